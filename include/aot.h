@@ -0,0 +1,634 @@
+#ifndef LISP_AOT_H
+#define LISP_AOT_H
+
+#include "atom.h"
+#include "builtin.h"
+#include "compiler.h"
+#include "eval.h"
+#include "parser.h"
+#include "tokenizer.h"
+
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Ahead of time translation of a program to C++ (lisp --emit-cpp), built against runtime.h
+ * Every top level expression becomes a function & every lambda a struct of the variables it
+ * captures, called with its parameters. Expressions are evaluated into temporaries in the order of
+ * the tree walker. A call of an arithmetic built-in function the program never redefines is a C++
+ * operator on integers, a call of a global the program defines once, to a lambda at the top level,
+ * calls its struct directly. A file imported at the top level is translated in place when it can
+ * be read while translating, so the binary does not need it. Macros are expanded while translating,
+ * by the macros defined at the top level before the expression. A top level expression with a form
+ * the translator does not handle (define or import in a lambda, future, profile, defmacro,
+ * quasiquote, malformed forms) or whose macros can only be expanded by the program running is left
+ * to the tree walker as a whole.
+ */
+namespace aot {
+	class Translator {
+		// a form left to the tree walker
+		struct Unsupported {};
+
+		// the result of the statements emitted so far, the value of an integer constant
+		struct Value {
+			std::string         code;
+			std::optional<long> integer;
+		};
+
+		// a lambda being translated, the innermost first
+		struct Scope {
+			std::vector<std::string> params;
+			std::vector<std::string> captured; // variables of the enclosing lambdas it uses
+			Scope*                   parent = nullptr;
+		};
+
+		// the body of a C++ function being emitted
+		class Function {
+			std::string m_code;
+			size_t      m_indent = 2, m_temps = 0;
+
+		  public:
+			void line(const std::string& text) { m_code += std::string(m_indent, '\t') + text + "\n"; }
+			void indent() { m_indent++; }
+			void dedent() { m_indent--; }
+			std::string temp() { return "t" + std::to_string(m_temps++); }
+			[[nodiscard]] const std::string& code() const { return m_code; }
+		};
+
+		// a top level expression, an import translated in place holds the expressions of the file
+		struct Form {
+			Atom              expr;
+			size_t            sequence = 0; // the order the expressions are evaluated in
+			std::string       module;
+			std::vector<Form> forms;
+			bool              expanded = true; // false when expanding a macro raised an error
+		};
+
+		struct Definition {
+			size_t                count = 0;
+			std::optional<size_t> lambda; // the form of a top level (define name (lambda ...))
+		};
+
+		std::vector<Form>                 m_forms;
+		std::set<std::string>             m_modules;
+		std::map<std::string, Definition> m_definitions;
+		bool                              m_open     = false; // an import may define any name
+		size_t                            m_sequence = 0;
+		Interpreter                       m_expander {builtin::table()}; // runs the expanders of the macros
+
+		std::vector<std::string>                 m_constants;
+		std::vector<std::string>                 m_globals;
+		std::map<std::string, size_t>            m_globalIndex;
+		size_t                                   m_sites = 0;
+		std::vector<std::string>                 m_structs;   // in the order they are completed
+		std::vector<std::string>                 m_methods;   // of the structs, which may call each other
+		std::vector<std::pair<size_t, size_t>>   m_lambdas;   // code constant & arity of every struct
+		std::map<std::string, size_t>            m_direct;    // globals bound to the lambda of a struct
+		std::vector<std::string>                 m_functions;
+		size_t                                   m_formCount = 0;
+		// the top level (define name (lambda ...)) being translated
+		std::optional<std::pair<std::string, size_t>> m_defining;
+
+		/** Text **/
+		static std::string literal(const std::string& text) {
+			std::ostringstream os;
+			os << '"';
+			for(unsigned char c: text) {
+				if(c == '"' || c == '\\')
+					os << '\\' << c;
+				else if(c >= 0x20 && c < 0x7F)
+					os << c;
+				else
+					os << '\\' << std::oct << std::setw(3) << std::setfill('0') << int(c) << std::dec;
+			}
+			os << '"';
+			if(text.find('\0') != std::string::npos)
+				return "std::string(" + os.str() + ", " + std::to_string(text.size()) + ")";
+			return os.str();
+		}
+
+		static std::string integer(long value) {
+			if(value == std::numeric_limits<long>::min())
+				return "std::numeric_limits<long>::min()";
+			return "(" + std::to_string(value) + "L)";
+		}
+
+		static std::string rational(double value) {
+			if(std::isnan(value))
+				return "std::numeric_limits<double>::quiet_NaN()";
+			if(std::isinf(value))
+				return value < 0 ? "-std::numeric_limits<double>::infinity()" : "std::numeric_limits<double>::infinity()";
+			std::ostringstream os;
+			os << std::hexfloat << value;
+			return os.str();
+		}
+
+		// a C++ identifier for a lisp name
+		static std::string mangle(const std::string& name) {
+			std::ostringstream os;
+			os << "v_";
+			for(unsigned char c: name) {
+				if(std::isalnum(c))
+					os << c;
+				else if(c == '_')
+					os << "__";
+				else
+					os << '_' << std::hex << std::setw(2) << std::setfill('0') << int(c) << std::dec;
+			}
+			return os.str();
+		}
+
+		// an expression in lisp notation for a comment
+		static std::string show(const Atom& expr, size_t limit = 100) {
+			std::ostringstream os;
+			print(os, expr);
+			std::string text = os.str();
+			for(auto& c: text) {
+				if(c == '\n' || c == '\r' || c == '\\') // a backslash ending the line would continue the comment
+					c = ' ';
+			}
+			return text.size() > limit ? text.substr(0, limit - 3) + "..." : text;
+		}
+		static void print(std::ostream& os, const Atom& expr) {
+			if(expr.type != Type::Pair) {
+				if(expr.isNil())
+					os << "nil";
+				else
+					os << expr;
+				return;
+			}
+			os << "(";
+			Atom p = expr;
+			for(bool first = true; p.type == Type::Pair; p = p.cdr(), first = false) {
+				os << (first ? "" : " ");
+				print(os, p.car());
+			}
+			if(!p.isNil()) {
+				os << " . ";
+				print(os, p);
+			}
+			os << ")";
+		}
+
+		/** Analysis **/
+		static std::optional<std::string> importPath(const Atom& expr) {
+			if(expr.type != Type::Pair || !Atom(expr).isProperList() || expr.car().type != Type::Symbol || compiler::keyword(expr.car()) != "IMPORT")
+				return std::nullopt;
+			if(!argumentCountIs(1, expr.cdr()) || expr.cdr().car().type != Type::Symbol)
+				return std::nullopt;
+			std::error_code error;
+			std::string     path = std::filesystem::weakly_canonical(*expr.cdr().car().symbol(), error).string();
+			if(error || !std::filesystem::is_regular_file(path))
+				return std::nullopt;
+			return path;
+		}
+
+		// the names expr may define, whether it may import
+		void scan(const Atom& expr) {
+			if(expr.type != Type::Pair || !Atom(expr).isProperList())
+				return;
+			if(expr.car().type == Type::Symbol) {
+				std::string word = compiler::keyword(expr.car());
+				if(word == "QUOTE")
+					return;
+				if(word == "IMPORT")
+					m_open = true;
+				if(word == "DEFINE" && argumentCountIs(2, expr.cdr()) && expr.cdr().car().type == Type::Symbol)
+					m_definitions[*expr.cdr().car().symbol()].count++;
+			}
+			for(Atom p = expr; !p.isNil(); p = p.cdr())
+				scan(p.car());
+		}
+
+		static bool isLambdaDefinition(const Atom& expr) {
+			if(expr.type != Type::Pair || !Atom(expr).isProperList() || expr.car().type != Type::Symbol || compiler::keyword(expr.car()) != "DEFINE")
+				return false;
+			Atom args = expr.cdr();
+			if(!argumentCountIs(2, args) || args.car().type != Type::Symbol)
+				return false;
+			Atom value = args.cdr().car();
+			return value.type == Type::Pair && value.car().type == Type::Symbol && compiler::keyword(value.car()) == "LAMBDA";
+		}
+
+		// expand the macros of a top level expression as lisp would, defining the macro of a defmacro
+		bool expand(Atom& expr) {
+			try {
+				expandMacros(m_expander, expr);
+				if(isForm(expr, "DEFMACRO"))
+					::eval(m_expander, expr, m_expander.global());
+				return true;
+			} catch(RunTimeError&) {
+				// eg. an expander calling a function of the program, the program expands it when it runs
+				return false;
+			}
+		}
+
+		void collect(const Atom& program, std::vector<Form>& forms) {
+			for(Atom p = program; !p.isNil(); p = p.cdr()) {
+				Form form {p.car(), m_sequence++};
+				if(auto path = importPath(form.expr)) {
+					form.module = *path;
+					if(m_modules.insert(*path).second) {
+						Source source(sourceFromFile(*path), *form.expr.cdr().car().symbol());
+						auto   tokens = tokenizer(source);
+						collect(::program(tokens, source), form.forms);
+					}
+				} else {
+					form.expanded = expand(form.expr);
+					scan(form.expr);
+					if(isLambdaDefinition(form.expr))
+						m_definitions[*form.expr.cdr().car().symbol()].lambda = form.sequence;
+				}
+				forms.push_back(std::move(form));
+			}
+		}
+
+		// whether a global is bound to the built-in function of its name for the whole program
+		bool unshadowed(const std::string& name) const { return !m_open && !m_definitions.count(name); }
+
+		// the struct a global is bound to from now on, when called from scope
+		std::optional<size_t> direct(const std::string& name, const Scope* scope) const {
+			auto definition = m_definitions.find(name);
+			if(m_open || definition == m_definitions.end() || definition->second.count != 1)
+				return std::nullopt;
+			if(auto it = m_direct.find(name); it != m_direct.end())
+				return it->second;
+			// a lambda can't run before the define of its own top level expression bound it
+			if(m_defining && m_defining->first == name && scope)
+				return m_defining->second;
+			return std::nullopt;
+		}
+
+		static bool isParam(const std::string& name, const Scope* scope) {
+			for(; scope; scope = scope->parent) {
+				if(std::count(scope->params.begin(), scope->params.end(), name))
+					return true;
+			}
+			return false;
+		}
+
+		/** Emission **/
+		std::string datum(const Atom& expr) {
+			switch(expr.type) {
+			case Type::Nil: return "nil";
+			case Type::Integer: return "Atom(long" + integer(*expr.integer()) + ")";
+			case Type::Rational: return "Atom(double(" + rational(*expr.rational()) + "))";
+			case Type::Symbol: return "Atom(std::string(" + literal(*expr.symbol()) + "))";
+			case Type::String: return "Atom::fromString(" + literal(*expr.string()) + ")";
+			case Type::Pair: {
+				std::string items;
+				Atom        p = expr;
+				for(; p.type == Type::Pair; p = p.cdr())
+					items += (items.empty() ? "" : ", ") + datum(p.car());
+				return "runtime::list({" + items + "}" + (p.isNil() ? "" : ", " + datum(p)) + ")";
+			}
+			default: throw Unsupported(); // not produced by the parser
+			}
+		}
+
+		std::string constant(const Atom& expr) {
+			m_constants.push_back(datum(expr));
+			return "constant[" + std::to_string(m_constants.size() - 1) + "]";
+		}
+
+		std::string global(const std::string& name) {
+			auto [it, added] = m_globalIndex.emplace(name, m_globals.size());
+			if(added)
+				m_globals.push_back(name);
+			return "global[" + std::to_string(it->second) + "]";
+		}
+
+		Value reference(Function& fn, const std::string& name, Scope* scope) {
+			Scope* owner = scope;
+			while(owner && !std::count(owner->params.begin(), owner->params.end(), name))
+				owner = owner->parent;
+			if(owner) {
+				// every lambda in between passes the variable on
+				for(Scope* s = scope; s != owner; s = s->parent) {
+					if(!std::count(s->captured.begin(), s->captured.end(), name))
+						s->captured.push_back(name);
+				}
+				return {mangle(name)};
+			}
+			std::string t = fn.temp();
+			fn.line("const Atom " + t + " = " + global(name) + ".get(interp);");
+			return {t};
+		}
+
+		Value emit(Function& fn, const Atom& expr, Scope* scope) {
+			switch(expr.type) {
+			case Type::Nil: return {"nil"};
+			case Type::Integer: return {"Atom(long" + integer(*expr.integer()) + ")", *expr.integer()};
+			case Type::Rational: return {"Atom(double(" + rational(*expr.rational()) + "))"};
+			case Type::String: return {constant(expr)};
+			case Type::Symbol: return reference(fn, *expr.symbol(), scope);
+			case Type::Pair: break;
+			default: throw Unsupported();
+			}
+			if(!Atom(expr).isProperList())
+				throw Unsupported();
+			Atom op   = expr.car();
+			Atom args = expr.cdr();
+			if(op.type == Type::Symbol) {
+				std::string word = compiler::keyword(op);
+				if(word == "QUOTE") {
+					if(!argumentCountIs(1, args))
+						throw Unsupported();
+					return {constant(args.car())};
+				}
+				if(word == "DEFINE") {
+					// a define in a lambda binds in its frame
+					if(scope || !argumentCountIs(2, args) || args.car().type != Type::Symbol)
+						throw Unsupported();
+					Value       value = emit(fn, args.cdr().car(), scope);
+					std::string t     = fn.temp();
+					fn.line("const Atom " + t + " = runtime::define(interp, " + literal(*args.car().symbol()) + ", " + value.code + ");");
+					return {t};
+				}
+				if(word == "LAMBDA")
+					return lambda(fn, args, scope);
+				if(word == "IF") {
+					if(!argumentCountIs(3, args))
+						throw Unsupported();
+					std::string condition = test(fn, args.car(), scope);
+					std::string t         = fn.temp();
+					fn.line("Atom " + t + ";");
+					fn.line("if(" + condition + ") {");
+					fn.indent();
+					fn.line(t + " = " + emit(fn, args.cdr().car(), scope).code + ";");
+					fn.dedent();
+					fn.line("} else {");
+					fn.indent();
+					fn.line(t + " = " + emit(fn, args.cdr().cdr().car(), scope).code + ";");
+					fn.dedent();
+					fn.line("}");
+					return {t};
+				}
+				if(compiler::isSpecialForm(word))
+					throw Unsupported();
+				const std::string& name = std::get<std::string>(op.value);
+				if(!isParam(name, scope)) {
+					auto primitive = compiler::primitiveOf(name);
+					if(primitive && unshadowed(name) && argumentCountIs(2, args)) {
+						Value       lhs = emit(fn, args.car(), scope);
+						Value       rhs = emit(fn, args.cdr().car(), scope);
+						std::string t   = fn.temp();
+						if(*primitive == compiler::Primitive::Eq || *primitive == compiler::Primitive::Less)
+							fn.line("const Atom " + t + " = " + comparison(*primitive, lhs, rhs) + " ? runtime::t : nil;");
+						else
+							fn.line("const Atom " + t + " = " + arithmetic(*primitive, lhs, rhs) + ";");
+						return {t};
+					}
+					if(auto index = direct(name, scope); index && argumentCountIs(m_lambdas[*index].second, args)) {
+						std::string call = "Lambda" + std::to_string(*index) + "{}(interp";
+						for(Atom p = args; !p.isNil(); p = p.cdr())
+							call += ", " + emit(fn, p.car(), scope).code;
+						std::string t = fn.temp();
+						fn.line("const Atom " + t + " = " + call + ");");
+						return {t};
+					}
+				}
+			}
+			Value       callee = emit(fn, op, scope);
+			std::string values;
+			for(Atom p = args; !p.isNil(); p = p.cdr())
+				values += (values.empty() ? "" : ", ") + emit(fn, p.car(), scope).code;
+			std::string t = fn.temp();
+			fn.line("const Atom " + t + " = site[" + std::to_string(m_sites++) + "](interp, " + callee.code + ", {" + values + "});");
+			return {t};
+		}
+
+		// a C++ condition true unless expr is nil
+		std::string test(Function& fn, const Atom& expr, Scope* scope) {
+			if(expr.type == Type::Pair && Atom(expr).isProperList() && expr.car().type == Type::Symbol && argumentCountIs(2, expr.cdr())) {
+				const std::string& name      = std::get<std::string>(expr.car().value);
+				auto               primitive = compiler::primitiveOf(name);
+				if((primitive == compiler::Primitive::Eq || primitive == compiler::Primitive::Less) && unshadowed(name) && !isParam(name, scope)) {
+					Value       lhs = emit(fn, expr.cdr().car(), scope);
+					Value       rhs = emit(fn, expr.cdr().cdr().car(), scope);
+					std::string c   = fn.temp();
+					fn.line("const bool " + c + " = " + comparison(*primitive, lhs, rhs) + ";");
+					return c;
+				}
+			}
+			return "!" + emit(fn, expr, scope).code + ".isNil()";
+		}
+
+		static std::string operand(const Value& value) {
+			return value.integer ? integer(*value.integer) : "std::get<long>(" + value.code + ".value)";
+		}
+
+		// integer operands are tested unless constant, others are left to the built-in function
+		static std::string guard(const Value& lhs, const Value& rhs) {
+			std::string guard;
+			for(auto* value: {&lhs, &rhs}) {
+				if(!value->integer)
+					guard += (guard.empty() ? "" : " && ") + value->code + ".type == Type::Integer";
+			}
+			return guard;
+		}
+
+		static std::string fallback(const char* builtin, const Value& lhs, const Value& rhs) {
+			return std::string("builtin::") + builtin + "(interp, Atom(" + lhs.code + ", Atom(" + rhs.code + ", nil)))";
+		}
+
+		static std::string arithmetic(compiler::Primitive primitive, const Value& lhs, const Value& rhs) {
+			const char* op      = "+";
+			const char* builtin = "add";
+			switch(primitive) {
+			case compiler::Primitive::Sub: op = "-", builtin = "sub"; break;
+			case compiler::Primitive::Mul: op = "*", builtin = "mul"; break;
+			case compiler::Primitive::Div: op = "/", builtin = "div"; break;
+			default: break;
+			}
+			std::string condition = guard(lhs, rhs);
+			if(primitive == compiler::Primitive::Div) {
+				if(rhs.integer == 0L)
+					return fallback(builtin, lhs, rhs);
+				if(!rhs.integer)
+					condition += " && " + operand(rhs) + " != 0";
+			}
+			std::string inline_ = "Atom(long(" + operand(lhs) + " " + op + " " + operand(rhs) + "))";
+			return condition.empty() ? inline_ : "(" + condition + " ? " + inline_ + " : " + fallback(builtin, lhs, rhs) + ")";
+		}
+
+		static std::string comparison(compiler::Primitive primitive, const Value& lhs, const Value& rhs) {
+			bool        less    = primitive == compiler::Primitive::Less;
+			std::string inline_ = operand(lhs) + (less ? " < " : " == ") + operand(rhs);
+			std::string condition = guard(lhs, rhs);
+			if(condition.empty())
+				return "(" + inline_ + ")";
+			return "(" + condition + " ? " + inline_ + " : !" + fallback(less ? "less" : "eq", lhs, rhs) + ".isNil())";
+		}
+
+		Value lambda(Function& fn, const Atom& args, Scope* scope) {
+			if(!argumentCountIs(2, args))
+				throw Unsupported();
+			Scope inner {.parent = scope};
+			for(Atom p = args.car(); !p.isNil(); p = p.cdr()) {
+				if(p.type != Type::Pair || p.car().type != Type::Symbol || std::count(inner.params.begin(), inner.params.end(), *p.car().symbol()))
+					throw Unsupported();
+				inner.params.push_back(*p.car().symbol());
+			}
+			size_t index = m_lambdas.size();
+			m_lambdas.emplace_back(0, inner.params.size());
+			if(m_defining && !scope && m_defining->second == SIZE_MAX)
+				m_defining->second = index;
+
+			Function    body;
+			Value       result = emit(body, args.cdr().car(), &inner);
+			std::string code   = constant(args);
+			m_lambdas[index].first = m_constants.size() - 1;
+
+			std::string name = "Lambda" + std::to_string(index), params, arguments;
+			for(size_t i = 0; i < inner.params.size(); i++) {
+				params += ", const Atom& " + mangle(inner.params[i]);
+				arguments += ", args[" + std::to_string(i) + "]";
+			}
+			std::ostringstream declaration, definition;
+			declaration << "\t// (lambda " << show(args).substr(1) << "\n";
+			declaration << "\tstruct " << name << " {\n";
+			for(auto& captured: inner.captured)
+				declaration << "\t\tAtom " << mangle(captured) << ";\n";
+			if(!inner.captured.empty())
+				declaration << "\n";
+			declaration << "\t\tAtom        operator()(Interpreter& interp" << params << ") const;\n";
+			declaration << "\t\tstatic Atom entry(Interpreter& interp, const Atom& closure, const Atom* args);\n";
+			declaration << "\t};\n";
+			definition << "\tAtom " << name << "::operator()(Interpreter& interp" << params << ") const {\n";
+			definition << body.code() << "\t\treturn " << result.code << ";\n\t}\n\n";
+			definition << "\tAtom " << name << "::entry(Interpreter& interp, const Atom& closure, const Atom* args) {\n";
+			if(inner.captured.empty()) {
+				definition << "\t\treturn " << name << "{}(interp" << arguments << ");\n";
+			} else {
+				definition << "\t\t" << name << " self;\n";
+				definition << "\t\tAtom captured = closure.car().cdr();\n";
+				for(auto& captured: inner.captured)
+					definition << "\t\tself." << mangle(captured) << " = runtime::next(captured);\n";
+				definition << "\t\treturn self(interp" << arguments << ");\n";
+			}
+			definition << "\t}\n";
+			m_structs.push_back(declaration.str());
+			m_methods.push_back(definition.str());
+
+			std::string captured;
+			for(auto& name: inner.captured)
+				captured += (captured.empty() ? "{" : ", {") + literal(name) + ", " + reference(fn, name, scope).code + "}";
+			std::string t = fn.temp();
+			fn.line("const Atom " + t + " = runtime::closure(interp, " + code + ", {" + captured + "});");
+			return {t};
+		}
+
+		// the name of the function evaluating a form
+		std::string form(const Form& form) {
+			std::vector<std::string> forms;
+			for(auto& inner: form.forms)
+				forms.push_back(this->form(inner));
+			std::string        name = "form" + std::to_string(m_formCount++);
+			std::ostringstream text;
+			text << "\t// " << show(form.expr) << "\n";
+			text << "\tAtom " << name << "(Interpreter& interp) {\n";
+			if(!form.module.empty()) {
+				// as import does, the module is registered before it is evaluated
+				text << "\t\tif(auto module = interp.modules().find(" << literal(form.module) << "))\n";
+				text << "\t\t\treturn *module;\n";
+				text << "\t\tinterp.modules().add(" << literal(form.module) << ");\n";
+				text << "\t\tAtom result;\n";
+				for(auto& inner: forms)
+					text << "\t\tresult = " << inner << "(interp);\n";
+				text << "\t\tinterp.modules().add(" << literal(form.module) << ", result);\n";
+				text << "\t\treturn result;\n";
+			} else {
+				size_t structs = m_structs.size(), lambdas = m_lambdas.size();
+				m_defining.reset();
+				if(isLambdaDefinition(form.expr))
+					m_defining.emplace(*form.expr.cdr().car().symbol(), SIZE_MAX);
+				try {
+					if(!form.expanded)
+						throw Unsupported();
+					Function fn;
+					Value    result = emit(fn, form.expr, nullptr);
+					text << fn.code();
+					text << "\t\treturn " << result.code << ";\n";
+					if(m_defining && m_definitions[m_defining->first].lambda == form.sequence)
+						m_direct.emplace(m_defining->first, m_defining->second);
+				} catch(Unsupported&) {
+					m_structs.resize(structs);
+					m_methods.resize(structs);
+					m_lambdas.resize(lambdas);
+					text << "\t\treturn runtime::evaluate(interp, " << constant(form.expr) << ");\n";
+				}
+				m_defining.reset();
+			}
+			text << "\t}\n";
+			m_functions.push_back(text.str());
+			return name;
+		}
+
+	  public:
+		/**
+		 * The C++ source of a program
+		 * @param program the top level expressions
+		 * @param name the file the program was read from
+		 */
+		std::string translate(const Atom& program, const std::string& name) {
+			collect(program, m_forms);
+			std::vector<std::string> forms;
+			for(auto& form: m_forms)
+				forms.push_back(this->form(form));
+
+			std::ostringstream os;
+			os << "// Translated from " << name << " by lisp --emit-cpp, build it with the lisp_runtime library\n";
+			os << "#include \"runtime.h\"\n\n";
+			os << "namespace {\n";
+			if(!m_constants.empty())
+				os << "\tAtom constant[" << m_constants.size() << "];\n";
+			if(!m_globals.empty()) {
+				os << "\truntime::Global global[] = {";
+				for(size_t i = 0; i < m_globals.size(); i++)
+					os << (i ? ", " : "") << "runtime::Global(" << literal(m_globals[i]) << ")";
+				os << "};\n";
+			}
+			if(m_sites)
+				os << "\truntime::CallSite site[" << m_sites << "];\n";
+			for(auto& text: m_structs)
+				os << "\n" << text;
+			for(auto& text: m_methods)
+				os << "\n" << text;
+			for(auto& text: m_functions)
+				os << "\n" << text;
+			os << "\n\tvoid initialize() {\n";
+			for(size_t i = 0; i < m_constants.size(); i++)
+				os << "\t\tconstant[" << i << "] = " << m_constants[i] << ";\n";
+			os << "\t}\n";
+			os << "} // namespace\n\n";
+			os << "int main() {\n";
+			os << "\tinitialize();\n";
+			os << "\treturn runtime::run({";
+			for(size_t i = 0; i < forms.size(); i++)
+				os << (i ? ", " : "") << forms[i];
+			os << "}, {";
+			for(size_t i = 0; i < m_lambdas.size(); i++)
+				os << (i ? ", " : "") << "{&constant[" << m_lambdas[i].first << "], " << m_lambdas[i].second << ", &Lambda" << i << "::entry}";
+			os << "});\n";
+			os << "}\n";
+			return os.str();
+		}
+	};
+
+	/** The C++ source of the program in a source **/
+	inline std::string translate(const Source& source) {
+		auto tokens = tokenizer(source);
+		return Translator().translate(program(tokens, source), source.name());
+	}
+} // namespace aot
+
+#endif //LISP_AOT_H
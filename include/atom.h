@@ -1,12 +1,16 @@
 #ifndef LISP_ATOM_H
 #define LISP_ATOM_H
 
+#include "memory.h"
+
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <ostream>
 #include <string>
-#include <unordered_map>
+#include <utility>
 #include <variant>
+#include <vector>
 
 /**
  * Type system
@@ -19,11 +23,25 @@ enum class Type {
     Pair,
     // functions
 	Builtin,
-	Closure // user defined
+	Closure, // user defined
+	// asynchronous evaluation
+	Future,
+	Task, // green thread
+	Channel,
+	// text & I/O, appended so serialized type tags stay stable
+	String,
+	Port,
+	Namespace // bindings of the global environment
 };
 
 struct Pair;
+struct Future;
+struct Task;
+struct Channel;
+class Port;
+class Namespace;
 class Environment;
+class Interpreter;
 class iterator;
 
 /**
@@ -33,13 +51,18 @@ class iterator;
 class Atom {
   public:
 
-	typedef Atom (*builtin_t)(Atom args);
+	typedef Atom (*builtin_t)(Interpreter& interp, Atom args);
 	using ValueType = std::variant<
 		std::shared_ptr<Pair>, // pair
-		std::string,           // symbol
+		std::string,           // symbol & string
 		long,                  // integer
-		double,                // rational
-		builtin_t              // built-in functions
+		double,                 // rational
+		builtin_t,              // built-in functions
+		std::shared_ptr<Future>, // future
+		std::shared_ptr<Task>,   // green thread
+		std::shared_ptr<Channel>, // channel
+		std::shared_ptr<Port>,     // port
+		std::shared_ptr<Namespace> // namespace
 		>;
 	Type      type;
 	ValueType value;
@@ -53,6 +76,12 @@ class Atom {
 	[[nodiscard]] std::optional<double>      rational() const;
 	[[nodiscard]] std::optional<Pair>        pair() const;
 	[[nodiscard]] std::optional<builtin_t>   builtin() const;
+	[[nodiscard]] std::optional<std::shared_ptr<Future>> future() const;
+	[[nodiscard]] std::optional<std::shared_ptr<Task>>   task() const;
+	[[nodiscard]] std::optional<std::shared_ptr<Channel>> channel() const;
+	[[nodiscard]] std::optional<std::string>              string() const;
+	[[nodiscard]] std::optional<std::shared_ptr<Port>>    port() const;
+	[[nodiscard]] std::optional<std::shared_ptr<Namespace>> ns() const;
 	[[nodiscard]] std::optional<Pair*>       pairPtr();
 	// Get first element of the list
 	[[nodiscard]] Atom& car() const;
@@ -69,6 +98,10 @@ class Atom {
 	explicit Atom(std::string symbol);
 	// construct a Pair atom
 	Atom(const Atom& car, const Atom& cdr);
+	// construct a Pair atom in the region of the calling thread, for pairs dying with their call (see region.h)
+	static Atom local(const Atom& car, const Atom& cdr);
+	// construct the list of items ending in tail, its pairs next to each other (see compact.h)
+	static Atom list(const std::vector<Atom>& items, const Atom& tail);
     // construct a Builtin function atom
 	explicit Atom(builtin_t fn):
 		value(fn), type(Type::Builtin) {}
@@ -78,6 +111,29 @@ class Atom {
 	// construct a Rational atom
 	explicit Atom(double rational):
 		value(rational), type(Type::Rational) {}
+	// construct a Future atom
+	explicit Atom(std::shared_ptr<Future> future):
+		value(std::move(future)), type(Type::Future) {}
+	// construct a Task atom
+	explicit Atom(std::shared_ptr<Task> task):
+		value(std::move(task)), type(Type::Task) {}
+	// construct a Channel atom
+	explicit Atom(std::shared_ptr<Channel> channel):
+		value(std::move(channel)), type(Type::Channel) {}
+	// construct a Port atom
+	explicit Atom(std::shared_ptr<Port> port):
+		value(std::move(port)), type(Type::Port) {}
+	// construct a Namespace atom
+	explicit Atom(std::shared_ptr<Namespace> ns):
+		value(std::move(ns)), type(Type::Namespace) {}
+	// construct a String atom, the std::string constructor creates symbols
+	static Atom fromString(std::string str) {
+		memory::allocated(memory::Kind::String, 0);
+		Atom atom;
+		atom.value = std::move(str);
+		atom.type  = Type::String;
+		return atom;
+	}
 	// construct a Nil atom
 //	explicit Atom(Type _type = Type::Nil):
 //		value(0), type(_type) {}
@@ -114,13 +170,34 @@ class Atom {
 
 struct Pair {
 	Pair(const Atom& _car, const Atom& _cdr):
-		car(_car), cdr(_cdr) {}
+		car(_car), cdr(_cdr) { memory::allocated(memory::Kind::Pair, allocationSize); }
+	Pair(const Pair& pair):
+		car(pair.car), cdr(pair.cdr) { memory::allocated(memory::Kind::Pair, allocationSize); }
+	// destroys the rest of a list iteratively, recursing would overflow the stack on long lists
+	~Pair() {
+		memory::freed(memory::Kind::Pair, allocationSize);
+		std::shared_ptr<Pair> next;
+		if(auto* rest = std::get_if<std::shared_ptr<Pair>>(&cdr.value))
+			next = std::move(*rest);
+		while(next && next.use_count() == 1) {
+			std::shared_ptr<Pair> after;
+			if(auto* rest = std::get_if<std::shared_ptr<Pair>>(&next->cdr.value))
+				after = std::move(*rest);
+			next = std::move(after);
+		}
+	}
 	Atom car, cdr;
+
+	// with the reference counts make_shared allocates alongside
+	static const size_t allocationSize;
 };
+inline const size_t Pair::allocationSize = sizeof(Pair) + 2 * sizeof(int) + sizeof(void*);
 
-static Atom nil = Atom();
+// a single immutable nil shared by every translation unit & interpreter
+inline const Atom nil = Atom();
 
-static std::unordered_map<std::string, Atom> symbolTable;
+// built-in functions by the name they are bound to
+using BuiltinTable = std::vector<std::pair<std::string, Atom::builtin_t>>;
 
 inline std::ostream& operator<<(std::ostream& os, const Atom& atom) {
 	switch(atom.type) {
@@ -147,8 +224,36 @@ inline std::ostream& operator<<(std::ostream& os, const Atom& atom) {
 		os << "<BUILTIN%>" << *atom.builtin();
 		break;
     case Type::Closure:
-        os << "<CLOSURE%>" << *atom.builtin();
+        os << "<CLOSURE%>" << std::get<std::shared_ptr<Pair>>(atom.value).get();
         break;
+	case Type::Future:
+		os << "<FUTURE%>" << atom.future()->get();
+		break;
+	case Type::Task:
+		os << "<TASK%>" << atom.task()->get();
+		break;
+	case Type::Channel:
+		os << "<CHANNEL%>" << atom.channel()->get();
+		break;
+	case Type::String:
+		os << '"';
+		for(char c: std::get<std::string>(atom.value)) {
+			switch(c) {
+			case '"': os << "\\\""; break;
+			case '\\': os << "\\\\"; break;
+			case '\n': os << "\\n"; break;
+			case '\t': os << "\\t"; break;
+			default: os << c;
+			}
+		}
+		os << '"';
+		break;
+	case Type::Port:
+		os << "<PORT%>" << atom.port()->get();
+		break;
+	case Type::Namespace:
+		os << "<NAMESPACE%>" << atom.ns()->get();
+		break;
 	}
 	return os;
 }
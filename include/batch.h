@@ -0,0 +1,187 @@
+#ifndef LISP_BATCH_H
+#define LISP_BATCH_H
+
+#include "atom.h"
+#include "debug.h"
+#include "environment.h"
+#include "eval.h"
+#include "interpreter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Batch evaluation of independent scripts by forked workers
+ * The interpreter is prepared (eg. with a large prelude) once, in the parent, the workers forked
+ * from it share that heap copy-on-write, so a script starts without rebuilding anything. The work
+ * queue and the results live in an anonymous shared mapping: a worker claims the next script with
+ * an atomic increment and writes its result record in place, no other communication is needed.
+ * Every script is evaluated in a fresh environment on top of the prepared global environment.
+ */
+namespace batch {
+	enum class Status : std::uint32_t {
+		Pending, // not run, or its worker died while running it
+		Ok,
+		Error,
+		Timeout
+	};
+
+	struct Options {
+		size_t                                   workers = std::max(1u, std::thread::hardware_concurrency());
+		std::optional<std::chrono::milliseconds> timeout;
+	};
+
+	// printed output & result of a script, truncated to fit the shared record
+	constexpr size_t maxResultSize = 1024;
+
+	struct Record {
+		Status        status      = Status::Pending;
+		std::uint64_t nanoseconds = 0;
+		std::uint32_t length      = 0;
+		bool          truncated   = false;
+		char          text[maxResultSize];
+	};
+
+	struct Result {
+		std::string              script;
+		Status                   status;
+		std::chrono::nanoseconds duration;
+		std::string              text;
+	};
+
+	// the shared mapping starts with the index of the next unclaimed script, a record per script follows
+	struct Queue {
+		std::atomic<size_t> next = 0;
+	};
+	static_assert(std::atomic<size_t>::is_always_lock_free, "the work queue is shared between processes");
+	static_assert(sizeof(Queue) % alignof(Record) == 0);
+
+	inline void store(Record& record, Status status, std::chrono::nanoseconds duration, const std::string& text) {
+		record.length    = std::min(text.size(), maxResultSize);
+		record.truncated = text.size() > maxResultSize;
+		std::memcpy(record.text, text.data(), record.length);
+		record.nanoseconds = duration.count();
+		record.status      = status; // last, a record is complete once its status is set
+	}
+
+	inline void run(Interpreter& interp, const std::string& script, Record& record, const Options& options) {
+		std::stringstream in, out;
+		std::istream&     oldIn  = interp.in();
+		std::ostream &    oldOut = interp.out(), &oldErr = interp.err();
+		interp.setPorts(in, out, out);
+		Status status = Status::Ok;
+		auto   start  = std::chrono::steady_clock::now();
+		if(options.timeout)
+			interp.setDeadline(start + *options.timeout);
+		try {
+			if(!std::filesystem::is_regular_file(script))
+				throw EvalError(nil, format("Failed to open file {}.", script));
+			MacroTable::Scope macros(interp.macros());
+			Environment       env(interp.global().atom());
+			Atom              result = interpret(interp, Source(sourceFromFile(script), script), env);
+			interp.scheduler().run();
+			out << result;
+		} catch(TimeoutError& err) {
+			status = Status::Timeout;
+			out << err.what();
+		} catch(ProgramError& err) {
+			status = Status::Error;
+			staticError(err, out);
+		} catch(RunTimeError& err) {
+			status = Status::Error;
+			out << err.what();
+		} catch(std::exception& err) {
+			status = Status::Error;
+			out << err.what();
+		}
+		interp.clearDeadline();
+		interp.setPorts(oldIn, oldOut, oldErr);
+		store(record, status, std::chrono::steady_clock::now() - start, out.str());
+	}
+
+	/**
+	 * Evaluate scripts with forked workers
+	 * @param interp the prepared interpreter, it may not have started its thread pool as
+	 * threads do not survive a fork
+	 * @param scripts paths of the scripts
+	 * @param options
+	 * @return the results in the order of scripts
+	 */
+	inline std::vector<Result> evaluate(Interpreter& interp, const std::vector<std::string>& scripts, const Options& options) {
+		if(interp.poolStarted())
+			throw EvalError(nil, "Batch workers can not be forked after parallel evaluation started threads");
+
+		size_t size   = sizeof(Queue) + scripts.size() * sizeof(Record);
+		void*  memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(memory == MAP_FAILED)
+			throw EvalError(nil, format("Failed to map the batch queue: {}", std::strerror(errno)));
+		auto* queue   = new(memory) Queue;
+		auto* records = reinterpret_cast<Record*>(static_cast<char*>(memory) + sizeof(Queue));
+		for(size_t i = 0; i < scripts.size(); i++)
+			new(&records[i]) Record;
+
+		// output buffered before the fork would be written by every worker
+		interp.out().flush();
+		interp.err().flush();
+		std::vector<pid_t> workers;
+		for(size_t w = 0; w < std::min(options.workers, scripts.size()); w++) {
+			pid_t pid = ::fork();
+			if(pid == 0) {
+				for(size_t i; (i = queue->next.fetch_add(1)) < scripts.size();)
+					run(interp, scripts[i], records[i], options);
+				::_exit(0); // skip the destructors & exit handlers of the parent's state
+			}
+			if(pid < 0)
+				break; // the workers which did start take over the remaining scripts
+			workers.push_back(pid);
+		}
+		// without any worker, evaluate in this process
+		if(workers.empty()) {
+			for(size_t i; (i = queue->next.fetch_add(1)) < scripts.size();)
+				run(interp, scripts[i], records[i], options);
+		}
+		for(pid_t pid: workers) {
+			int status;
+			while(::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+		}
+
+		std::vector<Result> results;
+		results.reserve(scripts.size());
+		for(size_t i = 0; i < scripts.size(); i++) {
+			Record&     record = records[i];
+			std::string text(record.text, record.length);
+			if(record.truncated)
+				text += "...";
+			if(record.status == Status::Pending)
+				text = "worker terminated";
+			results.push_back({scripts[i], record.status, std::chrono::nanoseconds(record.nanoseconds), std::move(text)});
+		}
+		::munmap(memory, size);
+		return results;
+	}
+
+	inline const char* toString(Status status) {
+		switch(status) {
+		case Status::Pending: return "failed";
+		case Status::Ok: return "ok";
+		case Status::Error: return "error";
+		case Status::Timeout: return "timeout";
+		}
+		return "unknown";
+	}
+} // namespace batch
+
+#endif //LISP_BATCH_H
@@ -3,10 +3,16 @@
 
 #include "debug.h"
 #include "atom.h"
+#include "channel.h"
 #include "eval.h"
+#include "port.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
 
 namespace builtin {
-    Atom car(Atom args) {
+    Atom car(Interpreter& interp, Atom args) {
         if(!argumentCountIs(1, args)) {
             throw EvalError(args, "Expected 1 argument for function 'car'");
         }
@@ -18,7 +24,7 @@ namespace builtin {
             return args.car().car();
         }
     }
-    Atom cdr(Atom args) {
+    Atom cdr(Interpreter& interp, Atom args) {
         if(!argumentCountIs(1, args)) {
             throw EvalError(args, "Expected 1 argument for function 'cdr'");
         }
@@ -31,11 +37,11 @@ namespace builtin {
         }
     }
 
-    Atom cons(Atom args) {
+    Atom cons(Interpreter& interp, Atom args) {
         if(!argumentCountIs(2, args)) {
             throw EvalError(args, "Expected 2 arguments for function 'cons'");
         }
-        return Atom(args.car(), args.cdr());
+        return Atom(args.car(), args.cdr().car());
     }
 
 /** Arithmetic **/
@@ -64,7 +70,7 @@ namespace builtin {
                atom.type == Type::Integer;
     }
 
-    Atom eq(Atom args) {
+    Atom eq(Interpreter& interp, Atom args) {
         if(!argumentCountIs(2, args)){
             throw EvalError(args, "Expected 2 arguments for binary '='");
         }
@@ -80,7 +86,7 @@ namespace builtin {
 		}() ? Atom("t") : nil;
     }
 
-    Atom less(Atom args) {
+    Atom less(Interpreter& interp, Atom args) {
         if(!argumentCountIs(2, args)){
             throw EvalError(args, "Expected 2 arguments for binary '='");
         }
@@ -96,7 +102,7 @@ namespace builtin {
         }() ? Atom("t") : nil;
     }
 
-    Atom add(Atom args) {
+    Atom add(Interpreter& interp, Atom args) {
         if(!argumentCountIs(2, args)) {
             throw EvalError(args, "Expected 2 arguments for binary '+'");
         }
@@ -106,7 +112,7 @@ namespace builtin {
             throw TypeError(args, format("invalid operands '{}' and '{}' to binary '+'", toString(lhs.type), toString(rhs.type)));
         BINARY_ARITHMETIC(lhs, rhs, +)
     }
-    Atom sub(Atom args) {
+    Atom sub(Interpreter& interp, Atom args) {
         if(!argumentCountIs(2, args)) {
             throw EvalError(args, "Expected 2 arguments for binary '-'");
         }
@@ -117,7 +123,7 @@ namespace builtin {
         BINARY_ARITHMETIC(lhs, rhs, -)
     }
 
-    Atom mul(Atom args) {
+    Atom mul(Interpreter& interp, Atom args) {
         if(!argumentCountIs(2, args)) {
             throw EvalError(args, "Expected 2 arguments for binary '*'");
         }
@@ -127,7 +133,7 @@ namespace builtin {
             throw TypeError(args, format("invalid operands '{}' and '{}' to binary '*'", toString(lhs.type), toString(rhs.type)));
         BINARY_ARITHMETIC(lhs, rhs, *)
     }
-    Atom div(Atom args) {
+    Atom div(Interpreter& interp, Atom args) {
         if(!argumentCountIs(2, args)) {
             throw EvalError(args, "Expected 2 arguments for binary '/'");
         }
@@ -140,18 +146,362 @@ namespace builtin {
 #undef BINARY_ARITHMETIC
 
 	/** I/O **/
-    Atom putchar(Atom args) {
+    // (putchar c) writes a character code, or the text of a symbol or string
+    Atom putchar(Interpreter& interp, Atom args) {
         if(!argumentCountIs(1, args)) {
             throw EvalError(args, "Expected 1 argument for function 'putchar'");
         }
-        putchar(args.car());
-        //std::cout << args.car();
+        Atom c = args.car();
+        if(c.type == Type::Integer) {
+            interp.out().put(char(*c.integer()));
+        } else if(c.type == Type::Symbol || c.type == Type::String) {
+            interp.out() << std::get<std::string>(c.value);
+        } else {
+            throw TypeError(args, format("invalid argument type '{}' to built-in function 'putchar'", toString(c.type)));
+        }
 		return nil;
     }
 
-    Atom getchar(Atom args) {
-        char c = ::getchar();
-		return Atom(std::string(1, c));
+    // (getchar) the code of the next input character, nil at the end of the input
+    Atom getchar(Interpreter& interp, Atom args) {
+        int c = interp.in().get();
+        if(c == EOF)
+            return nil;
+		return Atom(long(c));
+    }
+
+    // count arguments, the last of which, an optional port, may be missing
+    void checkPortArguments(const Atom& args, size_t count, const char* name) {
+        if(argumentCountIs(count, args) || argumentCountIs(count - 1, args))
+            return;
+        throw EvalError(args, format("Expected {} or {} argument(s) for function '{}'", count - 1, count, name));
+    }
+
+    // the port at position of args, nullptr to use the input/output of the interpreter
+    Port* portArgument(const Atom& args, size_t position, const char* name) {
+        Atom p = args;
+        for(size_t i = 0; i < position; i++)
+            p = p.cdr();
+        if(p.isNil())
+            return nullptr;
+        if(p.car().type != Type::Port) {
+            throw TypeError(args, format("invalid argument type '{}' mismatched with expected type '{}' to built-in function '{}'", toString(p.car().type), toString(Type::Port), name));
+        }
+        return p.car().port()->get();
+    }
+
+    Atom openFile(const Atom& args, Port::Mode mode, const char* name) {
+        if(!argumentCountIs(1, args)) {
+            throw EvalError(args, format("Expected 1 argument for function '{}'", name));
+        }
+        if(args.car().type != Type::String) {
+            throw TypeError(args, format("invalid argument type '{}' mismatched with expected type '{}' to built-in function '{}'", toString(args.car().type), toString(Type::String), name));
+        }
+        return Atom(std::make_shared<Port>(*args.car().string(), mode));
+    }
+
+    Atom openInputFile(Interpreter& interp, Atom args) {
+        return openFile(args, Port::Mode::Input, "open-input-file");
+    }
+
+    Atom openOutputFile(Interpreter& interp, Atom args) {
+        return openFile(args, Port::Mode::Output, "open-output-file");
+    }
+
+    // (read-line [port]) the next line as a string, nil at the end of the input
+    Atom readLine(Interpreter& interp, Atom args) {
+        checkPortArguments(args, 1, "read-line");
+        if(Port* port = portArgument(args, 0, "read-line")) {
+            auto line = port->readLine();
+            return line ? Atom::fromString(std::move(*line)) : nil;
+        }
+        std::string line;
+        if(!std::getline(interp.in(), line))
+            return nil;
+        return Atom::fromString(std::move(line));
+    }
+
+    // (read-bytes count [port]) up to count bytes as a string, nil at the end of the input
+    Atom readBytes(Interpreter& interp, Atom args) {
+        checkPortArguments(args, 2, "read-bytes");
+        if(args.car().type != Type::Integer || *args.car().integer() < 0) {
+            throw TypeError(args, "Expected a non-negative byte count for function 'read-bytes'");
+        }
+        size_t count = *args.car().integer();
+        if(Port* port = portArgument(args, 1, "read-bytes")) {
+            auto bytes = port->readBytes(count);
+            return bytes ? Atom::fromString(std::move(*bytes)) : nil;
+        }
+        std::string bytes(count, '\0');
+        interp.in().read(bytes.data(), std::streamsize(count));
+        bytes.resize(interp.in().gcount());
+        if(bytes.empty() && count > 0)
+            return nil;
+        return Atom::fromString(std::move(bytes));
+    }
+
+    // (write-string string [port])
+    Atom writeString(Interpreter& interp, Atom args) {
+        checkPortArguments(args, 2, "write-string");
+        if(args.car().type != Type::String) {
+            throw TypeError(args, format("invalid argument type '{}' mismatched with expected type '{}' to built-in function 'write-string'", toString(args.car().type), toString(Type::String)));
+        }
+        const auto& str = std::get<std::string>(args.car().value); // no copy of the string
+        if(Port* port = portArgument(args, 1, "write-string"))
+            port->write(str);
+        else
+            interp.out().write(str.data(), std::streamsize(str.size()));
+        return nil;
+    }
+
+    // (flush [port]) writes the buffered output
+    Atom flush(Interpreter& interp, Atom args) {
+        checkPortArguments(args, 1, "flush");
+        if(Port* port = portArgument(args, 0, "flush"))
+            port->flush();
+        else
+            interp.out().flush();
+        return nil;
+    }
+
+    Atom closePort(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(1, args)) {
+            throw EvalError(args, "Expected 1 argument for function 'close-port'");
+        }
+        portArgument(args, 0, "close-port")->close();
+        return nil;
+    }
+
+    /** Parallel **/
+    std::vector<Atom> toVector(const Atom& args, const Atom& list, const char* name) {
+        std::vector<Atom> items;
+        for(Atom p = list; !p.isNil(); p = p.cdr()) {
+            if(p.type != Type::Pair)
+                throw TypeError(args, format("Expected a proper list for function '{}'", name));
+            items.push_back(p.car());
+        }
+        return items;
+    }
+
+    Atom fromVector(const std::vector<Atom>& items) { return Atom::list(items, nil); }
+
+    // the optional grain size hint following the first n arguments, by default about 8 ranges per worker
+    size_t grainSize(Interpreter& interp, const Atom& args, size_t position, size_t n, const char* name) {
+        Atom hint = args;
+        for(size_t i = 0; i < position && !hint.isNil(); i++)
+            hint = hint.cdr();
+        if(hint.isNil())
+            return std::max<size_t>(1, n / (interp.pool().size() * 8));
+        hint = hint.car();
+        if(hint.isNil())
+            return std::max<size_t>(1, n / (interp.pool().size() * 8));
+        if(hint.type != Type::Integer || *hint.integer() < 1)
+            throw TypeError(args, format("Expected a positive grain size for function '{}'", name));
+        return *hint.integer();
+    }
+
+    // (pmap f list [grain]), the results keep the order of the list
+    Atom pmap(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(2, args) && !argumentCountIs(3, args)) {
+            throw EvalError(args, "Expected 2 or 3 arguments for function 'pmap'");
+        }
+        Atom fn    = args.car();
+        auto items = toVector(args, args.cdr().car(), "pmap");
+        std::vector<Atom> results(items.size());
+        interp.pool().parallelFor(items.size(), grainSize(interp, args, 2, items.size(), "pmap"), [&](size_t begin, size_t end) {
+            Atom f = fn;
+            for(size_t i = begin; i < end; i++)
+                results[i] = apply(interp, f, Atom(items[i], nil));
+        });
+        return fromVector(results);
+    }
+
+    // (pfor-each f list [grain]), for side effects only
+    Atom pforEach(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(2, args) && !argumentCountIs(3, args)) {
+            throw EvalError(args, "Expected 2 or 3 arguments for function 'pfor-each'");
+        }
+        Atom fn    = args.car();
+        auto items = toVector(args, args.cdr().car(), "pfor-each");
+        interp.pool().parallelFor(items.size(), grainSize(interp, args, 2, items.size(), "pfor-each"), [&](size_t begin, size_t end) {
+            Atom f = fn;
+            for(size_t i = begin; i < end; i++)
+                apply(interp, f, Atom(items[i], nil));
+        });
+        return nil;
+    }
+
+    // (preduce f init list [grain]), f has to be associative
+    // every range is folded on its own, the partial results are folded into init in list order
+    Atom preduce(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(3, args) && !argumentCountIs(4, args)) {
+            throw EvalError(args, "Expected 3 or 4 arguments for function 'preduce'");
+        }
+        Atom fn    = args.car();
+        auto items = toVector(args, args.cdr().cdr().car(), "preduce");
+        std::mutex                          lock;
+        std::vector<std::pair<size_t, Atom>> partials;
+        interp.pool().parallelFor(items.size(), grainSize(interp, args, 3, items.size(), "preduce"), [&](size_t begin, size_t end) {
+            Atom f   = fn;
+            Atom acc = items[begin];
+            for(size_t i = begin + 1; i < end; i++)
+                acc = apply(interp, f, Atom(acc, Atom(items[i], nil)));
+            std::lock_guard<std::mutex> guard(lock);
+            partials.emplace_back(begin, acc);
+        });
+        std::sort(partials.begin(), partials.end(), [](auto& lhs, auto& rhs) { return lhs.first < rhs.first; });
+        Atom acc = args.cdr().car();
+        for(auto& partial: partials)
+            acc = apply(interp, fn, Atom(acc, Atom(partial.second, nil)));
+        return acc;
+    }
+
+    /** Futures **/
+    std::shared_ptr<Future> futureArgument(const Atom& args, const char* name) {
+        if(!argumentCountIs(1, args)) {
+            throw EvalError(args, format("Expected 1 argument for function '{}'", name));
+        }
+        if(args.car().type != Type::Future) {
+            throw TypeError(args, format("invalid argument type '{}' mismatched with expected type '{}' to built-in function '{}'", toString(args.car().type), toString(Type::Future), name));
+        }
+        return *args.car().future();
+    }
+
+    // (touch f) waits for a future & returns its value, raising the error it raised
+    Atom touch(Interpreter& interp, Atom args) {
+        return futureArgument(args, "touch")->touch(interp.pool());
+    }
+
+    Atom futureReady(Interpreter& interp, Atom args) {
+        return futureArgument(args, "future-ready?")->ready ? Atom("t") : nil;
+    }
+
+    /** Green threads **/
+    // (spawn f) runs f without arguments as a new task
+    Atom spawn(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(1, args)) {
+            throw EvalError(args, "Expected 1 argument for function 'spawn'");
+        }
+        Atom fn = args.car();
+        if(fn.type != Type::Closure && fn.type != Type::Builtin) {
+            throw TypeError(args, format("Expected function, got {} for function 'spawn'", toString(fn.type)));
+        }
+        return Atom(interp.scheduler().spawn([&interp, fn]() mutable { return apply(interp, fn, nil); }));
+    }
+
+    Atom yield(Interpreter& interp, Atom args) {
+        interp.scheduler().yield();
+        return nil;
+    }
+
+    // (sleep milliseconds)
+    Atom sleep(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(1, args) || !isArithmetic(args.car())) {
+            throw EvalError(args, "Expected 1 numeric argument for function 'sleep'");
+        }
+        double ms = args.car().type == Type::Integer ? double(*args.car().integer()) : *args.car().rational();
+        interp.scheduler().sleep(std::chrono::nanoseconds(long(ms * 1e6)));
+        return nil;
+    }
+
+    // (join task) waits for a task & returns its result, raising the error it raised
+    Atom join(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(1, args)) {
+            throw EvalError(args, "Expected 1 argument for function 'join'");
+        }
+        if(args.car().type != Type::Task) {
+            throw TypeError(args, format("invalid argument type '{}' mismatched with expected type '{}' to built-in function 'join'", toString(args.car().type), toString(Type::Task)));
+        }
+        return interp.scheduler().join(*args.car().task());
+    }
+
+    /** Channels **/
+    std::shared_ptr<Channel> channelArgument(const Atom& args, size_t count, const char* name) {
+        if(!argumentCountIs(count, args)) {
+            throw EvalError(args, format("Expected {} argument(s) for function '{}'", count, name));
+        }
+        if(args.car().type != Type::Channel) {
+            throw TypeError(args, format("invalid argument type '{}' mismatched with expected type '{}' to built-in function '{}'", toString(args.car().type), toString(Type::Channel), name));
+        }
+        return *args.car().channel();
+    }
+
+    // while a channel is full/empty let the other green threads of this thread run, if any
+    void waitForChannel(Interpreter& interp) {
+        Scheduler& scheduler = interp.scheduler();
+        if(scheduler.drives() && scheduler.size() > 0)
+            scheduler.yield();
+        else
+            std::this_thread::yield();
+    }
+
+    Atom makeChannel(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(0, args)) {
+            throw EvalError(args, "Expected no arguments for function 'make-channel'");
+        }
+        return Atom(std::make_shared<Channel>());
+    }
+
+    // (send channel value) sends a copy of value, returns value
+    Atom send(Interpreter& interp, Atom args) {
+        auto channel = channelArgument(args, 2, "send");
+        Atom message = deepCopy(args.cdr().car());
+        while(!channel->queue.tryPush(std::move(message)))
+            waitForChannel(interp);
+        return args.cdr().car();
+    }
+
+    Atom receive(Interpreter& interp, Atom args) {
+        auto channel = channelArgument(args, 1, "receive");
+        for(;;) {
+            if(auto message = channel->queue.tryPop())
+                return std::move(*message);
+            waitForChannel(interp);
+        }
+    }
+
+    /** Macros **/
+    // (macroexpand expr) expands the uses of macros in a copy of expr, as a program is expanded before it is evaluated
+    Atom macroexpand(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(1, args)) {
+            throw EvalError(args, "Expected 1 argument for function 'macroexpand'");
+        }
+        Atom expansion = deepCopy(args.car()); // a quoted expression of the program stays as it is
+        expandMacros(interp, expansion);
+        return expansion;
+    }
+
+    /** Diagnostics **/
+    // ((kind allocations live) ... (live-bytes n) (peak-bytes n)), live is nil for kinds only counted when created
+    Atom memoryStats(Interpreter& interp, Atom args) {
+        if(!argumentCountIs(0, args)) {
+            throw EvalError(args, "Expected no arguments for function 'memory-stats'");
+        }
+        auto stats  = memory::stats();
+        Atom result = Atom(Atom(Atom("live-bytes"), Atom(Atom(long(stats.liveBytes)), nil)),
+                           Atom(Atom(Atom("peak-bytes"), Atom(Atom(long(stats.peakBytes)), nil)), nil));
+        for(size_t k = memory::kinds; k-- > 0;) {
+            auto kind = memory::Kind(k);
+            Atom live = memory::tracksLifetime(kind) ? Atom(long(stats.live[k])) : nil;
+            Atom entry(Atom(memory::toString(kind)), Atom(Atom(long(stats.allocations[k])), Atom(live, nil)));
+            result = Atom(entry, result);
+        }
+        return result;
+    }
+
+    // (dump-trace [count]) decodes the last events of the flight recorder to the error port
+    Atom dumpTrace(Interpreter& interp, Atom args) {
+        size_t count = trace::capacity;
+        if(argumentCountIs(1, args)) {
+            if(args.car().type != Type::Integer || *args.car().integer() < 0) {
+                throw TypeError(args, format("invalid argument type '{}' mismatched with expected type '{}' to built-in function 'dump-trace'", toString(args.car().type), toString(Type::Integer)));
+            }
+            count = *args.car().integer();
+        } else if(!argumentCountIs(0, args)) {
+            throw EvalError(args, "Expected 0 or 1 argument for function 'dump-trace'");
+        }
+        ::dumpTrace(interp, interp.err(), count);
+        return nil;
     }
 
 //	Atom puts(Atom args) {
@@ -179,6 +529,46 @@ namespace builtin {
 //            return args.car().car();
 //        }
 //    }
+
+    /** All built-in functions by the name they are bound to in the global environment **/
+    const BuiltinTable& table() {
+        static const BuiltinTable builtins = {
+            {"car", car},
+            {"cdr", cdr},
+            {"cons", cons},
+            {"+", add},
+            {"-", sub},
+            {"*", mul},
+            {"/", div},
+            {"=", eq},
+            {"<", less},
+            {"getchar", getchar},
+            {"putchar", putchar},
+            {"open-input-file", openInputFile},
+            {"open-output-file", openOutputFile},
+            {"read-line", readLine},
+            {"read-bytes", readBytes},
+            {"write-string", writeString},
+            {"flush", flush},
+            {"close-port", closePort},
+            {"pmap", pmap},
+            {"pfor-each", pforEach},
+            {"preduce", preduce},
+            {"touch", touch},
+            {"await", touch},
+            {"future-ready?", futureReady},
+            {"spawn", spawn},
+            {"yield", yield},
+            {"sleep", sleep},
+            {"join", join},
+            {"make-channel", makeChannel},
+            {"send", send},
+            {"receive", receive},
+            {"macroexpand", macroexpand},
+            {"memory-stats", memoryStats},
+            {"dump-trace", dumpTrace}};
+        return builtins;
+    }
 } // namespace builtin
 
 #endif //LISP_BUILTIN_H
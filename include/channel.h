@@ -0,0 +1,71 @@
+#ifndef LISP_CHANNEL_H
+#define LISP_CHANNEL_H
+
+#include "atom.h"
+#include "compact.h"
+#include "debug.h"
+#include "ringbuffer.h"
+
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Copy of the graph reachable from an atom, sharing & cycles included
+ * Nothing of the copy is shared with the original, so it can be handed to another thread or
+ * interpreter while the sender keeps using (and defining into) its own structures. The pairs
+ * of a copy are allocated together (see compact.h).
+ * Tasks belong to the scheduler of their interpreter and can not be copied, futures,
+ * channels and namespaces (the globals closures refer to) are thread-safe and stay shared.
+ */
+inline Atom deepCopy(const Atom& atom) {
+	if(atom.type != Type::Pair && atom.type != Type::Closure) {
+		if(atom.type == Type::Task)
+			throw TypeError(atom, "Tasks can not be sent to another thread");
+		return atom;
+	}
+	// copy every node first, then link them, so long lists & cycles need no recursion
+	std::unordered_map<const Pair*, std::shared_ptr<Pair>> copies;
+	std::vector<const Pair*>                               order;
+	std::vector<Atom>                                      stack{atom};
+	while(!stack.empty()) {
+		Atom next = std::move(stack.back());
+		stack.pop_back();
+		if(next.type == Type::Task)
+			throw TypeError(next, "Tasks can not be sent to another thread");
+		if(next.type != Type::Pair && next.type != Type::Closure)
+			continue;
+		const Pair* pair = std::get<std::shared_ptr<Pair>>(next.value).get();
+		if(copies.emplace(pair, std::allocate_shared<Pair>(compact::Allocator<Pair>(), nil, nil)).second) {
+			order.push_back(pair);
+			stack.push_back(pair->cdr);
+			stack.push_back(pair->car);
+		}
+	}
+	auto link = [&](const Atom& original) {
+		if(original.type != Type::Pair && original.type != Type::Closure)
+			return original;
+		Atom copy   = original;
+		copy.value = copies.at(std::get<std::shared_ptr<Pair>>(original.value).get());
+		return copy;
+	};
+	for(const Pair* pair: order) {
+		auto& copy = copies.at(pair);
+		copy->car  = link(pair->car);
+		copy->cdr  = link(pair->cdr);
+	}
+	return link(atom);
+}
+
+/**
+ * A bounded channel between threads or interpreters
+ * Values are deep copied when sent, a send waits while the channel is full and a receive
+ * while it is empty.
+ */
+struct Channel {
+	static constexpr size_t capacity = 1024;
+
+	MPMCQueue<Atom, capacity>              queue;
+	memory::Counted<memory::Kind::Channel> counted{sizeof(Channel)};
+};
+
+#endif //LISP_CHANNEL_H
@@ -0,0 +1,83 @@
+#ifndef LISP_COMPACT_H
+#define LISP_COMPACT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/**
+ * Contiguous allocation of the pairs of a list
+ * Lists of known length (read by the parser, built by builtins from a vector) allocate their
+ * pairs one after the other from a chunk the thread fills, so walking such a list reads memory
+ * sequentially & a pair costs no allocation of its own. Every pair keeps its own count, they are
+ * ordinary pairs that can be shared & mutated one by one: a cdr set to a pair elsewhere only
+ * ends the run there. A chunk is returned once the last of its pairs is freed, by any thread,
+ * so a single pair kept alive keeps its whole chunk.
+ */
+namespace compact {
+	constexpr size_t chunkSize = 16 * 1024; // aligned to its size, a block finds its chunk by masking its address
+
+	struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Chunk {
+		std::atomic<std::uint32_t> live {1}; // the blocks not freed, plus one while the chunk is filled
+	};
+
+	inline Chunk* chunkOf(const void* block) { return reinterpret_cast<Chunk*>(reinterpret_cast<std::uintptr_t>(block) & ~(chunkSize - 1)); }
+
+	inline void release(Chunk* chunk) {
+		if(chunk->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			chunk->~Chunk();
+			::operator delete(chunk, std::align_val_t(chunkSize));
+		}
+	}
+
+	/** The chunk a thread allocates from **/
+	class Run {
+		Chunk*        m_chunk = nullptr;
+		std::uint32_t m_top   = 0;
+
+	  public:
+		Run() = default;
+		Run(const Run&) = delete;
+		Run& operator=(const Run&) = delete;
+		~Run() {
+			if(m_chunk)
+				release(m_chunk);
+		}
+
+		void* allocate(size_t bytes) {
+			size_t size = (bytes + alignof(Chunk) - 1) / alignof(Chunk) * alignof(Chunk);
+			if(!m_chunk || m_top + size > chunkSize) {
+				if(m_chunk)
+					release(m_chunk);
+				m_chunk = new(::operator new(chunkSize, std::align_val_t(chunkSize))) Chunk;
+				m_top   = sizeof(Chunk);
+			}
+			m_chunk->live.fetch_add(1, std::memory_order_relaxed);
+			void* block = reinterpret_cast<std::byte*>(m_chunk) + m_top;
+			m_top += std::uint32_t(size);
+			return block;
+		}
+	};
+
+	inline thread_local Run t_run;
+
+	/** Allocates next to the previous block of the calling thread, frees to the chunk of the block **/
+	template<typename T>
+	struct Allocator {
+		using value_type = T;
+		static_assert(sizeof(T) <= chunkSize / 8, "blocks are a small part of a chunk");
+
+		Allocator() = default;
+		template<typename U>
+		Allocator(const Allocator<U>&) {} // rebound by allocate_shared
+
+		T*   allocate(size_t n) { return static_cast<T*>(t_run.allocate(n * sizeof(T))); }
+		void deallocate(T* p, size_t) { release(chunkOf(p)); }
+
+		template<typename U>
+		bool operator==(const Allocator<U>&) const { return true; }
+	};
+} // namespace compact
+
+#endif //LISP_COMPACT_H
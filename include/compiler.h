@@ -0,0 +1,941 @@
+#ifndef LISP_COMPILER_H
+#define LISP_COMPILER_H
+
+#include "atom.h"
+#include "debug.h"
+#include "environment.h"
+#include "escape.h"
+#include "eval.h"
+#include "future.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "namespace.h"
+#include "profiler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Closure compilation, a tier between the tree walking eval and a virtual machine
+ * Every top level expression is converted once into a tree of nodes specialized for what it does:
+ * a constant, a parameter at a known position of a known frame, a global looked up by its
+ * precomputed hash, an if, a call, or an arithmetic primitive on two arguments computing numbers
+ * inline while the global it names is still bound to the built-in function, specialized to the
+ * operand types its call site sees. Executing the tree is
+ * a virtual call per node, without keyword compares or searching frames by name.
+ * Frames are laid out as by the tree walker (see bindArguments), so a closure of either evaluator
+ * can be applied by the other. Forms the compiler does not specialize (import, profile, defmacro,
+ * quasiquote, malformed forms) are evaluated by the tree walker, raising the same errors at the
+ * same time. Macros are expanded before a top level expression is compiled (see expandMacros).
+ * Calls of closures are reported to the profiler & the flight recorder, inlined primitives are not.
+ * Hot closures defined at the top level on integers are further compiled to native code (see
+ * NativeCode), the calls it makes itself are not reported.
+ */
+namespace compiler {
+	class Node {
+	  public:
+		virtual ~Node() = default;
+		virtual Atom eval(Interpreter& interp, Environment& env) = 0;
+	};
+	using NodePtr = std::unique_ptr<Node>;
+	struct Program;
+
+	/** A self evaluating atom or a quoted expression **/
+	class ConstNode: public Node {
+		Atom m_value;
+
+	  public:
+		explicit ConstNode(Atom value):
+			m_value(std::move(value)) {}
+		Atom eval(Interpreter& interp, Environment& env) override { return m_value; }
+	};
+
+	/** A parameter, the binding at index of the frame depth frames out **/
+	class LocalRefNode: public Node {
+		size_t m_depth, m_index;
+
+	  public:
+		LocalRefNode(size_t depth, size_t index):
+			m_depth(depth), m_index(index) {}
+		Atom eval(Interpreter& interp, Environment& env) override {
+			const Atom* frame = &env.atom();
+			for(size_t d = m_depth; d > 0; d--)
+				frame = &frame->car();
+			const Atom* bindings = &frame->cdr();
+			for(size_t i = m_index; i > 0; i--)
+				bindings = &bindings->cdr();
+			return bindings->car().cdr();
+		}
+	};
+
+	/** A name a define may bind in a frame at run time, looked up by name as by the tree walker **/
+	class NameRefNode: public Node {
+		Atom m_symbol;
+
+	  public:
+		explicit NameRefNode(Atom symbol):
+			m_symbol(std::move(symbol)) {}
+		Atom eval(Interpreter& interp, Environment& env) override { return env.get(m_symbol); }
+	};
+
+	/** A global binding **/
+	class GlobalRefNode: public Node {
+		std::shared_ptr<Namespace> m_ns;
+		Atom                       m_symbol;
+		size_t                     m_hash;
+
+	  public:
+		GlobalRefNode(std::shared_ptr<Namespace> ns, Atom symbol):
+			m_ns(std::move(ns)), m_symbol(std::move(symbol)), m_hash(Namespace::hash(name())) {}
+		[[nodiscard]] const std::string&  name() const { return std::get<std::string>(m_symbol.value); }
+		[[nodiscard]] std::optional<Atom> value() const { return m_ns->lookup(name(), m_hash); }
+		Atom eval(Interpreter& interp, Environment& env) override {
+			if(auto value = this->value())
+				return *value;
+			throw EnvError(env, nil, format("Unexpected identifier {}, have you defined {}?", name(), name()));
+		}
+	};
+
+	class IfNode: public Node {
+		NodePtr m_condition, m_then, m_else;
+
+	  public:
+		IfNode(NodePtr condition, NodePtr then, NodePtr otherwise):
+			m_condition(std::move(condition)), m_then(std::move(then)), m_else(std::move(otherwise)) {}
+		Atom eval(Interpreter& interp, Environment& env) override {
+			return m_condition->eval(interp, env).isNil() ? m_else->eval(interp, env) : m_then->eval(interp, env);
+		}
+	};
+
+	class DefineNode: public Node {
+		Atom    m_symbol;
+		NodePtr m_value;
+
+	  public:
+		DefineNode(Atom symbol, NodePtr value):
+			m_symbol(std::move(symbol)), m_value(std::move(value)) {}
+		Atom eval(Interpreter& interp, Environment& env) override {
+			env.set(m_symbol, m_value->eval(interp, env));
+			return m_symbol;
+		}
+	};
+
+	/** An expression left to the tree walker **/
+	class InterpretNode: public Node {
+		Atom m_expr;
+
+	  public:
+		explicit InterpretNode(Atom expr):
+			m_expr(std::move(expr)) {}
+		Atom eval(Interpreter& interp, Environment& env) override { return ::eval(interp, m_expr, env); }
+	};
+
+	/** The symbol of a special form in upper case, as eval compares it **/
+	inline std::string keyword(const Atom& symbol) {
+		std::string text = std::get<std::string>(symbol.value);
+		for(auto& c: text)
+			c = char(toupper(c));
+		return text;
+	}
+
+	inline bool isSpecialForm(const std::string& word) {
+		for(auto* form: {"QUOTE", "DEFINE", "LAMBDA", "IF", "IMPORT", "FUTURE", "PROFILE", "DEFMACRO", "QUASIQUOTE"}) {
+			if(word == form)
+				return true;
+		}
+		return false;
+	}
+
+	/** The code pair of a closure, which identifies the lambda node that created it **/
+	inline const Pair* codeOf(const Atom& closure) {
+		return std::get<std::shared_ptr<Pair>>(closure.cdr().value).get();
+	}
+
+	enum class Primitive { Add, Sub, Mul, Div, Eq, Less };
+
+	/** The primitive a built-in function is inlined as, by the name it is bound to **/
+	inline std::optional<Primitive> primitiveOf(const std::string& name) {
+		static const std::pair<const char*, Primitive> primitives[] = {
+			{"+", Primitive::Add}, {"-", Primitive::Sub}, {"*", Primitive::Mul}, {"/", Primitive::Div}, {"=", Primitive::Eq}, {"<", Primitive::Less}};
+		for(auto& [symbol, primitive]: primitives) {
+			if(name == symbol)
+				return primitive;
+		}
+		return std::nullopt;
+	}
+
+	/**
+	 * Native code of a closure defined at the top level (see jit.h), for a body made of integer
+	 * constants, parameters, + - * of two arguments, ifs on < or = of two arguments and calls of the
+	 * closure itself by the global it is bound to. Called with integer arguments it computes what the
+	 * nodes would, other arguments are left to the nodes. The globals it assumes are checked again
+	 * at the first call after every define, as by primitive nodes.
+	 */
+	class NativeCode {
+		struct Assumption {
+			std::string     name;
+			Atom::builtin_t builtin; // bound to name, nullptr for a closure of the code itself
+		};
+
+		std::shared_ptr<Namespace> m_ns;
+		const BuiltinTable&        m_builtins;
+		const Pair*                m_code;
+		std::vector<std::string>   m_params;
+		std::vector<Assumption>    m_assumptions;
+		std::unique_ptr<jit::Code> m_native;
+		std::atomic<std::uint64_t> m_verified = 0;
+
+		NativeCode(std::shared_ptr<Namespace> ns, const BuiltinTable& builtins, const Pair* code):
+			m_ns(std::move(ns)), m_builtins(builtins), m_code(code) {}
+
+		// the built-in function of a global bound to the built-in function of its name
+		std::optional<Atom::builtin_t> builtin(const std::string& name, const Atom& value) const {
+			auto entry = std::find_if(m_builtins.begin(), m_builtins.end(), [&](auto& builtin) { return builtin.first == name; });
+			if(entry == m_builtins.end() || value.type != Type::Builtin || std::get<Atom::builtin_t>(value.value) != entry->second)
+				return std::nullopt;
+			return entry->second;
+		}
+
+		// the primitive a call of two arguments is, assuming its global stays bound
+		std::optional<Primitive> primitive(const Atom& expr) {
+			if(expr.type != Type::Pair || !Atom(expr).isProperList() || expr.car().type != Type::Symbol || !argumentCountIs(2, expr.cdr()))
+				return std::nullopt;
+			const std::string& name = std::get<std::string>(expr.car().value);
+			auto               op   = primitiveOf(name);
+			if(!op || isSpecialForm(keyword(expr.car())) || std::count(m_params.begin(), m_params.end(), name))
+				return std::nullopt;
+			auto value = m_ns->lookup(name);
+			auto fn    = value ? builtin(name, *value) : std::nullopt;
+			if(!fn)
+				return std::nullopt;
+			m_assumptions.push_back({name, *fn});
+			return op;
+		}
+
+		// the code evaluating expr into rax, false when it can not be compiled
+		bool emit(jit::Assembler& assembler, const Atom& expr) {
+			if(expr.type == Type::Integer) {
+				assembler.constant(std::get<long>(expr.value));
+				return true;
+			}
+			if(expr.type == Type::Symbol) {
+				auto param = std::find(m_params.begin(), m_params.end(), std::get<std::string>(expr.value));
+				if(param == m_params.end())
+					return false;
+				assembler.argument(param - m_params.begin());
+				return true;
+			}
+			if(expr.type != Type::Pair || !Atom(expr).isProperList() || expr.car().type != Type::Symbol)
+				return false;
+			Atom args = expr.cdr();
+			if(keyword(expr.car()) == "IF") {
+				if(!argumentCountIs(3, args))
+					return false;
+				auto condition = primitive(args.car());
+				if(condition != Primitive::Less && condition != Primitive::Eq)
+					return false;
+				auto otherwise = assembler.label(), end = assembler.label();
+				if(!emit(assembler, args.car().cdr().car()))
+					return false;
+				assembler.push();
+				if(!emit(assembler, args.car().cdr().cdr().car()))
+					return false;
+				assembler.branchUnless(condition == Primitive::Less ? jit::Assembler::Condition::Less : jit::Assembler::Condition::Equal, otherwise);
+				if(!emit(assembler, args.cdr().car()))
+					return false;
+				assembler.jump(end);
+				assembler.bind(otherwise);
+				if(!emit(assembler, args.cdr().cdr().car()))
+					return false;
+				assembler.bind(end);
+				return true;
+			}
+			if(auto op = primitive(expr)) {
+				if(op != Primitive::Add && op != Primitive::Sub && op != Primitive::Mul)
+					return false;
+				if(!emit(assembler, args.car()))
+					return false;
+				assembler.push();
+				if(!emit(assembler, args.cdr().car()))
+					return false;
+				switch(*op) {
+				case Primitive::Add: assembler.add(); break;
+				case Primitive::Sub: assembler.sub(); break;
+				default: assembler.mul(); break;
+				}
+				return true;
+			}
+			// a call of the closure itself
+			const std::string& name = std::get<std::string>(expr.car().value);
+			if(isSpecialForm(keyword(expr.car())) || std::count(m_params.begin(), m_params.end(), name))
+				return false;
+			auto value = m_ns->lookup(name);
+			if(!value || value->type != Type::Closure || codeOf(*value) != m_code || !argumentCountIs(m_params.size(), args))
+				return false;
+			m_assumptions.push_back({name, nullptr});
+			for(Atom p = args; !p.isNil(); p = p.cdr()) {
+				if(!emit(assembler, p.car()))
+					return false;
+				assembler.push();
+			}
+			assembler.callSelf(m_params.size());
+			return true;
+		}
+
+		// whether the globals are bound as when compiling
+		bool holds() {
+			std::uint64_t version = m_ns->version();
+			if(m_verified.load(std::memory_order_relaxed) == version)
+				return true;
+			for(auto& assumption: m_assumptions) {
+				auto value = m_ns->lookup(assumption.name);
+				if(!value)
+					return false;
+				if(assumption.builtin ? builtin(assumption.name, *value) != assumption.builtin
+									  : value->type != Type::Closure || codeOf(*value) != m_code)
+					return false;
+			}
+			m_verified.store(version, std::memory_order_relaxed);
+			return true;
+		}
+
+	  public:
+		/** The native code of the closures of code (params . body), nullptr if it can not be compiled **/
+		static std::unique_ptr<NativeCode> compile(std::shared_ptr<Namespace> ns, const BuiltinTable& builtins, const Atom& code) {
+			if(!jit::available() || !argumentCountIs(1, code.cdr()))
+				return nullptr;
+			std::unique_ptr<NativeCode> native(new NativeCode(std::move(ns), builtins, std::get<std::shared_ptr<Pair>>(code.value).get()));
+			for(Atom p = code.car(); !p.isNil(); p = p.cdr())
+				native->m_params.push_back(std::get<std::string>(p.car().value));
+			if(native->m_params.size() > jit::maxArity)
+				return nullptr;
+			std::uint64_t   version = native->m_ns->version();
+			jit::Assembler assembler;
+			assembler.prologue(native->m_params.size());
+			if(!native->emit(assembler, code.cdr().car()))
+				return nullptr;
+			assembler.epilogue();
+			native->m_native = std::make_unique<jit::Code>(assembler.finish());
+			if(!native->m_native->entry())
+				return nullptr;
+			native->m_verified.store(version, std::memory_order_relaxed);
+			return native;
+		}
+
+		[[nodiscard]] size_t arity() const { return m_params.size(); }
+
+		/** The result of a call with args, nullopt to evaluate the call on the nodes **/
+		std::optional<Atom> call(Interpreter& interp, const Atom* args) {
+			std::int64_t values[jit::maxArity] = {};
+			for(size_t i = 0; i < m_params.size(); i++) {
+				if(args[i].type != Type::Integer)
+					return std::nullopt;
+				values[i] = std::get<long>(args[i].value);
+			}
+			if(!holds())
+				return std::nullopt;
+			jit::Context context {jit::callsPerCheck, 0, &interp};
+			std::int64_t result = m_native->entry()(&context, values[0], values[1], values[2], values[3], values[4]);
+			if(context.aborted) // the nodes raise the timeout
+				return std::nullopt;
+			return Atom(long(result));
+		}
+	};
+
+	/**
+	 * A lambda expression, its closures share the code pair (params . body) created when compiling
+	 * which identifies them as closures of this node. A lambda at the top level is compiled to
+	 * native code once its closures were called hotCalls times, if its body allows.
+	 */
+	class LambdaNode: public Node {
+		Atom                 m_code;
+		size_t               m_arity;
+		std::vector<NodePtr> m_body;
+		// the namespace of a lambda at the top level when native code is enabled
+		std::shared_ptr<Namespace>  m_ns;
+		const BuiltinTable*         m_builtins;
+		std::atomic<std::uint64_t>  m_calls = 0;
+		std::unique_ptr<NativeCode> m_nativeCode;
+		std::atomic<NativeCode*>    m_native = nullptr;
+		bool                        m_local; // no closure captures the frames, see escape.h
+
+	  public:
+		static constexpr std::uint64_t hotCalls = 1000;
+
+		LambdaNode(Atom code, size_t arity, std::vector<NodePtr> body, std::shared_ptr<Namespace> ns = nullptr, const BuiltinTable* builtins = nullptr):
+			m_code(std::move(code)), m_arity(arity), m_body(std::move(body)), m_ns(std::move(ns)), m_builtins(builtins), m_local(escape::local(m_code.cdr())) {}
+
+		[[nodiscard]] const Pair* code() const { return std::get<std::shared_ptr<Pair>>(m_code.value).get(); }
+		/** Whether a closure of the node is alive, it holds the code pair **/
+		[[nodiscard]] bool        referenced() const { return std::get<std::shared_ptr<Pair>>(m_code.value).use_count() > 1; }
+		[[nodiscard]] const Atom& params() const { return m_code.car(); }
+		[[nodiscard]] size_t      arity() const { return m_arity; }
+		/** Whether the frames of the closures are allocated in the region **/
+		[[nodiscard]] bool        local() const { return m_local; }
+		/** The native code of the closures, nullptr until they are hot or if the body can't be compiled **/
+		[[nodiscard]] NativeCode* native() const { return m_native.load(std::memory_order_acquire); }
+
+		Atom eval(Interpreter& interp, Environment& env) override {
+			memory::allocated(memory::Kind::Closure, 0);
+			Atom closure(env.atom(), m_code);
+			closure.type = Type::Closure;
+			return closure;
+		}
+
+		/** Evaluate the body for a closure fn of this node in a new frame of bindings **/
+		Atom apply(Interpreter& interp, const Atom& fn, const Atom& bindings) {
+			// a single call reaches the threshold, it compiles the native code
+			if(m_ns && m_calls.fetch_add(1, std::memory_order_relaxed) + 1 == hotCalls) {
+				m_nativeCode = NativeCode::compile(m_ns, *m_builtins, m_code);
+				m_native.store(m_nativeCode.get(), std::memory_order_release);
+			}
+			Environment frame = m_local ? Environment::local(fn.car()) : Environment(fn.car());
+			frame.atom().cdr() = bindings;
+			Atom result;
+			for(auto& node: m_body)
+				result = node->eval(interp, frame);
+			return result;
+		}
+	};
+
+	/**
+	 * The lambda nodes compiled, by their code pair
+	 * Nodes are removed only while no node is evaluated, by any thread, and every removal starts a
+	 * new generation, so a call node holding on to a node of an older generation looks it up again.
+	 */
+	class Registry {
+		mutable std::shared_mutex                    m_lock;
+		std::unordered_map<const Pair*, LambdaNode*> m_lambdas;
+		std::atomic<std::uint64_t>                   m_generation = 0;
+		mutable std::atomic<size_t>                  m_active     = 0; // evaluations in progress
+		mutable std::atomic<bool>                    m_removing   = false;
+
+	  public:
+		/** Marks an evaluation of nodes in progress while alive, nested ones included **/
+		class Evaluation {
+			const Registry& m_registry;
+
+		  public:
+			explicit Evaluation(const Registry& registry):
+				m_registry(registry) {
+				for(;;) {
+					m_registry.m_active.fetch_add(1);
+					if(!m_registry.m_removing.load())
+						return;
+					m_registry.m_active.fetch_sub(1);
+					while(m_registry.m_removing.load())
+						std::this_thread::yield();
+				}
+			}
+			Evaluation(const Evaluation&) = delete;
+			Evaluation& operator=(const Evaluation&) = delete;
+			~Evaluation() { m_registry.m_active.fetch_sub(1, std::memory_order_release); }
+		};
+
+		void add(LambdaNode* lambda) {
+			std::unique_lock<std::shared_mutex> guard(m_lock);
+			m_lambdas.emplace(lambda->code(), lambda);
+		}
+		[[nodiscard]] LambdaNode* find(const Pair* code) const {
+			std::shared_lock<std::shared_mutex> guard(m_lock);
+			auto                                it = m_lambdas.find(code);
+			return it != m_lambdas.end() ? it->second : nullptr;
+		}
+		[[nodiscard]] std::uint64_t generation() const { return m_generation.load(std::memory_order_acquire); }
+
+		/**
+		 * Run remove, which may remove nodes & destroy them, unless nodes are being evaluated
+		 * @return whether remove was run
+		 */
+		template<typename Remove>
+		bool whileIdle(Remove remove) {
+			m_removing.store(true);
+			bool idle = m_active.load() == 0;
+			if(idle) {
+				remove();
+				m_generation.fetch_add(1, std::memory_order_release);
+			}
+			m_removing.store(false);
+			return idle;
+		}
+		void remove(const LambdaNode* lambda) {
+			std::unique_lock<std::shared_mutex> guard(m_lock);
+			m_lambdas.erase(lambda->code());
+		}
+	};
+
+	/** Evaluates an expression on the thread pool, the node outlives the evaluation of its top level expression **/
+	class FutureNode: public Node {
+		NodePtr                m_expr;
+		const Registry&        m_lambdas;
+		std::weak_ptr<Program> m_program; // alive while the node is evaluated
+
+	  public:
+		FutureNode(NodePtr expr, const Registry& lambdas, std::weak_ptr<Program> program):
+			m_expr(std::move(expr)), m_lambdas(lambdas), m_program(std::move(program)) {}
+		Atom eval(Interpreter& interp, Environment& env) override {
+			auto state = std::make_shared<Future>();
+			// the program is kept until the future is computed
+			interp.pool().submit([&interp, state, node = m_expr.get(), &lambdas = m_lambdas, program = m_program.lock(), env]() mutable {
+				try {
+					Registry::Evaluation evaluation(lambdas);
+					state->value = node->eval(interp, env);
+				} catch(...) {
+					state->error = std::current_exception();
+				}
+				state->ready.store(true, std::memory_order_release);
+			});
+			return Atom(state);
+		}
+	};
+
+	/**
+	 * A call, closures of lambda nodes get their arguments bound as they are evaluated, other
+	 * functions are applied by apply. The lambda node of the last closure called is cached.
+	 */
+	class CallNode: public Node {
+	  protected:
+		const Registry&          m_lambdas;
+		NodePtr                  m_fn;
+		std::vector<NodePtr>     m_args;
+		std::atomic<LambdaNode*>   m_cached     = nullptr;
+		std::atomic<std::uint64_t> m_generation = 0; // of the registry when m_cached was stored
+
+		// the list dies with the call, as the list the tree walker evaluates arguments into
+		Atom evalArguments(Interpreter& interp, Environment& env) {
+			Atom args, last;
+			for(auto& arg: m_args) {
+				Atom item = Atom::local(arg->eval(interp, env), nil);
+				if(last.isNil())
+					args = item;
+				else
+					last.cdr() = item;
+				last = item;
+			}
+			return args;
+		}
+
+		LambdaNode* lambdaOf(const Atom& closure) {
+			const Pair*   code       = codeOf(closure);
+			std::uint64_t generation = m_lambdas.generation();
+			if(m_generation.load(std::memory_order_acquire) == generation) {
+				LambdaNode* cached = m_cached.load(std::memory_order_acquire);
+				if(cached && cached->code() == code)
+					return cached;
+			}
+			LambdaNode* lambda = m_lambdas.find(code);
+			if(lambda) {
+				m_cached.store(lambda, std::memory_order_release);
+				m_generation.store(generation, std::memory_order_release);
+			}
+			return lambda;
+		}
+
+		Atom call(Interpreter& interp, LambdaNode& lambda, Atom& fn, Environment& env) {
+			if(m_args.size() != lambda.arity()) // raises the error of the tree walker
+				return lambda.apply(interp, fn, bindArguments(lambda.params(), evalArguments(interp, env), lambda.local()));
+			// the calls made by native code are neither profiled nor traced
+			NativeCode* native = lambda.native();
+			if(native && !interp.profiler()) {
+				Atom values[jit::maxArity];
+				for(size_t i = 0; i < m_args.size(); i++)
+					values[i] = m_args[i]->eval(interp, env);
+				interp.checkDeadline();
+				trace::Call traced(fn);
+				auto        result = native->call(interp, values);
+				if(!result) {
+					Atom args;
+					for(size_t i = m_args.size(); i-- > 0;)
+						args = Atom(values[i], args);
+					result = lambda.apply(interp, fn, bindArguments(lambda.params(), args, lambda.local()));
+				}
+				traced.returned(*result);
+				return *result;
+			}
+			Atom bindings, last;
+			Atom params = lambda.params();
+			bool local  = lambda.local();
+			for(auto& arg: m_args) {
+				Atom binding = escape::cons(local, escape::cons(local, params.car(), arg->eval(interp, env)), nil);
+				if(last.isNil())
+					bindings = binding;
+				else
+					last.cdr() = binding;
+				last   = binding;
+				params = params.cdr();
+			}
+			interp.checkDeadline();
+			std::optional<Profiler::Call> profiled;
+			if(Profiler* profiler = interp.profiler(); profiler && profiler->measures())
+				profiled.emplace(profiler, fn);
+			trace::Call traced(fn);
+			Atom result = lambda.apply(interp, fn, bindings);
+			traced.returned(result);
+			return result;
+		}
+
+	  public:
+		CallNode(const Registry& lambdas, NodePtr fn, std::vector<NodePtr> args):
+			m_lambdas(lambdas), m_fn(std::move(fn)), m_args(std::move(args)) {}
+
+		Atom eval(Interpreter& interp, Environment& env) override {
+			Atom fn = m_fn->eval(interp, env);
+			if(fn.type == Type::Closure) {
+				if(LambdaNode* lambda = lambdaOf(fn))
+					return call(interp, *lambda, fn, env);
+			}
+			return apply(interp, fn, evalArguments(interp, env));
+		}
+	};
+
+	/** The operand types of an arithmetic call, a bit each so a call site can record all it saw **/
+	enum class Operands : std::uint8_t {
+		None         = 0,
+		IntInt       = 1,
+		IntDouble    = 2,
+		DoubleInt    = 4,
+		DoubleDouble = 8,
+		Other        = 16 // anything not arithmetic, raising the error of the built-in function
+	};
+
+	inline Operands operandsOf(const Atom& lhs, const Atom& rhs) {
+		bool lhsInt = lhs.type == Type::Integer, rhsInt = rhs.type == Type::Integer;
+		if((!lhsInt && lhs.type != Type::Rational) || (!rhsInt && rhs.type != Type::Rational))
+			return Operands::Other;
+		if(lhsInt)
+			return rhsInt ? Operands::IntInt : Operands::IntDouble;
+		return rhsInt ? Operands::DoubleInt : Operands::DoubleDouble;
+	}
+
+	/**
+	 * A call of a global bound to an arithmetic built-in function on two arguments. The site records
+	 * the operand types it sees & specializes to the first: while the operands keep those types it
+	 * computes inline behind a test of both. Operands of another type make it generic for good,
+	 * dispatching on the types of every call, operands not arithmetic & integer division by zero
+	 * go to the built-in function. Once the global is bound to something else it is an ordinary
+	 * call. The binding is checked again after every define.
+	 */
+	template<Primitive op>
+	class PrimitiveNode: public CallNode {
+		std::shared_ptr<Namespace> m_ns;
+		const GlobalRefNode&       m_global;
+		Atom::builtin_t            m_builtin;
+		// the namespace version the global was last seen bound to the built-in function at
+		std::atomic<std::uint64_t> m_verified = 0;
+		// the operand types seen, the ones specialized to, Other once generic
+		std::atomic<std::uint8_t>  m_seen        = 0;
+		std::atomic<Operands>      m_specialized = Operands::None;
+
+		bool unshadowed() {
+			std::uint64_t version = m_ns->version();
+			if(m_verified.load(std::memory_order_relaxed) == version)
+				return true;
+			auto value = m_global.value();
+			if(!value || value->type != Type::Builtin || std::get<Atom::builtin_t>(value->value) != m_builtin)
+				return false;
+			m_verified.store(version, std::memory_order_relaxed);
+			return true;
+		}
+
+		// as the built-in function computes, integers with integers & doubles otherwise
+		template<typename L, typename R>
+		static Atom compute(L a, R b) {
+			switch(op) {
+			case Primitive::Add: return Atom(a + b);
+			case Primitive::Sub: return Atom(a - b);
+			case Primitive::Mul: return Atom(a * b);
+			case Primitive::Div: return Atom(a / b);
+			case Primitive::Eq: return a == b ? Atom("t") : nil;
+			case Primitive::Less: return a < b ? Atom("t") : nil;
+			}
+			return nil;
+		}
+
+		static std::optional<Atom> compute(Operands operands, const Atom& lhs, const Atom& rhs) {
+			switch(operands) {
+			case Operands::IntInt: {
+				long b = std::get<long>(rhs.value);
+				if(op == Primitive::Div && b == 0)
+					return std::nullopt;
+				return compute(std::get<long>(lhs.value), b);
+			}
+			case Operands::IntDouble: return compute(std::get<long>(lhs.value), std::get<double>(rhs.value));
+			case Operands::DoubleInt: return compute(std::get<double>(lhs.value), std::get<long>(rhs.value));
+			case Operands::DoubleDouble: return compute(std::get<double>(lhs.value), std::get<double>(rhs.value));
+			default: return std::nullopt;
+			}
+		}
+
+		static bool holds(Operands operands, const Atom& lhs, const Atom& rhs) {
+			switch(operands) {
+			case Operands::IntInt: return lhs.type == Type::Integer && rhs.type == Type::Integer;
+			case Operands::IntDouble: return lhs.type == Type::Integer && rhs.type == Type::Rational;
+			case Operands::DoubleInt: return lhs.type == Type::Rational && rhs.type == Type::Integer;
+			case Operands::DoubleDouble: return lhs.type == Type::Rational && rhs.type == Type::Rational;
+			default: return false;
+			}
+		}
+
+		Atom generic(Interpreter& interp, Operands specialized, const Atom& lhs, const Atom& rhs) {
+			Operands operands = operandsOf(lhs, rhs);
+			auto     bit      = std::uint8_t(operands);
+			if(!(m_seen.load(std::memory_order_relaxed) & bit))
+				m_seen.fetch_or(bit, std::memory_order_relaxed);
+			if(specialized == Operands::None)
+				m_specialized.compare_exchange_strong(specialized, operands, std::memory_order_relaxed);
+			else if(specialized != operands && specialized != Operands::Other)
+				m_specialized.store(Operands::Other, std::memory_order_relaxed);
+			if(auto result = compute(operands, lhs, rhs))
+				return *result;
+			return m_builtin(interp, Atom(lhs, Atom(rhs, nil)));
+		}
+
+	  public:
+		PrimitiveNode(const Registry& lambdas, std::shared_ptr<Namespace> ns, std::unique_ptr<GlobalRefNode> fn, Atom::builtin_t builtin, std::vector<NodePtr> args):
+			CallNode(lambdas, nullptr, std::move(args)), m_ns(std::move(ns)), m_global(*fn), m_builtin(builtin) {
+			m_fn = std::move(fn);
+		}
+
+		/** The operand types seen, a bit each **/
+		[[nodiscard]] std::uint8_t seen() const { return m_seen.load(std::memory_order_relaxed); }
+		/** The operand types the site is specialized to, None before its first call, Other once generic **/
+		[[nodiscard]] Operands specialized() const { return m_specialized.load(std::memory_order_relaxed); }
+
+		Atom eval(Interpreter& interp, Environment& env) override {
+			if(!unshadowed())
+				return CallNode::eval(interp, env);
+			Atom     lhs         = m_args[0]->eval(interp, env);
+			Atom     rhs         = m_args[1]->eval(interp, env);
+			Operands specialized = m_specialized.load(std::memory_order_relaxed);
+			if(holds(specialized, lhs, rhs)) {
+				if(auto result = compute(specialized, lhs, rhs))
+					return *result;
+			}
+			return generic(interp, specialized, lhs, rhs);
+		}
+	};
+
+	/** The nodes of a top level expression & the lambda nodes among them **/
+	struct Program {
+		NodePtr                  root;
+		std::vector<LambdaNode*> lambdas;
+	};
+
+	/**
+	 * The evaluator compiling top level expressions in the global environment, others are tree walked
+	 * An expression creating lambdas or futures is kept while a closure of its lambdas or a future
+	 * it started is alive, like the code of the tree walker, and is dropped by a later evaluation.
+	 */
+	class Compiler: public Evaluator {
+		// the frames around an expression while compiling it, the innermost first
+		struct Scope {
+			std::vector<std::string> params;
+			std::vector<std::string> defined;         // names a define in the body may bind in the frame
+			bool                     open   = false;  // an import in the body may bind any name
+			const Scope*             parent = nullptr;
+		};
+		struct Context {
+			std::shared_ptr<Namespace> ns;
+			std::shared_ptr<Program>   program;
+			bool                       retain = false; // the nodes have to outlive the evaluation
+		};
+
+		static constexpr size_t minSweep = 16; // programs retained before the first sweep
+
+		const BuiltinTable&                   m_builtins;
+		bool                                  m_native;
+		Registry                              m_lambdas;
+		std::mutex                            m_lock;
+		std::vector<std::shared_ptr<Program>> m_programs; // top level expressions which created lambdas or futures
+		size_t                                m_sweepAt = minSweep;
+
+		// drop the programs nothing evaluates anymore, once they doubled since the last sweep
+		void sweep() {
+			if(m_programs.size() < m_sweepAt)
+				return;
+			bool swept = m_lambdas.whileIdle([&] {
+				std::erase_if(m_programs, [&](const std::shared_ptr<Program>& program) {
+					if(program.use_count() > 1 || std::any_of(program->lambdas.begin(), program->lambdas.end(), [](auto* lambda) { return lambda->referenced(); }))
+						return false;
+					for(auto* lambda: program->lambdas)
+						m_lambdas.remove(lambda);
+					return true;
+				});
+			});
+			if(swept)
+				m_sweepAt = std::max(minSweep, 2 * m_programs.size());
+		}
+
+		// the names the evaluation of expr may bind in the frame it is evaluated in
+		static void scan(const Atom& expr, Scope& scope) {
+			if(expr.type != Type::Pair || !Atom(expr).isProperList())
+				return;
+			if(expr.car().type == Type::Symbol) {
+				std::string word = keyword(expr.car());
+				if(word == "QUOTE" || word == "LAMBDA")
+					return;
+				if(word == "DEFINE" && argumentCountIs(2, expr.cdr()) && expr.cdr().car().type == Type::Symbol)
+					scope.defined.push_back(*expr.cdr().car().symbol());
+				if(word == "IMPORT")
+					scope.open = true;
+			}
+			for(Atom p = expr; !p.isNil(); p = p.cdr())
+				scan(p.car(), scope);
+		}
+
+		NodePtr reference(const Atom& symbol, const Scope* scope, Context& context) {
+			const std::string& name = std::get<std::string>(symbol.value);
+			for(size_t depth = 0; scope; scope = scope->parent, depth++) {
+				auto param = std::find(scope->params.begin(), scope->params.end(), name);
+				if(param != scope->params.end())
+					return std::make_unique<LocalRefNode>(depth, param - scope->params.begin());
+				if(scope->open || std::find(scope->defined.begin(), scope->defined.end(), name) != scope->defined.end())
+					return std::make_unique<NameRefNode>(symbol);
+			}
+			return std::make_unique<GlobalRefNode>(context.ns, symbol);
+		}
+
+		NodePtr lambda(const Atom& expr, const Atom& args, const Scope* scope, Context& context) {
+			if(!argumentCountIs(2, args))
+				return std::make_unique<InterpretNode>(expr);
+			Scope inner {.parent = scope};
+			Atom  params = args.car();
+			for(Atom p = params; !p.isNil(); p = p.cdr()) {
+				if(p.type != Type::Pair || p.car().type != Type::Symbol)
+					return std::make_unique<InterpretNode>(expr);
+				inner.params.push_back(*p.car().symbol());
+			}
+			Atom body = args.cdr();
+			for(Atom p = body; !p.isNil(); p = p.cdr())
+				scan(p.car(), inner);
+			std::vector<NodePtr> nodes;
+			for(Atom p = body; !p.isNil(); p = p.cdr())
+				nodes.push_back(compile(p.car(), &inner, context));
+			auto node = std::make_unique<LambdaNode>(Atom(params, body), inner.params.size(), std::move(nodes), scope || !m_native ? nullptr : context.ns, &m_builtins);
+			m_lambdas.add(node.get());
+			context.program->lambdas.push_back(node.get());
+			context.retain = true;
+			return node;
+		}
+
+		NodePtr call(const Atom& op, const Atom& args, const Scope* scope, Context& context) {
+			std::vector<NodePtr> nodes;
+			for(Atom p = args; !p.isNil(); p = p.cdr())
+				nodes.push_back(compile(p.car(), scope, context));
+			NodePtr fn = op.type == Type::Symbol ? reference(op, scope, context) : compile(op, scope, context);
+			auto*   global = dynamic_cast<GlobalRefNode*>(fn.get());
+			if(!global || nodes.size() != 2)
+				return std::make_unique<CallNode>(m_lambdas, std::move(fn), std::move(nodes));
+			auto builtin = std::find_if(m_builtins.begin(), m_builtins.end(), [&](auto& entry) { return entry.first == global->name(); });
+			auto primitive = primitiveOf(global->name());
+			if(builtin == m_builtins.end() || !primitive)
+				return std::make_unique<CallNode>(m_lambdas, std::move(fn), std::move(nodes));
+			std::unique_ptr<GlobalRefNode> ref(static_cast<GlobalRefNode*>(fn.release()));
+			switch(*primitive) {
+			case Primitive::Add: return std::make_unique<PrimitiveNode<Primitive::Add>>(m_lambdas, context.ns, std::move(ref), builtin->second, std::move(nodes));
+			case Primitive::Sub: return std::make_unique<PrimitiveNode<Primitive::Sub>>(m_lambdas, context.ns, std::move(ref), builtin->second, std::move(nodes));
+			case Primitive::Mul: return std::make_unique<PrimitiveNode<Primitive::Mul>>(m_lambdas, context.ns, std::move(ref), builtin->second, std::move(nodes));
+			case Primitive::Div: return std::make_unique<PrimitiveNode<Primitive::Div>>(m_lambdas, context.ns, std::move(ref), builtin->second, std::move(nodes));
+			case Primitive::Eq: return std::make_unique<PrimitiveNode<Primitive::Eq>>(m_lambdas, context.ns, std::move(ref), builtin->second, std::move(nodes));
+			case Primitive::Less: return std::make_unique<PrimitiveNode<Primitive::Less>>(m_lambdas, context.ns, std::move(ref), builtin->second, std::move(nodes));
+			}
+			return nullptr;
+		}
+
+		NodePtr compile(const Atom& expr, const Scope* scope, Context& context) {
+			if(expr.type == Type::Symbol)
+				return reference(expr, scope, context);
+			if(expr.type != Type::Pair)
+				return std::make_unique<ConstNode>(expr);
+			if(!Atom(expr).isProperList())
+				return std::make_unique<InterpretNode>(expr);
+			Atom op   = expr.car();
+			Atom args = expr.cdr();
+			if(op.type == Type::Symbol) {
+				std::string word = keyword(op);
+				if(word == "QUOTE")
+					return argumentCountIs(1, args) ? NodePtr(std::make_unique<ConstNode>(args.car())) : std::make_unique<InterpretNode>(expr);
+				if(word == "DEFINE") {
+					if(!argumentCountIs(2, args) || args.car().type != Type::Symbol)
+						return std::make_unique<InterpretNode>(expr);
+					return std::make_unique<DefineNode>(args.car(), compile(args.cdr().car(), scope, context));
+				}
+				if(word == "LAMBDA")
+					return lambda(expr, args, scope, context);
+				if(word == "IF") {
+					if(!argumentCountIs(3, args))
+						return std::make_unique<InterpretNode>(expr);
+					return std::make_unique<IfNode>(compile(args.car(), scope, context), compile(args.cdr().car(), scope, context),
+													compile(args.cdr().cdr().car(), scope, context));
+				}
+				if(word == "FUTURE") {
+					if(!argumentCountIs(1, args))
+						return std::make_unique<InterpretNode>(expr);
+					context.retain = true;
+					return std::make_unique<FutureNode>(compile(args.car(), scope, context), m_lambdas, context.program);
+				}
+				if(word == "IMPORT" || word == "PROFILE" || word == "DEFMACRO" || word == "QUASIQUOTE")
+					return std::make_unique<InterpretNode>(expr);
+			}
+			return call(op, args, scope, context);
+		}
+
+	  public:
+		/** native enables the native code of hot closures at the top level **/
+		explicit Compiler(const BuiltinTable& builtins, bool native = jit::available()):
+			m_builtins(builtins), m_native(native && jit::available()) {}
+
+		Atom eval(Interpreter& interp, const Atom& expr, Environment& env) override {
+			// only the global frame is known when compiling
+			if(env.atom().car().type != Type::Namespace)
+				return ::eval(interp, expr, env);
+			auto program = std::make_shared<Program>();
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				sweep();
+				Context context {*env.atom().car().ns(), program};
+				program->root = compile(expr, nullptr, context);
+				if(context.retain)
+					m_programs.push_back(program);
+			}
+			Registry::Evaluation evaluation(m_lambdas);
+			return program->root->eval(interp, env);
+		}
+
+		/** The top level expressions retained, as long as closures of their lambdas or their futures may evaluate them **/
+		[[nodiscard]] size_t programs() {
+			std::lock_guard<std::mutex> guard(m_lock);
+			return m_programs.size();
+		}
+
+		std::optional<Atom> applyClosure(Interpreter& interp, const Atom& fn, const Atom& args) override {
+			Registry::Evaluation evaluation(m_lambdas);
+			LambdaNode*          lambda = m_lambdas.find(codeOf(fn));
+			if(!lambda)
+				return std::nullopt;
+			NativeCode* native = lambda->native();
+			if(native && !interp.profiler() && Atom(args).isProperList() && argumentCountIs(native->arity(), args)) {
+				Atom   values[jit::maxArity];
+				size_t count = 0;
+				for(Atom p = args; !p.isNil(); p = p.cdr())
+					values[count++] = p.car();
+				if(auto result = native->call(interp, values))
+					return result;
+			}
+			return lambda->apply(interp, fn, bindArguments(lambda->params(), args, lambda->local()));
+		}
+	};
+} // namespace compiler
+
+#endif //LISP_COMPILER_H
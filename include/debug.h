@@ -3,6 +3,7 @@
 
 #include "atom.h"
 #include "format.h"
+#include "source.h"
 #include "token.h"
 
 #include <utility>
@@ -16,6 +17,12 @@ inline static std::string toString(Type type) {
 	case Type::Rational: return "Rational";
 	case Type::Builtin: return "Builtin";
 	case Type::Closure: return "Closure";
+	case Type::Future: return "Future";
+	case Type::Task: return "Task";
+	case Type::Channel: return "Channel";
+	case Type::String: return "String";
+	case Type::Port: return "Port";
+	case Type::Namespace: return "Namespace";
 	default: return "Unknown Type";
 	}
 }
@@ -43,16 +50,30 @@ inline std::string toString(TokenType type) {
 
 /**
  * A program error occurs during the lexical analysis (Tokenizer) or during the parsing
+ * The position of the token is resolved when the error is raised, so the source may go out of scope
  */
 class ProgramError: std::exception {
 	std::string m_msg;
-    Token m_token;
+	Token       m_token;
+	std::string m_name;
+	std::string m_line;
+	size_t      m_lineNumber, m_column;
+
   public:
-	explicit ProgramError(const Token& token, std::string msg):
-		m_msg(std::move(msg)), m_token(token) {
+	explicit ProgramError(const Source& source, const Token& token, std::string msg):
+		m_msg(std::move(msg)), m_token(token), m_name(source.name()) {
+		auto position = source.position(token);
+		m_lineNumber  = position.line;
+		m_column      = position.column;
+		m_line        = source.line(position.line);
 	}
-	Token& token(){ return m_token; }
-	std::string what() { return m_msg; }
+	Token&             token() { return m_token; }
+	const std::string& sourceName() const { return m_name; }
+	// the full line of source the token is on
+	const std::string& lineText() const { return m_line; }
+	size_t             line() const { return m_lineNumber; }
+	size_t             column() const { return m_column; }
+	std::string        what() { return m_msg; }
 };
 
 /**
@@ -60,8 +81,8 @@ class ProgramError: std::exception {
  */
 class LexError: public ProgramError {
   public:
-	explicit LexError(const Token& token, const std::string& msg):
-		ProgramError(token, msg) {
+	explicit LexError(const Source& source, const Token& token, const std::string& msg):
+		ProgramError(source, token, msg) {
 	}
 };
 
@@ -70,8 +91,8 @@ class LexError: public ProgramError {
  */
 class SyntaxError: public ProgramError {
   public:
-	explicit SyntaxError(const Token& token, const std::string& msg):
-		ProgramError(token, msg) {
+	explicit SyntaxError(const Source& source, const Token& token, const std::string& msg):
+		ProgramError(source, token, msg) {
 	}
 };
 
@@ -128,10 +149,20 @@ class EvalError: public RunTimeError {
 };
 
 /**
- * Report am error
+ * A timeout error occurs when an evaluation runs past the deadline set on its interpreter
+ */
+class TimeoutError: public EvalError {
+  public:
+	explicit TimeoutError(const std::string& msg):
+		EvalError(nil, msg) {}
+};
+
+/**
+ * Report an error
  * @param err
+ * @param os
  */
-inline void staticError(ProgramError& err) {
+inline void staticError(ProgramError& err, std::ostream& os = std::cerr) {
 	// format:
 	/*
        filename, line:col error: msg
@@ -140,19 +171,21 @@ inline void staticError(ProgramError& err) {
     */
 	// where ^~~~~ is the length of the token
 	std::stringstream str;
-	Token& t = err.token();
-	str << "REPL, " << t.line << ":" << t.column << err.what() << "\n";
-	str << t.line << " |" << t.value << "\n"; // < show entire line & highlight token
-	str << " |" << "^~~~~~";
-
+	std::string       number = std::to_string(err.line() + 1);
+	size_t            length = std::max<size_t>(err.token().length, 1);
+	str << err.sourceName() << ", " << err.line() + 1 << ":" << err.column() + 1 << " error: " << err.what() << "\n";
+	str << number << " | " << err.lineText() << "\n"; // show entire line & highlight token
+	str << std::string(number.size(), ' ') << " | " << std::string(err.column(), ' ') << "^" << std::string(length - 1, '~') << "\n";
+	os << str.str();
 }
 
 /**
  *
  * @param err
+ * @param os
  */
-inline void dynamicError(EvalError& err) {
-	std::cerr << err.what() << "\n";
+inline void dynamicError(EvalError& err, std::ostream& os = std::cerr) {
+	os << err.what() << "\n";
 }
 
 #define CHECK(x) std::cout << #x << ": " << x << std::endl
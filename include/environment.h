@@ -3,12 +3,16 @@
 
 #include "atom.h"
 #include "debug.h"
+#include "namespace.h"
 
+#include <memory>
 #include <vector>
 
 /**
  * The environment contains all definitions
- * It uses the atom structure as a map
+ * It uses the atom structure as a map, a frame is (parent . bindings), bindings in the order they
+ * were made (the parameters of a closure first). The parent of the global
+ * frame is a Namespace holding the global bindings, which threads read without locking.
  */
 class Environment {
 	Atom m_env;
@@ -18,12 +22,32 @@ class Environment {
   public:
 	Environment(const Atom& parent, const std::vector<std::pair<std::string, Atom::builtin_t>>& pair):
 		m_env(Atom(parent, nil)) {
+		memory::allocated(memory::Kind::Frame, 0);
 		for(auto& s: pair) {
 			set(Atom(s.first), Atom(s.second));
 		}
 	}
 	explicit Environment(const Atom& parent):
-		m_env(Atom(parent, nil)) {}
+		m_env(Atom(parent, nil)) { memory::allocated(memory::Kind::Frame, 0); }
+
+	/** A frame allocated in the region of the calling thread, for a call no closure captures (see escape.h) **/
+	static Environment local(const Atom& parent) {
+		memory::allocated(memory::Kind::Frame, 0);
+		return Environment(Atom::local(parent, nil), true);
+	}
+
+	/** The environment of an existing frame, eg. one restored from an image **/
+	static Environment fromFrame(const Atom& frame) { return Environment(frame, true); }
+
+	/** A global environment, binding the built-in functions in a new namespace **/
+	static Environment global(const std::vector<std::pair<std::string, Atom::builtin_t>>& builtins) {
+		Environment env(Atom(Atom(std::make_shared<Namespace>()), nil), true);
+		memory::allocated(memory::Kind::Frame, 0);
+		for(auto& s: builtins) {
+			env.set(Atom(s.first), Atom(s.second));
+		}
+		return env;
+	}
 
 	Atom& atom() { return m_env; }
 
@@ -45,6 +69,11 @@ class Environment {
 			}
 			bs = bs.cdr();
 		}
+		if(parent.type == Type::Namespace) {
+			if(auto value = std::get<std::shared_ptr<Namespace>>(parent.value)->lookup(std::get<std::string>(symbol.value)))
+				return *value;
+			parent = nil;
+		}
 		if(parent.isNil()) {
 			throw EnvError(*this, parent, format("Unexpected identifier {}, have you defined {}?", *symbol.symbol(), *symbol.symbol()));
 		}
@@ -54,8 +83,13 @@ class Environment {
 	}
 
 	void set(const Atom& symbol, const Atom& value) {
-		Atom bs = m_env.cdr();
-		Atom b  = nil;
+		if(m_env.car().type == Type::Namespace) {
+			std::get<std::shared_ptr<Namespace>>(m_env.car().value)->define(*symbol.symbol(), value);
+			return;
+		}
+		Atom bs   = m_env.cdr();
+		Atom b    = nil;
+		Atom last = nil;
 
 		// try to find symbol
 		while(!bs.isNil()) {
@@ -64,11 +98,15 @@ class Environment {
 				b.cdr() = value;
 				return;
 			}
-			bs = bs.cdr();
+			last = bs;
+			bs   = bs.cdr();
 		}
-		// if it does not exist, prepend symbol value set
-		b           = Atom(symbol, value);
-		m_env.cdr() = Atom(b, m_env.cdr());
+		// if it does not exist, append symbol value set, the bindings before it keep their position
+		b = Atom(Atom(symbol, value), nil);
+		if(last.isNil())
+			m_env.cdr() = b;
+		else
+			last.cdr() = b;
 	}
 };
 
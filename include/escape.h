@@ -0,0 +1,70 @@
+#ifndef LISP_ESCAPE_H
+#define LISP_ESCAPE_H
+
+#include "atom.h"
+#include "region.h"
+
+#include <cctype>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * Escape analysis of closure bodies
+ * The frame of a call & the pairs binding its arguments are only reachable from the call, unless
+ * its body closes over the frame: a lambda, a future or a macro expander evaluated in it, or an
+ * import evaluating a module in it. Bodies that can't are analyzed once, their frames are allocated in the region of
+ * the calling thread (see region.h) & released on return, as are the lists of evaluated arguments
+ * every call makes for the function applied. A leaf function allocates nothing on the heap.
+ */
+namespace escape {
+	/** Whether evaluating expr may capture the frame it is evaluated in **/
+	inline bool captures(const Atom& expr) {
+		if(expr.type != Type::Pair)
+			return false;
+		if(expr.car().type == Type::Symbol) {
+			std::string word = std::get<std::string>(expr.car().value);
+			for(auto& c: word)
+				c = char(toupper(c));
+			if(word == "QUOTE")
+				return false;
+			if(word == "LAMBDA" || word == "FUTURE" || word == "IMPORT" || word == "DEFMACRO")
+				return true;
+		}
+		for(Atom p = expr; p.type == Type::Pair; p = p.cdr()) {
+			if(captures(p.car()))
+				return true;
+		}
+		return false;
+	}
+
+	constexpr size_t analyzedBodies = 4096; // before the bodies freed since are forgotten
+
+	/**
+	 * Whether the frames of closures with body can be allocated in the region, analyzed once per
+	 * body by every thread. The table holds the bodies weakly, a body freed keeps its address until
+	 * it is forgotten, so an address is never mistaken for another body.
+	 */
+	inline bool local(const Atom& body) {
+		thread_local std::unordered_map<const Pair*, std::pair<std::weak_ptr<Pair>, bool>> analyzed;
+		if(body.type != Type::Pair)
+			return true;
+		const auto& pair = std::get<std::shared_ptr<Pair>>(body.value);
+		if(auto it = analyzed.find(pair.get()); it != analyzed.end())
+			return it->second.second;
+		if(analyzed.size() >= analyzedBodies)
+			std::erase_if(analyzed, [](const auto& entry) { return entry.second.first.expired(); });
+		bool local = true;
+		for(Atom p = body; p.type == Type::Pair && local; p = p.cdr())
+			local = !captures(p.car());
+		analyzed.emplace(pair.get(), std::make_pair(std::weak_ptr<Pair>(pair), local));
+		return local;
+	}
+
+	/** A pair in the region when local, on the heap otherwise **/
+	inline Atom cons(bool local, const Atom& car, const Atom& cdr) { return local ? Atom::local(car, cdr) : Atom(car, cdr); }
+} // namespace escape
+
+#endif //LISP_ESCAPE_H
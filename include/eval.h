@@ -4,33 +4,186 @@
 #include "atom.h"
 #include "debug.h"
 #include "environment.h"
+#include "escape.h"
+#include "future.h"
+#include "interpreter.h"
+#include "module.h"
 #include "tokenizer.h"
 #include "parser.h"
+#include "profiler.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 
 /** Evaluation forward declaration **/
-Atom eval(Atom expr, Environment& env);
+Atom eval(Interpreter& interp, Atom expr, Environment& env);
+Atom apply(Interpreter& interp, Atom& fn, const Atom& args);
 
-Atom interpret(const std::string& source, Environment& env){
-    auto tokens = tokenizer(source);    // Lexical analysis
-    Atom root = expression(tokens); // Parsing
-    return eval(root, env);         // Evaluation / Interpretation
+/** Whether expr is a list starting with the symbol keyword, compared in upper case as eval does **/
+bool isForm(const Atom& expr, std::string_view keyword){
+    if(expr.type != Type::Pair || expr.car().type != Type::Symbol){
+        return false;
+    }
+    const std::string& symbol = std::get<std::string>(expr.car().value);
+    return std::equal(symbol.begin(), symbol.end(), keyword.begin(), keyword.end(), [](char c, char k){ return toupper(c) == k; });
+}
+
+/** The names bound by the lambdas around an expression, which shadow the macros of the same name **/
+using Bound = std::unordered_set<std::string>;
+
+/** Add the names expr defines in the frame it is evaluated in, not those of the lambdas in it **/
+void defines(Bound& bound, const Atom& expr){
+    if(expr.type != Type::Pair || isForm(expr, "QUOTE") || isForm(expr, "QUASIQUOTE") || isForm(expr, "LAMBDA") || isForm(expr, "DEFMACRO")){
+        return;
+    }
+    if(isForm(expr, "DEFINE") && expr.cdr().type == Type::Pair && expr.cdr().car().type == Type::Symbol){
+        bound.insert(std::get<std::string>(expr.cdr().car().value));
+    }
+    for(Atom p = expr; p.type == Type::Pair; p = p.cdr()){
+        defines(bound, p.car());
+    }
+}
+
+/** The names bound by a lambda or macro: its parameters & the names its body defines **/
+Bound bindings(const Bound& outer, Atom params, const Atom& body){
+    Bound bound = outer;
+    for(; params.type == Type::Pair; params = params.cdr()){
+        if(params.car().type == Type::Symbol){
+            bound.insert(std::get<std::string>(params.car().value));
+        }
+    }
+    if(params.type == Type::Symbol){
+        bound.insert(std::get<std::string>(params.value));
+    }
+    for(Atom p = body; p.type == Type::Pair; p = p.cdr()){
+        defines(bound, p.car());
+    }
+    return bound;
+}
+
+/**
+ * Expand the uses of macros in the expression held by slot, in place
+ * A use is replaced by its expansion, which is expanded in turn, so the expander of a use runs
+ * once however often its expression is evaluated afterwards. Quoted data, quasiquote templates
+ * but for their unquoted expressions & the parameters of lambdas are left as they are, as are
+ * calls of names a surrounding lambda binds.
+ * @param depth the quasiquotes around slot not undone by an unquote
+ * @param bound the names bound by the lambdas around slot
+ */
+void expandMacros(Interpreter& interp, Atom& slot, size_t depth = 0, const Bound& bound = {}){
+    if(slot.type != Type::Pair || interp.macros().empty()){
+        return;
+    }
+    if(depth > 0){
+        if(isForm(slot, "UNQUOTE") || isForm(slot, "UNQUOTE-SPLICING") || isForm(slot, "QUASIQUOTE")){
+            if(slot.cdr().type == Type::Pair){
+                expandMacros(interp, slot.cdr().car(), isForm(slot, "QUASIQUOTE") ? depth + 1 : depth - 1, bound);
+            }
+            return;
+        }
+        for(Atom p = slot; p.type == Type::Pair; p = p.cdr()){
+            expandMacros(interp, p.car(), depth, bound);
+        }
+        return;
+    }
+    while(slot.type == Type::Pair && slot.car().type == Type::Symbol){
+        const std::string& name = std::get<std::string>(slot.car().value);
+        if(bound.count(name)){
+            break;
+        }
+        auto expander = interp.macros().find(name);
+        if(!expander){
+            break;
+        }
+        slot = apply(interp, *expander, slot.cdr());
+    }
+    if(isForm(slot, "QUOTE")){
+        return;
+    }
+    if(isForm(slot, "QUASIQUOTE")){
+        if(slot.cdr().type == Type::Pair){
+            expandMacros(interp, slot.cdr().car(), 1, bound);
+        }
+        return;
+    }
+    // the forms following the parameters of a lambda or a macro, in the scope of its bindings
+    Atom p = slot;
+    size_t skipped = isForm(slot, "LAMBDA") ? 2 : isForm(slot, "DEFMACRO") ? 3 : 0;
+    for(size_t i = 0; i < skipped && p.type == Type::Pair; i++){
+        p = p.cdr();
+    }
+    if(skipped > 0){
+        Atom params = skipped == 2 ? slot.cdr() : slot.cdr().type == Type::Pair ? slot.cdr().cdr() : nil;
+        Bound inner = bindings(bound, params.type == Type::Pair ? params.car() : nil, p);
+        for(; p.type == Type::Pair; p = p.cdr()){
+            expandMacros(interp, p.car(), 0, inner);
+        }
+        return;
+    }
+    for(; p.type == Type::Pair; p = p.cdr()){
+        expandMacros(interp, p.car(), 0, bound);
+    }
+}
+
+// a top level expression whose macros are expanded
+Atom evalExpanded(Interpreter& interp, const Atom& expr, Environment& env){
+    if(Evaluator* evaluator = interp.evaluator()){
+        return evaluator->eval(interp, expr, env);
+    }
+    return eval(interp, expr, env);
+}
+
+/**
+ * Evaluate a top level expression, by the evaluator of the interpreter if it has one
+ * Its macros are expanded first, those defined by earlier top level expressions.
+ */
+Atom evalTopLevel(Interpreter& interp, const Atom& expr, Environment& env){
+    Atom form = expr;
+    expandMacros(interp, form);
+    return evalExpanded(interp, form, env);
+}
+
+/** Evaluate a list of top level expressions, returning the value of the last one **/
+Atom evalProgram(Interpreter& interp, Atom program, Environment& env){
+    Atom result;
+    while(!program.isNil()){
+        // expanded in the list, so evaluating the program again doesn't expand it again
+        expandMacros(interp, program.car());
+        result = evalExpanded(interp, program.car(), env);
+        program = program.cdr();
+    }
+    return result;
+}
+
+Atom interpret(Interpreter& interp, const Source& source, Environment& env){
+    auto tokens = tokenizer(source);           // Lexical analysis
+    Atom root = program(tokens, source);       // Parsing
+    return evalProgram(interp, root, env);     // Evaluation / Interpretation
+}
+
+/** Interpret a source in the global environment **/
+Atom interpret(Interpreter& interp, const Source& source){
+    return interpret(interp, source, interp.global());
 }
 
 std::string sourceFromFile(const std::string& fileName){
     std::ifstream file(fileName, std::ios::binary);
-    std::string input;
     if(!file.is_open()){
         std::cerr << format("Failed to open file {}.", fileName) << "\n";
     }
-    file >> input;
-    return input;
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 }
 
 bool argumentCountIs(size_t n, const Atom& args){
 	Atom a = args;
-    for(int i = 0; i < n-1; i++){
+	if(n == 0) return a.isNil();
+    for(size_t i = 0; i < n-1; i++){
         if(a.isNil()) return false;
 		a = a.cdr();
 	}
@@ -40,7 +193,7 @@ bool argumentCountIs(size_t n, const Atom& args){
 
 /** Operator implementations **/
 /** import a source file **/
-Atom import(Atom& args, Environment& env){
+Atom import(Interpreter& interp, Atom& args, Environment& env){
     if(!argumentCountIs(1, args)){
         throw EvalError(args, "Expected 1 argument for operator 'import'");
 	}
@@ -48,19 +201,44 @@ Atom import(Atom& args, Environment& env){
 	if(symbol.type != Type::Symbol){
         throw TypeError(symbol, format("Expected type {} mismatched with actual type {} for operator 'import'", toString(Type::Symbol), toString(symbol.type)));
 	}
-    interpret(sourceFromFile(*symbol.symbol()), env);
+    std::string fileName = *symbol.symbol();
+    std::error_code error;
+    std::string path = std::filesystem::weakly_canonical(fileName, error).string();
+    if(error || !std::filesystem::is_regular_file(path)){
+        throw EvalError(symbol, format("Failed to open file {} for operator 'import'", fileName));
+    }
+    // every module is only evaluated once
+    if(auto module = interp.modules().find(path)){
+        return *module;
+    }
+    interp.modules().add(path);
+
+    // skip tokenizing & parsing when the parsed form of this exact source is cached
+    std::string text = sourceFromFile(path);
+    Atom program;
+    if(auto cached = interp.moduleCache().load(text)){
+        program = *cached;
+    } else {
+        Source source(text, fileName);
+        auto tokens = tokenizer(source);
+        program = ::program(tokens, source);
+        interp.moduleCache().store(text, program);
+    }
+    Atom result = evalProgram(interp, program, env);
+    interp.modules().add(path, result);
+    return result;
 }
 
 /** Evaluate an if expression **/
-Atom ifexpr(Atom& args, Environment& env){
+Atom ifexpr(Interpreter& interp, Atom& args, Environment& env){
     Atom condition;
     Atom value;
     if(!argumentCountIs(3, args)){
         throw EvalError(args, "Expected 2 arguments for operator 'define'");
     }
-    condition = eval(args.car(), env);
+    condition = eval(interp, args.car(), env);
     value = condition.isNil() ? args.cdr().cdr().car() : args.cdr().car();
-    return eval(value, env);
+    return eval(interp, value, env);
 }
 
 /** Don't evaluate a list **/
@@ -72,7 +250,7 @@ Atom quote(Atom& args){
 }
 
 /** Define a variable / function **/
-Atom define(const Atom& args, Environment& env){
+Atom define(Interpreter& interp, const Atom& args, Environment& env){
     if(!argumentCountIs(2, args)){
         throw EvalError(args, "Expected 2 arguments for operator 'define'");
     }
@@ -82,7 +260,7 @@ Atom define(const Atom& args, Environment& env){
     if(symbol.type != Type::Symbol){
         throw TypeError(symbol, format("Expected type {} mismatched with actual type {}", toString(Type::Symbol), toString(symbol.type)));
     }
-    value = eval(args.cdr().car(), env);
+    value = eval(interp, args.cdr().car(), env);
 
     env.set(symbol, value);
     return symbol;
@@ -93,56 +271,215 @@ Atom lambda(Environment& env, const Atom& args, Atom& expr){
 	if(!argumentCountIs(2, args)){
         throw EvalError(args, "Expected 1 argument for operator 'lambda'");
 	}
-	return Atom(env, args.car(), args.cdr());
+	Atom closure(env, args.car(), args.cdr());
+	escape::local(args.cdr()); // analyze the body once, its calls look the result up
+	return closure;
+}
+
+/** Define a macro, (defmacro name (params) body), its expander a closure of params & body **/
+Atom defmacro(Interpreter& interp, const Atom& args, Environment& env){
+    if(!argumentCountIs(3, args)){
+        throw EvalError(args, "Expected 3 arguments for operator 'defmacro'");
+    }
+    Atom symbol = args.car();
+    if(symbol.type != Type::Symbol){
+        throw TypeError(symbol, format("Expected type {} mismatched with actual type {} for operator 'defmacro'", toString(Type::Symbol), toString(symbol.type)));
+    }
+    Atom params = args.cdr().car();
+    Atom body = args.cdr().cdr();
+    interp.macros().define(*symbol.symbol(), Atom(env, params, body));
+    return symbol;
+}
+
+/**
+ * Build the structure of a quasiquote template, evaluating its unquoted expressions & splicing
+ * the lists of its unquote-splicing ones. A nested quasiquote is built as a template itself.
+ * @param depth the quasiquotes around tmpl not undone by an unquote
+ */
+Atom quasiquote(Interpreter& interp, const Atom& tmpl, Environment& env, size_t depth = 1){
+    if(tmpl.type != Type::Pair){
+        return tmpl;
+    }
+    bool unquote = isForm(tmpl, "UNQUOTE"), splicing = isForm(tmpl, "UNQUOTE-SPLICING");
+    if(unquote || splicing || isForm(tmpl, "QUASIQUOTE")){
+        if(!argumentCountIs(1, tmpl.cdr())){
+            throw EvalError(tmpl, format("Expected 1 argument for operator '{}'", *tmpl.car().symbol()));
+        }
+        if(splicing && depth == 1){
+            throw EvalError(tmpl, "Expected unquote-splicing in a list");
+        }
+        if(unquote && depth == 1){
+            return eval(interp, tmpl.cdr().car(), env);
+        }
+        return Atom(tmpl.car(), Atom(quasiquote(interp, tmpl.cdr().car(), env, unquote || splicing ? depth - 1 : depth + 1), nil));
+    }
+    std::vector<Atom> items;
+    auto append = [&](const Atom& item){ items.push_back(item); };
+    Atom p = tmpl;
+    // (a . ,b) reads as (a unquote b), its rest is an unquote
+    for(; p.type == Type::Pair && !isForm(p, "UNQUOTE"); p = p.cdr()){
+        Atom item = p.car();
+        if(depth == 1 && isForm(item, "UNQUOTE-SPLICING") && argumentCountIs(1, item.cdr())){
+            Atom spliced = eval(interp, item.cdr().car(), env);
+            if(!spliced.isProperList()){
+                throw TypeError(spliced, format("Expected a list to splice, got {}", toString(spliced.type)));
+            }
+            for(; !spliced.isNil(); spliced = spliced.cdr()){
+                append(spliced.car());
+            }
+        } else {
+            append(quasiquote(interp, item, env, depth));
+        }
+    }
+    return Atom::list(items, quasiquote(interp, p, env, depth));
+}
+
+/** Evaluate an expression asynchronously on the thread pool **/
+Atom future(Interpreter& interp, const Atom& args, Environment& env){
+    if(!argumentCountIs(1, args)){
+        throw EvalError(args, "Expected 1 argument for operator 'future'");
+    }
+    auto state = std::make_shared<Future>();
+    interp.pool().submit([&interp, state, expr = args.car(), env]() mutable {
+        try {
+            state->value = eval(interp, expr, env);
+        } catch(...) {
+            state->error = std::current_exception();
+        }
+        state->ready.store(true, std::memory_order_release);
+    });
+    return Atom(state);
+}
+
+/**
+ * The bindings of a closure frame, ((param . arg) ...) in the order of the parameters
+ * The compiled tier addresses parameters by this position, so both evaluators build frames alike.
+ * The pairs are allocated in the region when local, for a frame no closure captures.
+ */
+Atom bindArguments(const Atom& params, Atom args, bool local = false){
+    Atom bindings, last;
+    Atom p = params;
+    while(!p.isNil() && !args.isNil()){
+        Atom binding = escape::cons(local, escape::cons(local, p.car(), args.car()), nil);
+        if(last.isNil()){
+            bindings = binding;
+        } else {
+            last.cdr() = binding;
+        }
+        last = binding;
+        p = p.cdr();
+        args = args.cdr();
+    }
+    if(!p.isNil() || !args.isNil()){
+        throw EvalError(args, "Expected as many arguments as the closure has parameters");
+    }
+    return bindings;
 }
 
 /** Apply a closure (lambda / user defined function) **/
-Atom applyClosure(Atom& fn, Atom args){
+Atom applyClosure(Interpreter& interp, Atom& fn, Atom args){
+    if(Evaluator* evaluator = interp.evaluator()){
+        if(auto result = evaluator->applyClosure(interp, fn, args)){
+            return *result;
+        }
+    }
 
-    auto closure_env = Environment(fn.car());
     Atom param_names = fn.cdr().car();
     Atom body = fn.cdr().cdr();
+    // a frame no closure captures is released on return
+    bool local = escape::local(body);
+    auto closure_env = local ? Environment::local(fn.car()) : Environment(fn.car());
 
     // bind args to param_names
-    while(!param_names.isNil() || !args.isNil()){
-        closure_env.set(param_names.car(), args.car());
-        param_names = param_names.cdr();
-        args = args.cdr();
-    }
-    if(!param_names.isNil() || !args.isNil()){
-        // arguments & parameters are not the same amount!
-    }
+    closure_env.atom().cdr() = bindArguments(param_names, args, local);
 
     Atom result;
     // evaluate the body
     while(!body.isNil()){
-        result = eval(body.car(), closure_env);
+        result = eval(interp, body.car(), closure_env);
         body = body.cdr();
     }
     return result;
 }
 
 /** Apply builtin or closure **/
-Atom apply(Atom& fn, const Atom& args){
-	if(fn.type == Type::Builtin){
-		return (*fn.builtin())(args);
-	} else if(fn.type == Type::Closure){
-		return applyClosure(fn, args);
-	} else {
-
+Atom apply(Interpreter& interp, Atom& fn, const Atom& args){
+	if(fn.type != Type::Builtin && fn.type != Type::Closure){
         throw TypeError(args, format("Expected function, got {}", toString(fn.type)));
 	}
+	std::optional<Profiler::Call> call; // measures the call while profiling
+	if(Profiler* profiler = interp.profiler(); profiler && profiler->measures()){
+		call.emplace(profiler, fn);
+	}
+	trace::Call traced(fn);
+	Atom result = fn.type == Type::Builtin ? (*fn.builtin())(interp, args) : applyClosure(interp, fn, args);
+	traced.returned(result);
+	return result;
+}
+
+/** Decode the last count trace events of the calling thread, naming the functions bound globally **/
+void dumpTrace(Interpreter& interp, std::ostream& os, size_t count = trace::capacity){
+    trace::dump(os, count, functionNames((*interp.global().atom().car().ns())->bindings()));
+}
+
+/** Write the report of a profiler to the error port, and its samples as collapsed stacks to path unless empty **/
+void reportProfile(Interpreter& interp, const Profiler& profiler, const std::string& path){
+    auto names = profiler.names((*interp.global().atom().car().ns())->bindings());
+    profiler.report(interp.err(), names);
+    if(path.empty()){
+        return;
+    }
+    std::ofstream file(path);
+    if(!file.is_open()){
+        throw EvalError(nil, format("Failed to open file {} for the profile", path));
+    }
+    profiler.collapsed(file, names);
+}
+
+/** Evaluate an expression while profiling it, (profile expr [path]) **/
+Atom profile(Interpreter& interp, const Atom& args, Environment& env){
+    if(!argumentCountIs(1, args) && !argumentCountIs(2, args)){
+        throw EvalError(args, "Expected 1 or 2 arguments for operator 'profile'");
+    }
+    std::string path;
+    if(argumentCountIs(2, args)){
+        Atom file = eval(interp, args.cdr().car(), env);
+        if(file.type != Type::String){
+            throw TypeError(file, format("Expected type {} mismatched with actual type {} for operator 'profile'", toString(Type::String), toString(file.type)));
+        }
+        path = *file.string();
+    }
+    // a nested profile is measured by the outer one
+    if(interp.profiler()){
+        return eval(interp, args.car(), env);
+    }
+    Profiler profiler;
+    profiler.start();
+    interp.setProfiler(&profiler);
+    Atom result;
+    try {
+        result = eval(interp, args.car(), env);
+    } catch(...) {
+        interp.setProfiler(nullptr);
+        throw;
+    }
+    interp.setProfiler(nullptr);
+    profiler.stop();
+    reportProfile(interp, profiler, path);
+    return result;
 }
 
 /**
  * The interpretation and execution of the program using the root s-expression and an environment
  * Note: LISP evaluates everything unless it's quoted
+ * @param interp
  * @param expr
  * @param env
  * @return
  */
-Atom eval(Atom expr, Environment& env){
+Atom eval(Interpreter& interp, Atom expr, Environment& env){
     Atom op, args;
+    interp.checkDeadline();
 
     if(expr.type == Type::Symbol){
         return env.get(expr);
@@ -156,6 +493,7 @@ Atom eval(Atom expr, Environment& env){
 
     op = expr.car();   // get first element as operator
     args = expr.cdr(); // use remaining elements as operands
+    trace::eval(op);
 
     if(op.type == Type::Symbol){
         std::string symbol = *op.symbol();
@@ -164,24 +502,42 @@ Atom eval(Atom expr, Environment& env){
         if(symbol == "QUOTE"){
             return quote(args);
         } else if(symbol == "DEFINE"){
-			return define(args, env);
+			return define(interp, args, env);
         } else if(symbol == "LAMBDA"){
 			return lambda(env, args, expr);
 		} else if(symbol == "IF"){
-            return ifexpr(args, env);
+            return ifexpr(interp, args, env);
 		} else if(symbol == "IMPORT"){
-            return import(args, env);
+            return import(interp, args, env);
+        } else if(symbol == "FUTURE"){
+            return future(interp, args, env);
+        } else if(symbol == "PROFILE"){
+            return profile(interp, args, env);
+        } else if(symbol == "DEFMACRO"){
+            return defmacro(interp, args, env);
+        } else if(symbol == "QUASIQUOTE"){
+            if(!argumentCountIs(1, args)){
+                throw EvalError(args, "Expected 1 argument for operator 'quasiquote'");
+            }
+            return quasiquote(interp, args.car(), env);
         }
     }
 
-    op = eval(op, env); // evaluate operator
-	Atom p = args;
-    // evaluate all arguments
-	while(!p.isNil()){
-        p.car() = eval(p.car(), env);
-		p = p.cdr();
-	}
-	return apply(op, args);
+    op = eval(interp, op, env); // evaluate operator
+    // evaluate all arguments into a new list, the expression itself is left untouched
+    // the list dies with the call, functions keep its items but never the list itself
+    Atom evaluated, p;
+    while(!args.isNil()){
+        Atom item = Atom::local(eval(interp, args.car(), env), nil);
+        if(p.isNil()){
+            evaluated = item;
+        } else {
+            p.cdr() = item;
+        }
+        p = item;
+        args = args.cdr();
+    }
+	return apply(interp, op, evaluated);
 }
 
 #endif //LISP_EVAL_H
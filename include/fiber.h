@@ -0,0 +1,173 @@
+#ifndef LISP_FIBER_H
+#define LISP_FIBER_H
+
+#include "stack.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+
+#if !defined(__x86_64__)
+	#include <ucontext.h>
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+	#include <sanitizer/common_interface_defs.h>
+#endif
+
+/**
+ * Stackful coroutines
+ * The evaluator is recursive, so a suspended task needs its own machine stack. On x86-64 a
+ * switch only saves the callee saved registers (see src/fiber.cpp), elsewhere ucontext is used.
+ */
+#if defined(__x86_64__)
+extern "C" void lisp_fiber_switch(void** save, void* load);
+extern "C" void lisp_fiber_trampoline();
+#endif
+
+/**
+ * A fiber stack, reserved with mmap so only the pages actually used are committed
+ * The lowest page is a guard page, so an overflow faults instead of corrupting memory
+ */
+class FiberStack {
+	void*  m_base = nullptr;
+	size_t m_size = 0;
+
+  public:
+	static constexpr size_t defaultSize = 8 * 1024 * 1024; // as a thread, address space only as eval recurses deeply
+
+	FiberStack() = default;
+	explicit FiberStack(size_t size) {
+		size_t page = ::sysconf(_SC_PAGESIZE);
+		m_size      = (size + page - 1) / page * page + page;
+		m_base      = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if(m_base == MAP_FAILED)
+			throw std::bad_alloc();
+		::mprotect(m_base, page, PROT_NONE);
+	}
+	FiberStack(FiberStack&& other) noexcept:
+		m_base(std::exchange(other.m_base, nullptr)), m_size(std::exchange(other.m_size, 0)) {}
+	FiberStack& operator=(FiberStack&& other) noexcept {
+		std::swap(m_base, other.m_base);
+		std::swap(m_size, other.m_size);
+		return *this;
+	}
+	~FiberStack() {
+		if(m_base)
+			::munmap(m_base, m_size);
+	}
+
+	[[nodiscard]] bool  empty() const { return m_base == nullptr; }
+	[[nodiscard]] void* base() const { return m_base; }
+	[[nodiscard]] void* top() const { return static_cast<char*>(m_base) + m_size; }
+	[[nodiscard]] size_t size() const { return m_size; }
+};
+
+class Fiber {
+	std::function<void()> m_body;
+	FiberStack            m_stack;
+	bool                  m_done = false;
+#if defined(__x86_64__)
+	void* m_sp       = nullptr; // saved stack pointer of the fiber
+	void* m_callerSp = nullptr; // saved stack pointer of whoever resumed it
+#else
+	ucontext_t m_context{}, m_caller{};
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+	// AddressSanitizer is told about every switch, the stack of whoever resumed the fiber included
+	void*       m_fakeStack    = nullptr;
+	const void* m_callerBottom = nullptr;
+	size_t      m_callerSize   = 0;
+#endif
+
+	void startSwitch(bool toFiber) {
+#if defined(__SANITIZE_ADDRESS__)
+		if(toFiber)
+			__sanitizer_start_switch_fiber(&m_fakeStack, m_stack.base(), m_stack.size());
+		else // a finished fiber never comes back, its fake stack is released
+			__sanitizer_start_switch_fiber(m_done ? nullptr : &m_fakeStack, m_callerBottom, m_callerSize);
+#endif
+	}
+	void finishSwitch(bool inFiber) {
+#if defined(__SANITIZE_ADDRESS__)
+		if(inFiber)
+			__sanitizer_finish_switch_fiber(m_fakeStack, &m_callerBottom, &m_callerSize);
+		else
+			__sanitizer_finish_switch_fiber(m_fakeStack, nullptr, nullptr);
+#endif
+	}
+
+	static void entry(Fiber* self) {
+		self->finishSwitch(true);
+		self->m_body();
+		self->m_done = true;
+		self->suspend();
+	}
+
+  public:
+	Fiber(std::function<void()> body, FiberStack stack):
+		m_body(std::move(body)), m_stack(std::move(stack)) {
+#if defined(__x86_64__)
+		// the initial frame is popped by lisp_fiber_switch, which then returns into the trampoline
+		auto** sp = reinterpret_cast<void**>(reinterpret_cast<std::uintptr_t>(m_stack.top()) & ~std::uintptr_t(15));
+		*--sp     = nullptr;                                             // alignment
+		*--sp     = reinterpret_cast<void*>(&lisp_fiber_trampoline);     // return address
+		*--sp     = nullptr;                                             // rbp
+		*--sp     = nullptr;                                             // rbx
+		*--sp     = this;                                                // r12, argument
+		*--sp     = reinterpret_cast<void*>(&Fiber::entry);              // r13, function
+		*--sp     = nullptr;                                             // r14
+		*--sp     = nullptr;                                             // r15
+		*--sp     = reinterpret_cast<void*>(std::uintptr_t(0x037F) << 32 | 0x1F80); // x87 control word, mxcsr
+		m_sp      = sp;
+#else
+		::getcontext(&m_context);
+		m_context.uc_stack.ss_sp   = m_stack.base();
+		m_context.uc_stack.ss_size = m_stack.size();
+		m_context.uc_link          = nullptr;
+		auto ptr                   = reinterpret_cast<std::uintptr_t>(this);
+		::makecontext(&m_context, reinterpret_cast<void (*)()>(&Fiber::start), 2, unsigned(ptr >> 32), unsigned(ptr));
+#endif
+	}
+	Fiber(const Fiber&) = delete;
+	Fiber& operator=(const Fiber&) = delete;
+
+#if !defined(__x86_64__)
+	static void start(unsigned high, unsigned low) {
+		entry(reinterpret_cast<Fiber*>(std::uintptr_t(high) << 32 | low));
+	}
+#endif
+
+	/** Run the fiber until it suspends or finishes, a finished fiber can not be resumed **/
+	void resume() {
+		const char* limit = std::exchange(stack::t_limit, stack::limitOf(m_stack.base(), m_stack.size()));
+		startSwitch(true);
+#if defined(__x86_64__)
+		lisp_fiber_switch(&m_callerSp, m_sp);
+#else
+		::swapcontext(&m_caller, &m_context);
+#endif
+		finishSwitch(false);
+		stack::t_limit = limit;
+	}
+
+	/** Switch back to whoever resumed the fiber, only valid from inside the fiber **/
+	void suspend() {
+		startSwitch(false);
+#if defined(__x86_64__)
+		lisp_fiber_switch(&m_sp, m_callerSp);
+#else
+		::swapcontext(&m_context, &m_caller);
+#endif
+		finishSwitch(true);
+	}
+
+	[[nodiscard]] bool done() const { return m_done; }
+
+	/** Take the stack of a finished fiber, for reuse **/
+	FiberStack release() { return std::move(m_stack); }
+};
+
+#endif //LISP_FIBER_H
@@ -0,0 +1,37 @@
+#ifndef LISP_FUTURE_H
+#define LISP_FUTURE_H
+
+#include "atom.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <exception>
+#include <thread>
+
+/**
+ * The result of an expression evaluated on the thread pool of an interpreter
+ * Either a value or the error evaluating it raised, valid once ready is set
+ */
+struct Future {
+	std::atomic<bool>  ready = false;
+	Atom               value;
+	std::exception_ptr error;
+	memory::Counted<memory::Kind::Future> counted{sizeof(Future)};
+
+	/**
+	 * Wait for the result, running queued work of the pool meanwhile
+	 * @param pool
+	 * @return the value, or rethrows the error
+	 */
+	Atom touch(ThreadPool& pool) {
+		while(!ready.load(std::memory_order_acquire)) {
+			if(!pool.runOne())
+				std::this_thread::yield();
+		}
+		if(error)
+			std::rethrow_exception(error);
+		return value;
+	}
+};
+
+#endif //LISP_FUTURE_H
@@ -0,0 +1,93 @@
+#ifndef LISP_IMAGE_H
+#define LISP_IMAGE_H
+
+#include "environment.h"
+#include "eval.h"
+#include "interpreter.h"
+#include "serialize.h"
+#include "version.h"
+
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Heap images
+ * An image is a snapshot of the global environment, everything reachable from it (closures
+ * and symbols included), the macros and the registry of imported modules, so a later start can skip
+ * loading the prelude. The encoding is relocatable (see serialize.h) and tied to the
+ * interpreter version.
+ */
+constexpr char imageMagic[] = "LISPI";
+
+/**
+ * Write an image of the global environment of an interpreter
+ * @param path
+ * @param interp
+ */
+void saveImage(const std::string& path, Interpreter& interp) {
+	// (global frame . (((module path . result) ...) . ((macro name . expander) ...)))
+	Atom loaded;
+	for(auto& [module, result]: interp.modules())
+		loaded = Atom(Atom(Atom(module), result), loaded);
+	Atom macros;
+	for(auto& [name, expander]: interp.macros().all())
+		macros = Atom(Atom(Atom(name), expander), macros);
+
+	std::string data;
+	AtomWriter  writer(data, &interp.builtins());
+	writer.putString(imageMagic);
+	writer.putString(interpreterVersion);
+	writer.put<std::uint32_t>(serializeFormat);
+	writer.write(Atom(interp.global().atom(), Atom(loaded, macros)));
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if(!file.write(data.data(), data.size()))
+		throw SerializeError(format("Failed to write image {}", path));
+}
+
+/**
+ * Map an image and restore the global environment, macros & imported modules of an interpreter from it
+ * Built-in functions are resolved against the built-ins of the interpreter
+ * @param path
+ * @param interp
+ */
+void loadImage(const std::string& path, Interpreter& interp) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw SerializeError(format("Failed to open image {}", path));
+	struct stat info {};
+	if(::fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		throw SerializeError(format("Failed to read image {}", path));
+	}
+	void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(data == MAP_FAILED)
+		throw SerializeError(format("Failed to map image {}", path));
+
+	Atom root;
+	try {
+		AtomReader reader(std::string_view(static_cast<const char*>(data), info.st_size), &interp.builtins());
+		if(reader.string() != imageMagic)
+			throw SerializeError(format("{} is not an image", path));
+		if(reader.string() != interpreterVersion || reader.get<std::uint32_t>() != serializeFormat)
+			throw SerializeError(format("Image {} was saved by a different interpreter version", path));
+		root = reader.read();
+	} catch(SerializeError&) {
+		::munmap(data, info.st_size);
+		throw;
+	}
+	::munmap(data, info.st_size);
+
+	for(Atom loaded = root.cdr().car(); !loaded.isNil(); loaded = loaded.cdr())
+		interp.modules().add(*loaded.car().car().symbol(), loaded.car().cdr());
+	for(Atom macros = root.cdr().cdr(); !macros.isNil(); macros = macros.cdr())
+		interp.macros().define(*macros.car().car().symbol(), macros.car().cdr());
+	interp.global() = Environment::fromFrame(root.car());
+}
+
+#endif //LISP_IMAGE_H
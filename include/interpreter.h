@@ -0,0 +1,146 @@
+#ifndef LISP_INTERPRETER_H
+#define LISP_INTERPRETER_H
+
+#include "atom.h"
+#include "environment.h"
+#include "macro.h"
+#include "module.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "stack.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+/**
+ * Evaluates the top level expressions of an interpreter in place of the tree walking eval, eg. by
+ * compiling them first. Closures it creates are applied through it as well.
+ */
+class Evaluator {
+  public:
+	virtual ~Evaluator() = default;
+	/** Evaluate a top level expression in env **/
+	virtual Atom eval(Interpreter& interp, const Atom& expr, Environment& env) = 0;
+	/** Apply a closure the evaluator created, nullopt for any other closure **/
+	virtual std::optional<Atom> applyClosure(Interpreter& interp, const Atom& fn, const Atom& args) = 0;
+};
+
+/**
+ * An interpreter instance, it owns all state a program can observe or change:
+ * the global environment, the registry of imported modules and the I/O ports.
+ * Interpreters share no mutable state, so separate instances can run on separate threads
+ * without locking. Every evaluation and built-in function call receives its interpreter.
+ */
+class Interpreter {
+	const BuiltinTable& m_builtins;
+	Environment         m_global;
+	ModuleRegistry      m_modules;
+	ModuleCache         m_moduleCache;
+	MacroTable          m_macros;
+	std::istream*       m_in;
+	std::ostream*       m_out;
+	std::ostream*       m_err;
+	Scheduler           m_scheduler;
+	// the evaluator of top level expressions, the tree walking eval without one
+	std::unique_ptr<Evaluator> m_evaluator;
+	// created on first use, destroyed first so no worker outlives the state above
+	std::once_flag              m_poolOnce;
+	std::unique_ptr<ThreadPool> m_pool;
+	// steady clock time in ns evaluation has to finish by, 0 without a deadline
+	std::atomic<std::int64_t> m_deadline = 0;
+	// evaluations since the clock was last read, per thread as the pool evaluates too
+	static inline thread_local std::uint32_t t_ticks = 0;
+	// measures the functions applied while set, not owned
+	std::atomic<Profiler*> m_profiler = nullptr;
+
+	static constexpr std::uint32_t ticksPerClockRead = 1024;
+
+  public:
+	/**
+	 * @param builtins the built-in functions bound in the global environment
+	 * @param in port read by the program
+	 * @param out port written by the program & results
+	 * @param err port errors are reported to
+	 */
+	explicit Interpreter(const BuiltinTable& builtins, std::istream& in = std::cin, std::ostream& out = std::cout, std::ostream& err = std::cerr):
+		m_builtins(builtins), m_global(Environment::global(builtins)), m_moduleCache(ModuleCache::fromEnvironment()),
+		m_in(&in), m_out(&out), m_err(&err) {
+		m_global.set(Atom("t"), Atom("t"));
+	}
+	Interpreter(const Interpreter&) = delete;
+	Interpreter& operator=(const Interpreter&) = delete;
+
+	[[nodiscard]] const BuiltinTable& builtins() const { return m_builtins; }
+	Environment&                      global() { return m_global; }
+	ModuleRegistry&                   modules() { return m_modules; }
+	[[nodiscard]] const ModuleCache&  moduleCache() const { return m_moduleCache; }
+	void                              setModuleCache(ModuleCache cache) { m_moduleCache = std::move(cache); }
+	MacroTable&                       macros() { return m_macros; }
+
+	/** The green threads of the interpreter **/
+	Scheduler& scheduler() { return m_scheduler; }
+
+	/** The worker threads parallel built-in functions run on **/
+	ThreadPool& pool() {
+		std::call_once(m_poolOnce, [this] { m_pool = std::make_unique<ThreadPool>(); });
+		return *m_pool;
+	}
+
+	/** Limit the evaluations of the interpreter, on any thread, to finish by deadline **/
+	void setDeadline(std::chrono::steady_clock::time_point deadline) {
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+		m_deadline.store(std::max<std::int64_t>(ns, 1), std::memory_order_relaxed);
+	}
+	void clearDeadline() { m_deadline.store(0, std::memory_order_relaxed); }
+
+	/**
+	 * Called by eval, raises a TimeoutError past the deadline, reading the clock only once every so
+	 * many calls, & an EvalError when the guarded stack of the thread runs out
+	 */
+	void checkDeadline() {
+		if(stack::exhausted())
+			throw EvalError(nil, "Stack overflow");
+		if(m_deadline.load(std::memory_order_relaxed) == 0 || ++t_ticks % ticksPerClockRead != 0)
+			return;
+		if(pastDeadline())
+			throw TimeoutError("Evaluation timed out");
+	}
+
+	/** Whether the deadline passed, reads the clock **/
+	bool pastDeadline() const {
+		std::int64_t deadline = m_deadline.load(std::memory_order_relaxed);
+		if(deadline == 0)
+			return false;
+		auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		return now >= deadline;
+	}
+
+	/** The evaluator replacing the tree walking eval, if any **/
+	Evaluator* evaluator() const { return m_evaluator.get(); }
+	void       setEvaluator(std::unique_ptr<Evaluator> evaluator) { m_evaluator = std::move(evaluator); }
+
+	/** The profiler measuring the interpreter, if any **/
+	Profiler* profiler() const { return m_profiler.load(std::memory_order_relaxed); }
+	void      setProfiler(Profiler* profiler) { m_profiler.store(profiler, std::memory_order_relaxed); }
+
+	/** Whether the thread pool was created, its threads would not survive a fork **/
+	bool poolStarted() const { return m_pool != nullptr; }
+
+	/** I/O ports **/
+	std::istream& in() { return *m_in; }
+	std::ostream& out() { return *m_out; }
+	std::ostream& err() { return *m_err; }
+	void          setPorts(std::istream& in, std::ostream& out, std::ostream& err) {
+		m_in  = &in;
+		m_out = &out;
+		m_err = &err;
+	}
+};
+
+#endif //LISP_INTERPRETER_H
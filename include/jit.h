@@ -0,0 +1,248 @@
+#ifndef LISP_JIT_H
+#define LISP_JIT_H
+
+#include "interpreter.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define LISP_JIT 1
+#else
+#define LISP_JIT 0
+#endif
+
+/**
+ * Native code generation for x86-64
+ * A native function follows the System V calling convention: a Context in rdi, up to maxArity
+ * integer arguments in the following argument registers, the result in rax. Its frame keeps the
+ * context in rbx and the arguments in stack slots, an expression is evaluated into rax with the
+ * intermediate values pushed. Every call counts down the budget of the context, once it is used up
+ * the caller is asked whether to go on, eg. to honor the evaluation deadline. When it says no, the
+ * call returns through every native frame with aborted set & a meaningless result.
+ */
+namespace jit {
+	struct Context {
+		std::int64_t budget; // calls until the next check
+		std::int64_t aborted;
+		Interpreter* interp;
+	};
+	static_assert(offsetof(Context, budget) == 0 && offsetof(Context, aborted) == 8, "the offsets are encoded in native code");
+
+	constexpr std::int64_t callsPerCheck = 1 << 14;
+	constexpr size_t       maxArity      = 5;
+
+	using Entry = std::int64_t (*)(Context*, std::int64_t, std::int64_t, std::int64_t, std::int64_t, std::int64_t);
+
+	/** Whether native code can be generated on this platform **/
+	constexpr bool available() { return LISP_JIT; }
+
+	// called by native code when the budget is used up, non zero to abort
+	inline std::int64_t budgetExhausted(Context* context) {
+		context->budget  = callsPerCheck;
+		context->aborted = context->interp->pastDeadline();
+		return context->aborted;
+	}
+
+	/** Executable memory holding the code of a function **/
+	class Code {
+		void*  m_memory = nullptr;
+		size_t m_size   = 0;
+
+	  public:
+		explicit Code(const std::vector<std::uint8_t>& bytes) {
+#if LISP_JIT
+			m_size         = bytes.size();
+			void* memory   = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(memory == MAP_FAILED)
+				return;
+			std::memcpy(memory, bytes.data(), m_size);
+			// never writable & executable at once
+			if(::mprotect(memory, m_size, PROT_READ | PROT_EXEC) != 0) {
+				::munmap(memory, m_size);
+				return;
+			}
+			m_memory = memory;
+#endif
+		}
+		Code(const Code&) = delete;
+		Code& operator=(const Code&) = delete;
+		~Code() {
+#if LISP_JIT
+			if(m_memory)
+				::munmap(m_memory, m_size);
+#endif
+		}
+
+		/** The function, nullptr when the memory could not be made executable **/
+		[[nodiscard]] Entry entry() const { return reinterpret_cast<Entry>(m_memory); }
+	};
+
+	/**
+	 * Emits the templates native functions are made of
+	 * Keeps track of the values pushed, so calls are made with the stack aligned to 16 bytes.
+	 */
+	class Assembler {
+	  public:
+		using Label = size_t;
+		enum class Condition { Less, Equal };
+
+	  private:
+		// the registers the arguments are passed in, after the context
+		static constexpr std::uint8_t argumentRegisters[maxArity] = {6 /* rsi */, 2 /* rdx */, 1 /* rcx */, 8 /* r8 */, 9 /* r9 */};
+
+		std::vector<std::uint8_t>                m_bytes;
+		std::vector<size_t>                      m_labels; // positions, SIZE_MAX until bound
+		std::vector<std::pair<size_t, Label>>    m_fixups; // rel32 operands to patch
+		size_t                                   m_depth = 0; // values pushed
+		Label                                    m_exit;
+
+		void emit(std::initializer_list<std::uint8_t> bytes) { m_bytes.insert(m_bytes.end(), bytes); }
+		void emit32(std::int32_t value) {
+			for(int i = 0; i < 4; i++)
+				m_bytes.push_back(std::uint8_t(std::uint32_t(value) >> (8 * i)));
+		}
+		void emit64(std::int64_t value) {
+			for(int i = 0; i < 8; i++)
+				m_bytes.push_back(std::uint8_t(std::uint64_t(value) >> (8 * i)));
+		}
+		void relative(Label label) {
+			m_fixups.emplace_back(m_bytes.size(), label);
+			emit32(0);
+		}
+		static std::int32_t slot(size_t index) { return -16 - 8 * std::int32_t(index); }
+		void popInto(std::uint8_t reg) {
+			if(reg >= 8)
+				emit({0x41});
+			emit({std::uint8_t(0x58 + (reg & 7))});
+			m_depth--;
+		}
+		// the value pushed last into rax, the value of rax into rcx
+		void popOperands() {
+			emit({0x48, 0x89, 0xC1}); // mov rcx, rax
+			popInto(0);               // pop rax
+		}
+		template<typename Call>
+		void aligned(Call call) {
+			if(m_depth % 2)
+				emit({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+			call();
+			if(m_depth % 2)
+				emit({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+		}
+
+	  public:
+		Assembler():
+			m_exit(label()) {}
+
+		Label label() {
+			m_labels.push_back(SIZE_MAX);
+			return m_labels.size() - 1;
+		}
+		void bind(Label label) { m_labels[label] = m_bytes.size(); }
+
+		/** Set up the frame of a function of arity arguments & count down the budget **/
+		void prologue(size_t arity) {
+			emit({0x55});                   // push rbp
+			emit({0x48, 0x89, 0xE5});       // mov rbp, rsp
+			emit({0x53});                   // push rbx
+			emit({0x48, 0x89, 0xFB});       // mov rbx, rdi
+			emit({0x48, 0x81, 0xEC});       // sub rsp, slots, an odd count keeps the stack aligned
+			emit32(std::int32_t(8 * (arity | 1)));
+			for(size_t i = 0; i < arity; i++) {
+				std::uint8_t reg = argumentRegisters[i];
+				emit({std::uint8_t(reg >= 8 ? 0x4C : 0x48), 0x89, std::uint8_t(0x85 | ((reg & 7) << 3))}); // mov [rbp + slot], reg
+				emit32(slot(i));
+			}
+			Label body = label();
+			emit({0x48, 0xFF, 0x0B}); // dec qword [rbx]
+			emit({0x0F, 0x85});       // jnz body
+			relative(body);
+			emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+			emit({0x48, 0xB8});       // mov rax, budgetExhausted
+			emit64(std::int64_t(reinterpret_cast<std::intptr_t>(&budgetExhausted)));
+			emit({0xFF, 0xD0});       // call rax
+			emit({0x48, 0x85, 0xC0}); // test rax, rax
+			emit({0x0F, 0x85});       // jnz exit
+			relative(m_exit);
+			bind(body);
+		}
+
+		/** Return rax **/
+		void epilogue() {
+			bind(m_exit);
+			emit({0x48, 0x8B, 0x5D, 0xF8}); // mov rbx, [rbp - 8]
+			emit({0xC9});                   // leave
+			emit({0xC3});                   // ret
+		}
+
+		void constant(std::int64_t value) {
+			emit({0x48, 0xB8}); // mov rax, value
+			emit64(value);
+		}
+		void argument(size_t index) {
+			emit({0x48, 0x8B, 0x85}); // mov rax, [rbp + slot]
+			emit32(slot(index));
+		}
+		void push() {
+			emit({0x50}); // push rax
+			m_depth++;
+		}
+
+		/** rax = pushed + rax, pushed - rax, pushed * rax **/
+		void add() {
+			popOperands();
+			emit({0x48, 0x01, 0xC8}); // add rax, rcx
+		}
+		void sub() {
+			popOperands();
+			emit({0x48, 0x29, 0xC8}); // sub rax, rcx
+		}
+		void mul() {
+			popOperands();
+			emit({0x48, 0x0F, 0xAF, 0xC1}); // imul rax, rcx
+		}
+
+		/** Jump to otherwise unless pushed < rax / pushed = rax **/
+		void branchUnless(Condition condition, Label otherwise) {
+			popOperands();
+			emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+			emit({0x0F, std::uint8_t(condition == Condition::Less ? 0x8D /* jge */ : 0x85 /* jne */)});
+			relative(otherwise);
+		}
+		void jump(Label label) {
+			emit({0xE9});
+			relative(label);
+		}
+
+		/** Call the function being assembled with the last arity values pushed, returning when aborted **/
+		void callSelf(size_t arity) {
+			for(size_t i = arity; i-- > 0;)
+				popInto(argumentRegisters[i]);
+			emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+			aligned([&] {
+				emit({0xE8}); // call the start
+				m_fixups.emplace_back(m_bytes.size(), SIZE_MAX);
+				emit32(0);
+			});
+			emit({0x48, 0x83, 0x7B, 0x08, 0x00}); // cmp qword [rbx + 8], 0
+			emit({0x0F, 0x85});                   // jne exit
+			relative(m_exit);
+		}
+
+		/** The machine code, with every jump resolved **/
+		std::vector<std::uint8_t> finish() {
+			for(auto [at, label]: m_fixups) {
+				size_t target = label == SIZE_MAX ? 0 : m_labels[label];
+				auto   offset = std::int32_t(std::int64_t(target) - std::int64_t(at + 4));
+				std::memcpy(&m_bytes[at], &offset, 4);
+			}
+			return m_bytes;
+		}
+	};
+} // namespace jit
+
+#endif //LISP_JIT_H
@@ -0,0 +1,68 @@
+#ifndef LISP_MACRO_H
+#define LISP_MACRO_H
+
+#include "atom.h"
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * The macros of an interpreter by name, each bound to its expander: a closure applied to the
+ * unevaluated arguments of a use of the macro, returning the expression the use is replaced by
+ * (see expandMacros). Macros are global, shared by the threads evaluating in the interpreter.
+ * Evaluations whose definitions are dropped afterwards drop their macros with a Scope.
+ */
+class MacroTable {
+	mutable std::shared_mutex             m_lock;
+	std::unordered_map<std::string, Atom> m_macros;
+	std::atomic<bool>                     m_empty = true; // programs without macros skip expansion
+
+  public:
+	[[nodiscard]] bool empty() const { return m_empty.load(std::memory_order_acquire); }
+
+	[[nodiscard]] std::optional<Atom> find(const std::string& name) const {
+		std::shared_lock<std::shared_mutex> guard(m_lock);
+		auto                                it = m_macros.find(name);
+		if(it == m_macros.end())
+			return std::nullopt;
+		return it->second;
+	}
+
+	void define(const std::string& name, const Atom& expander) {
+		std::unique_lock<std::shared_mutex> guard(m_lock);
+		m_macros[name] = expander;
+		m_empty.store(false, std::memory_order_release);
+	}
+
+	/** The macros by name, eg. to save them in an image **/
+	[[nodiscard]] std::unordered_map<std::string, Atom> all() const {
+		std::shared_lock<std::shared_mutex> guard(m_lock);
+		return m_macros;
+	}
+
+	/** Restores the macros of a table when it goes out of scope, for evaluations whose definitions are dropped **/
+	class Scope {
+		MacroTable&                           m_table;
+		std::unordered_map<std::string, Atom> m_saved;
+
+	  public:
+		explicit Scope(MacroTable& table):
+			m_table(table) {
+			std::shared_lock<std::shared_mutex> guard(table.m_lock);
+			m_saved = table.m_macros;
+		}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope() {
+			std::unique_lock<std::shared_mutex> guard(m_table.m_lock);
+			m_table.m_macros = std::move(m_saved);
+			m_table.m_empty.store(m_table.m_macros.empty(), std::memory_order_release);
+		}
+	};
+};
+
+#endif //LISP_MACRO_H
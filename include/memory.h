@@ -0,0 +1,185 @@
+#ifndef LISP_MEMORY_H
+#define LISP_MEMORY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+/**
+ * Allocation statistics of the objects the interpreter creates
+ * Every thread counts its allocations & frees in thread local counters and adds them to the
+ * process wide totals once its live bytes changed by flushBytes, so counting costs no atomic
+ * operation per object. The totals of other threads lag behind by up to flushBytes each.
+ * Pairs (lists, closures & environment frames), futures, tasks, channels and ports are counted
+ * until they are freed, closures, frames and strings are counted when they are created only as
+ * they are made of pairs or copied by value.
+ * Objects are freed by reference counting, there is no collector and so no pause.
+ */
+namespace memory {
+	enum class Kind {
+		Pair,
+		Closure,
+		Frame,
+		String,
+		Future,
+		Task,
+		Channel,
+		Port
+	};
+	constexpr size_t kinds = size_t(Kind::Port) + 1;
+
+	inline const char* toString(Kind kind) {
+		switch(kind) {
+		case Kind::Pair: return "pair";
+		case Kind::Closure: return "closure";
+		case Kind::Frame: return "frame";
+		case Kind::String: return "string";
+		case Kind::Future: return "future";
+		case Kind::Task: return "task";
+		case Kind::Channel: return "channel";
+		case Kind::Port: return "port";
+		}
+		return "unknown";
+	}
+
+	/** Whether objects of kind are counted until they are freed **/
+	constexpr bool tracksLifetime(Kind kind) {
+		return kind != Kind::Closure && kind != Kind::Frame && kind != Kind::String;
+	}
+
+	constexpr std::int64_t flushBytes = 16 * 1024;
+
+	struct Totals {
+		std::atomic<std::uint64_t> allocations[kinds] = {};
+		std::atomic<std::uint64_t> frees[kinds]       = {};
+		std::atomic<std::int64_t>  liveBytes          = 0;
+		std::atomic<std::int64_t>  peakBytes          = 0;
+	};
+	inline Totals totals;
+
+	// trivially destructible, objects freed by destructors running after the thread exited still count
+	struct Local {
+		std::uint64_t allocations[kinds]        = {}; // since the thread started, the profiler reads them
+		std::uint64_t frees[kinds]              = {};
+		std::uint64_t flushedAllocations[kinds] = {};
+		std::uint64_t flushedFrees[kinds]       = {};
+		std::int64_t  bytes                     = 0; // live bytes not yet added to the totals
+		std::int64_t  maxBytes                  = 0; // the highest bytes since the last flush, for the peak
+		bool          registered                = false;
+	};
+	inline thread_local Local t_local;
+
+	inline void flush() {
+		Local& local = t_local;
+		for(size_t k = 0; k < kinds; k++) {
+			totals.allocations[k].fetch_add(local.allocations[k] - local.flushedAllocations[k], std::memory_order_relaxed);
+			totals.frees[k].fetch_add(local.frees[k] - local.flushedFrees[k], std::memory_order_relaxed);
+			local.flushedAllocations[k] = local.allocations[k];
+			local.flushedFrees[k]       = local.frees[k];
+		}
+		std::int64_t highest = totals.liveBytes.fetch_add(local.bytes, std::memory_order_relaxed) + std::max(local.bytes, local.maxBytes);
+		local.bytes = local.maxBytes = 0;
+		std::int64_t peak = totals.peakBytes.load(std::memory_order_relaxed);
+		while(highest > peak && !totals.peakBytes.compare_exchange_weak(peak, highest, std::memory_order_relaxed)) {}
+	}
+
+	// the counts of a thread are added to the totals when it exits
+	inline void registerThread() {
+		struct Exit {
+			~Exit() { flush(); }
+		};
+		static thread_local Exit exit;
+		(void)exit;
+		t_local.registered = true;
+	}
+
+	inline void allocated(Kind kind, size_t bytes) {
+		Local& local = t_local;
+		if(!local.registered)
+			registerThread();
+		local.allocations[size_t(kind)]++;
+		local.bytes += std::int64_t(bytes);
+		if(local.bytes > local.maxBytes)
+			local.maxBytes = local.bytes;
+		if(local.bytes >= flushBytes)
+			flush();
+	}
+
+	inline void freed(Kind kind, size_t bytes) {
+		Local& local = t_local;
+		local.frees[size_t(kind)]++;
+		if((local.bytes -= std::int64_t(bytes)) <= -flushBytes)
+			flush();
+	}
+
+	/** Objects of kind the calling thread allocated **/
+	inline std::uint64_t allocations(Kind kind) { return t_local.allocations[size_t(kind)]; }
+
+	/** Counts an object from construction to destruction, as a member of the object **/
+	template<Kind kind>
+	class Counted {
+		size_t m_bytes;
+
+	  public:
+		explicit Counted(size_t bytes):
+			m_bytes(bytes) { allocated(kind, m_bytes); }
+		Counted(const Counted& other):
+			m_bytes(other.m_bytes) { allocated(kind, m_bytes); }
+		Counted& operator=(const Counted&) { return *this; }
+		~Counted() { freed(kind, m_bytes); }
+	};
+
+	struct Stats {
+		std::uint64_t allocations[kinds];
+		std::int64_t  live[kinds]; // objects not freed yet, for the kinds whose lifetime is tracked
+		std::int64_t  liveBytes;
+		std::int64_t  peakBytes;
+	};
+
+	/** The process wide statistics, including everything the calling thread counted **/
+	inline Stats stats() {
+		flush();
+		Stats stats {};
+		for(size_t k = 0; k < kinds; k++) {
+			stats.allocations[k] = totals.allocations[k].load(std::memory_order_relaxed);
+			stats.live[k]        = std::int64_t(stats.allocations[k] - totals.frees[k].load(std::memory_order_relaxed));
+		}
+		stats.liveBytes = totals.liveBytes.load(std::memory_order_relaxed);
+		stats.peakBytes = std::max(stats.liveBytes, totals.peakBytes.load(std::memory_order_relaxed));
+		return stats;
+	}
+
+	/** A summary table of the statistics **/
+	inline void summary(std::ostream& os, const Stats& stats) {
+		os << std::left << std::setw(10) << "kind" << std::right << std::setw(14) << "allocations" << std::setw(12) << "live" << "\n";
+		for(size_t k = 0; k < kinds; k++) {
+			os << std::left << std::setw(10) << toString(Kind(k)) << std::right << std::setw(14) << stats.allocations[k];
+			if(tracksLifetime(Kind(k)))
+				os << std::setw(12) << stats.live[k];
+			os << "\n";
+		}
+		os << "live bytes " << stats.liveBytes << ", peak bytes " << stats.peakBytes << "\n";
+	}
+
+	/** The statistics as a JSON object **/
+	inline void json(std::ostream& os, const Stats& stats) {
+		os << "{\"allocations\": {";
+		for(size_t k = 0; k < kinds; k++)
+			os << (k ? ", " : "") << "\"" << toString(Kind(k)) << "\": " << stats.allocations[k];
+		os << "}, \"live\": {";
+		bool first = true;
+		for(size_t k = 0; k < kinds; k++) {
+			if(!tracksLifetime(Kind(k)))
+				continue;
+			os << (first ? "" : ", ") << "\"" << toString(Kind(k)) << "\": " << stats.live[k];
+			first = false;
+		}
+		os << "}, \"live_bytes\": " << stats.liveBytes << ", \"peak_bytes\": " << stats.peakBytes << "}\n";
+	}
+} // namespace memory
+
+#endif //LISP_MEMORY_H
@@ -0,0 +1,160 @@
+#ifndef LISP_MODULE_H
+#define LISP_MODULE_H
+
+#include "atom.h"
+#include "serialize.h"
+#include "version.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unistd.h>
+
+/**
+ * Keeps track of the modules which have been imported, so every path is only loaded once
+ */
+class ModuleRegistry {
+	std::unordered_map<std::string, Atom> m_modules;
+
+  public:
+	[[nodiscard]] std::optional<Atom> find(const std::string& path) const {
+		auto it = m_modules.find(path);
+		if(it == m_modules.end())
+			return std::nullopt;
+		return it->second;
+	}
+	// a module is registered before it is evaluated, so cyclic imports terminate
+	void add(const std::string& path, const Atom& result = nil) {
+		m_modules[path] = result;
+	}
+	[[nodiscard]] size_t size() const { return m_modules.size(); }
+	[[nodiscard]] auto   begin() const { return m_modules.begin(); }
+	[[nodiscard]] auto   end() const { return m_modules.end(); }
+};
+
+/**
+ * 64 bit FNV-1a hash
+ */
+inline std::uint64_t hash(std::string_view data, std::uint64_t hash = 14695981039346656037ull) {
+	for(unsigned char c: data) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/**
+ * On-disk cache of parsed modules
+ * An entry is keyed by the hash of the source, the interpreter & the reader version, so a
+ * stale or foreign entry is never used. The cache lives in $LISP_CACHE_DIR, $XDG_CACHE_HOME/lisp or
+ * ~/.cache/lisp, and is disabled when LISP_NO_CACHE is set.
+ */
+class ModuleCache {
+	static constexpr char magic[] = "LISPC";
+	std::filesystem::path m_dir;
+
+	[[nodiscard]] std::uint64_t key(const std::string& source) const {
+		return hash(source, hash(interpreterVersion) ^ serializeFormat ^ std::uint64_t(readerVersion) << 32);
+	}
+	[[nodiscard]] std::filesystem::path entry(std::uint64_t key) const {
+		std::stringstream name;
+		name << std::hex << std::setw(16) << std::setfill('0') << key << ".lispc";
+		return m_dir / name.str();
+	}
+
+  public:
+	explicit ModuleCache(std::filesystem::path dir = {}):
+		m_dir(std::move(dir)) {}
+
+	static ModuleCache fromEnvironment() {
+		if(std::getenv("LISP_NO_CACHE"))
+			return ModuleCache();
+		if(auto* dir = std::getenv("LISP_CACHE_DIR"))
+			return ModuleCache(dir);
+		if(auto* dir = std::getenv("XDG_CACHE_HOME"))
+			return ModuleCache(std::filesystem::path(dir) / "lisp");
+		if(auto* dir = std::getenv("HOME"))
+			return ModuleCache(std::filesystem::path(dir) / ".cache" / "lisp");
+		return ModuleCache();
+	}
+
+	[[nodiscard]] bool enabled() const { return !m_dir.empty(); }
+
+	/**
+	 * Look up the parsed form of a source
+	 * @param source
+	 * @return the list of top level expressions, if a valid entry exists
+	 */
+	[[nodiscard]] std::optional<Atom> load(const std::string& source) const {
+		if(!enabled())
+			return std::nullopt;
+		std::ifstream file(entry(key(source)), std::ios::binary);
+		if(!file.is_open())
+			return std::nullopt;
+		std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		try {
+			AtomReader reader(data);
+			if(reader.string() != magic || reader.string() != interpreterVersion ||
+			   reader.get<std::uint32_t>() != serializeFormat ||
+			   reader.get<std::uint32_t>() != readerVersion ||
+			   reader.get<std::uint64_t>() != source.size() ||
+			   reader.get<std::uint64_t>() != hash(source))
+				return std::nullopt;
+			return reader.read();
+		} catch(SerializeError&) {
+			return std::nullopt; // treat a corrupt entry as a miss
+		}
+	}
+
+	/**
+	 * Store the parsed form of a source, failures are ignored as the cache is only an optimization
+	 * @param source
+	 * @param program the list of top level expressions
+	 */
+	void store(const std::string& source, const Atom& program) const {
+		if(!enabled())
+			return;
+		std::string data;
+		AtomWriter  writer(data);
+		writer.putString(magic);
+		writer.putString(interpreterVersion);
+		writer.put<std::uint32_t>(serializeFormat);
+		writer.put<std::uint32_t>(readerVersion);
+		writer.put<std::uint64_t>(source.size());
+		writer.put<std::uint64_t>(hash(source));
+		try {
+			writer.write(program);
+		} catch(SerializeError&) {
+			return;
+		}
+
+		std::error_code error;
+		std::filesystem::create_directories(m_dir, error);
+		auto path = entry(key(source));
+		// unique to the writer, the threads & interpreters of a process included
+		static std::atomic<std::uint64_t> writes = 0;
+		auto                              tmp    = path;
+		tmp += format(".{}.{}", ::getpid(), writes++);
+		bool written;
+		{
+			std::ofstream file(tmp, std::ios::binary);
+			written = bool(file.write(data.data(), data.size()));
+		}
+		if(!written) {
+			std::filesystem::remove(tmp, error);
+			return;
+		}
+		// rename is atomic, so concurrent interpreters never read a partial entry
+		std::filesystem::rename(tmp, path, error);
+		if(error)
+			std::filesystem::remove(tmp, error);
+	}
+};
+
+#endif //LISP_MODULE_H
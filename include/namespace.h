@@ -0,0 +1,261 @@
+#ifndef LISP_NAMESPACE_H
+#define LISP_NAMESPACE_H
+
+#include "atom.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Epoch based reclamation
+ * A reader announces the global epoch in its slot while it holds pointers into shared data, an
+ * object retired at epoch e is deleted once no slot announces an epoch of e or earlier. Readers
+ * only write their own slot, so they never wait for a writer or for each other.
+ */
+class EpochDomain {
+  public:
+	static constexpr size_t maxThreads = 512;
+
+  private:
+	struct alignas(64) Slot {
+		std::atomic<bool>          owned  = false;
+		std::atomic<std::uint64_t> active = 0; // epoch announced by the reader, 0 when quiescent
+	};
+	struct Retired {
+		std::uint64_t         epoch;
+		std::function<void()> reclaim;
+	};
+
+	std::atomic<std::uint64_t> m_epoch = 1;
+	Slot                       m_slots[maxThreads];
+	std::mutex                 m_retiredLock;
+	std::vector<Retired>       m_retired;
+
+	// the slot of the calling thread, claimed on first use & released when the thread exits
+	Slot& slot() {
+		struct Owner {
+			Slot* slot = nullptr;
+			~Owner() {
+				if(slot)
+					slot->owned.store(false, std::memory_order_release);
+			}
+		};
+		static thread_local Owner owner;
+		if(!owner.slot) {
+			for(auto& candidate: m_slots) {
+				bool expected = false;
+				if(candidate.owned.compare_exchange_strong(expected, true)) {
+					owner.slot = &candidate;
+					break;
+				}
+			}
+			if(!owner.slot)
+				throw std::runtime_error("Too many threads reading shared namespaces");
+		}
+		return *owner.slot;
+	}
+
+	// the earliest epoch announced by a reader
+	std::uint64_t oldestActive() const {
+		std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+		for(auto& slot: m_slots) {
+			std::uint64_t active = slot.active.load(std::memory_order_seq_cst);
+			if(active != 0)
+				oldest = std::min(oldest, active);
+		}
+		return oldest;
+	}
+
+  public:
+	/** The domain shared by every namespace **/
+	static EpochDomain& instance() {
+		static EpochDomain domain;
+		return domain;
+	}
+
+	/** Pointers read from shared data stay valid while a guard exists on the thread, guards nest **/
+	class Guard {
+		Slot*         m_slot;
+		std::uint64_t m_previous;
+
+	  public:
+		explicit Guard(EpochDomain& domain):
+			m_slot(&domain.slot()), m_previous(m_slot->active.load(std::memory_order_relaxed)) {
+			if(m_previous == 0)
+				m_slot->active.store(domain.m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+		}
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+		~Guard() {
+			if(m_previous == 0)
+				m_slot->active.store(0, std::memory_order_release);
+		}
+	};
+
+	/** Delete an object unlinked from shared data once the readers which may still see it are done **/
+	template<typename T>
+	void retire(T* object) {
+		std::uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+		std::vector<Retired> reclaimable;
+		{
+			std::lock_guard<std::mutex> guard(m_retiredLock);
+			m_retired.push_back({epoch, [object] { delete object; }});
+			std::uint64_t oldest = oldestActive();
+			auto          kept   = std::partition(m_retired.begin(), m_retired.end(), [oldest](const Retired& retired) { return retired.epoch >= oldest; });
+			std::move(kept, m_retired.end(), std::back_inserter(reclaimable));
+			m_retired.erase(kept, m_retired.end());
+		}
+		for(auto& retired: reclaimable)
+			retired.reclaim();
+	}
+
+	/** Delete every retired object, only when no reader can be active **/
+	void reclaimAll() {
+		std::vector<Retired> retired;
+		{
+			std::lock_guard<std::mutex> guard(m_retiredLock);
+			retired.swap(m_retired);
+		}
+		for(auto& object: retired)
+			object.reclaim();
+	}
+
+	/** Objects waiting for readers to finish **/
+	size_t pending() {
+		std::lock_guard<std::mutex> guard(m_retiredLock);
+		return m_retired.size();
+	}
+};
+
+/**
+ * The global bindings of an interpreter, readable from any thread without locking
+ * Readers look symbols up in an immutable snapshot of the table, define publishes a new
+ * snapshot with an atomic swap & retires the old one to the epoch domain. A snapshot is a hash
+ * table of immutable buckets, so a new version copies the bucket array & the one bucket which
+ * changed, not every binding. Defines are serialized by a mutex.
+ */
+class Namespace {
+	using Binding = std::pair<std::string, Atom>;
+	using Bucket  = std::vector<Binding>;
+
+	struct Table {
+		std::vector<std::shared_ptr<const Bucket>> buckets;
+		size_t                                     size = 0;
+	};
+
+	static constexpr size_t initialBuckets = 64;
+	static constexpr size_t maxLoad        = 4; // bindings per bucket before growing
+
+	std::atomic<const Table*>  m_table;
+	std::atomic<std::uint64_t> m_version = 1;
+	std::mutex                 m_writeLock;
+
+	static size_t bucketOf(const Table& table, size_t hash) {
+		return hash & (table.buckets.size() - 1);
+	}
+	static size_t bucketOf(const Table& table, const std::string& name) {
+		return bucketOf(table, hash(name));
+	}
+
+	static Table* rehash(const Table& table, size_t buckets) {
+		std::vector<Bucket> rebuilt(buckets);
+		for(auto& bucket: table.buckets) {
+			if(!bucket)
+				continue;
+			for(auto& binding: *bucket)
+				rebuilt[std::hash<std::string>{}(binding.first) & (buckets - 1)].push_back(binding);
+		}
+		auto* grown = new Table{std::vector<std::shared_ptr<const Bucket>>(buckets), table.size};
+		for(size_t i = 0; i < buckets; i++) {
+			if(!rebuilt[i].empty())
+				grown->buckets[i] = std::make_shared<const Bucket>(std::move(rebuilt[i]));
+		}
+		return grown;
+	}
+
+  public:
+	Namespace():
+		m_table(new Table{std::vector<std::shared_ptr<const Bucket>>(initialBuckets), 0}) {}
+	Namespace(const Namespace&) = delete;
+	Namespace& operator=(const Namespace&) = delete;
+	~Namespace() {
+		// the last reference is gone, so no reader can still be looking at the table
+		delete m_table.load(std::memory_order_relaxed);
+	}
+
+	/** The hash names are looked up by, computed once for a name looked up repeatedly **/
+	static size_t hash(const std::string& name) { return std::hash<std::string>{}(name); }
+
+	/** The value bound to name, if any, without blocking **/
+	std::optional<Atom> lookup(const std::string& name) const {
+		return lookup(name, hash(name));
+	}
+	std::optional<Atom> lookup(const std::string& name, size_t hash) const {
+		EpochDomain::Guard guard(EpochDomain::instance());
+		const Table*       table  = m_table.load(std::memory_order_seq_cst); // ordered after announcing the epoch
+		const auto&        bucket = table->buckets[bucketOf(*table, hash)];
+		if(bucket) {
+			for(auto& [key, value]: *bucket) {
+				if(key == name)
+					return value;
+			}
+		}
+		return std::nullopt;
+	}
+
+	/** Bind name to value, publishing a new snapshot **/
+	void define(const std::string& name, const Atom& value) {
+		std::lock_guard<std::mutex> lock(m_writeLock);
+		const Table*                current = m_table.load(std::memory_order_relaxed);
+		std::unique_ptr<Table>      next(new Table(*current)); // shares every bucket
+		auto&                       slot = next->buckets[bucketOf(*next, name)];
+		auto                        bucket = slot ? std::make_shared<Bucket>(*slot) : std::make_shared<Bucket>();
+		auto                        it = std::find_if(bucket->begin(), bucket->end(), [&](const Binding& binding) { return binding.first == name; });
+		if(it != bucket->end()) {
+			it->second = value;
+		} else {
+			bucket->emplace_back(name, value);
+			next->size++;
+		}
+		slot = std::move(bucket);
+		if(next->size > next->buckets.size() * maxLoad)
+			next.reset(rehash(*next, next->buckets.size() * 2));
+		m_table.store(next.release(), std::memory_order_seq_cst); // ordered before advancing the epoch
+		m_version.fetch_add(1, std::memory_order_release);
+		EpochDomain::instance().retire(const_cast<Table*>(current));
+	}
+
+	/** Every binding of the current snapshot **/
+	std::vector<Binding> bindings() const {
+		EpochDomain::Guard   guard(EpochDomain::instance());
+		const Table*         table = m_table.load(std::memory_order_seq_cst);
+		std::vector<Binding> result;
+		result.reserve(table->size);
+		for(auto& bucket: table->buckets) {
+			if(bucket)
+				result.insert(result.end(), bucket->begin(), bucket->end());
+		}
+		return result;
+	}
+
+	/** Changes with every define, a binding read at one version is current until the version changes **/
+	std::uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+
+	size_t size() const {
+		EpochDomain::Guard guard(EpochDomain::instance());
+		return m_table.load(std::memory_order_seq_cst)->size;
+	}
+};
+
+#endif //LISP_NAMESPACE_H
@@ -3,79 +3,83 @@
 
 #include "debug.h"
 #include "format.h"
+#include "source.h"
 
 #include <queue>
+#include <vector>
 
-Atom expression(std::deque<Token>& tokens);
+Atom expression(std::deque<Token>& tokens, const Source& source);
 
 /**
  * Parse a list
  * @param tokens incoming tokens from expression()
+ * @param source the source the tokens refer into
  * @return an atom containing a list
  */
-Atom list(std::deque<Token>& tokens) {
-	Atom result;
-	Atom p;
+Atom list(std::deque<Token>& tokens, const Source& source) {
+	std::vector<Atom> items;
+	Atom              tail;
+	Token             open = tokens.front();
+	// a list the tokens run out in misses its )
+	auto more = [&]() {
+		if(tokens.empty())
+			throw SyntaxError(source, open, format("Expected {}", toString(TokenType::RIGHT_PAREN)));
+	};
 	// expectation assertion
 	auto expect = [&](TokenType type) {
+		more();
 		if(tokens.front().type != type)
-			throw SyntaxError(tokens.front(), format("Expected {}", toString(type)));
+			throw SyntaxError(source, tokens.front(), format("Expected {}", toString(type)));
 	};
 
 	expect(TokenType::LEFT_PAREN);
 	tokens.pop_front();
 
-	if(tokens.back().type != TokenType::RIGHT_PAREN) {
-		expect(TokenType::RIGHT_PAREN);
-	}
-	while(!tokens.empty()) {
-		Atom item;
+	for(;;) {
+		more();
 		if(tokens.front().type == TokenType::RIGHT_PAREN) {
 			tokens.pop_front();
 			break;
 		}
 		if(tokens.front().type == TokenType::DOT) {
+			Token dot = tokens.front();
 			tokens.pop_front();
 			// improper list
-			if(p.isNil())
-				throw SyntaxError(tokens.front(), "Improper list");
+			if(items.empty())
+				throw SyntaxError(source, dot, "Improper list");
 
-			item    = expression(tokens);
-			p.cdr() = item;
+			more();
+			tail = expression(tokens, source);
 			expect(TokenType::RIGHT_PAREN);
 			tokens.pop_front();
 			break;
 		}
-		item = expression(tokens);
-		if(p.isNil()) {
-			result = Atom(item, nil);
-			p      = result;
-		} else {
-			p.cdr() = Atom(item, nil);
-			p       = p.cdr();
-		}
+		items.push_back(expression(tokens, source));
 	}
-	return result;
+	// the items are read before the pairs are allocated, so they lie next to each other
+	return Atom::list(items, tail);
 }
 
 /**
- * Parse simple data (numbers & identifiers)
+ * Parse simple data (numbers, identifiers & strings)
  * @param tokens incoming tokens from expression()
+ * @param source the source the tokens refer into
  * @return an atom containing simple data
  */
-Atom simple(std::deque<Token>& tokens) {
-	Atom   atom;
-	Token& token = tokens.front();
+Atom simple(std::deque<Token>& tokens, const Source& source) {
+	Atom        atom;
+	Token&      token = tokens.front();
+	std::string text(source.text(token));
 	switch(token.type) {
 	case TokenType::NUMBER: {
 		size_t read;
 
-		long long value = std::stoll(token.value, &read);
-		if(read != token.value.size()) {
-			atom.value = std::stod(token.value);
+		long long value = std::stoll(text, &read);
+		if(read != text.size()) {
+			atom.value = std::stod(text);
 
 			atom.type = Type::Rational;
-		} else if(read == token.value.size()) {
+		} else if(read == text.size()) {
 			atom.value = value;
 			atom.type  = Type::Integer;
 		} else {
@@ -84,35 +88,83 @@ Atom simple(std::deque<Token>& tokens) {
 		break;
 	}
 	case TokenType::IDENTIFIER:
-		if(token.value == "nil") {
+		if(text == "nil") {
 			atom = nil;
 		} else {
-			atom.value = token.value;
+			atom.value = text;
 			atom.type  = Type::Symbol;
 		}
 		break;
-	case TokenType::STRING:
+	case TokenType::STRING: {
+		std::string str;
+		str.reserve(text.size() - 2);
+		for(size_t i = 1; i + 1 < text.size(); i++) {
+			char c = text[i];
+			if(c == '\\') {
+				switch(text[++i]) {
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case '0': c = '\0'; break;
+				default: c = text[i]; // \" & \\ & any other escaped character itself
+				}
+			}
+			str += c;
+		}
+		atom = Atom::fromString(std::move(str));
 		break;
 	}
+	}
 	tokens.pop_front(); // ?
 	return atom;
 }
 
+/** The symbol a reader macro token wraps the following expression in, nullptr for other tokens **/
+const char* readerMacro(TokenType type) {
+	switch(type) {
+	case TokenType::QUOTE: return "quote";
+	case TokenType::GRAVE: return "quasiquote";
+	case TokenType::TILDE: return "unquote";
+	case TokenType::IDK: return "unquote-splicing";
+	default: return nullptr;
+	}
+}
+
 /**
  * Parse an expression
  * The parser creates a binary tree using the Atom class which ends with a NIL
  * @param tokens incoming tokens from the tokenizer
+ * @param source the source the tokens refer into
  * @return an atom containing an expression
  */
-Atom expression(std::deque<Token>& tokens) {
+Atom expression(std::deque<Token>& tokens, const Source& source) {
 
 	Token token = tokens.front();
 	if(token.type == TokenType::LEFT_PAREN) {
-		return list(tokens);
+		return list(tokens, source);
 	} else if(token.type == TokenType::RIGHT_PAREN) {
-		throw SyntaxError(token, "Expected List or Expression.");
+		throw SyntaxError(source, token, "Expected List or Expression.");
+	} else if(const char* symbol = readerMacro(token.type)) {
+		// 'x reads as (quote x), `x ,x ,@x as (quasiquote x) (unquote x) (unquote-splicing x)
+		tokens.pop_front();
+		if(tokens.empty())
+			throw SyntaxError(source, token, format("Expected an expression after {}", toString(token.type)));
+		return Atom(Atom(std::string(symbol)), Atom(expression(tokens, source), nil));
 	} else
-		return simple(tokens);
+		return simple(tokens, source);
+}
+
+/**
+ * Parse all top level expressions of a source
+ * @param tokens incoming tokens from the tokenizer
+ * @param source the source the tokens refer into
+ * @return a list of the expressions in order
+ */
+Atom program(std::deque<Token>& tokens, const Source& source) {
+	std::vector<Atom> items;
+	while(!tokens.empty())
+		items.push_back(expression(tokens, source));
+	return Atom::list(items, nil);
 }
 
 #endif //LISP_PARSER_H
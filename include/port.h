@@ -0,0 +1,201 @@
+#ifndef LISP_PORT_H
+#define LISP_PORT_H
+
+#include "atom.h"
+#include "debug.h"
+#include "format.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * A file opened for reading or writing with a large user-space buffer
+ * A port only enters the kernel once per buffer, reads & writes larger than the buffer go
+ * straight to the file descriptor. Output is written when the buffer fills, on flush and on
+ * close; a port is closed (and flushed) when the last atom referring to it goes away.
+ * Ports are not synchronized, use a port from one thread at a time.
+ */
+class Port {
+  public:
+	enum class Mode {
+		Input,
+		Output
+	};
+	static constexpr size_t bufferSize = 64 * 1024;
+
+  private:
+	int               m_fd;
+	Mode              m_mode;
+	std::string       m_name;
+	std::vector<char> m_buf;
+	size_t            m_begin = 0, m_end = 0; // unread input, or buffered output in [0, m_end)
+	memory::Counted<memory::Kind::Port> m_counted{sizeof(Port) + bufferSize};
+
+	[[noreturn]] void fail(const char* action) const {
+		throw EvalError(nil, format("Failed to {} {}: {}", action, m_name, std::strerror(errno)));
+	}
+	void checkMode(Mode mode) const {
+		if(m_fd < 0)
+			throw EvalError(nil, format("Port {} is closed", m_name));
+		if(m_mode != mode)
+			throw EvalError(nil, format("Port {} is not an {} port", m_name, mode == Mode::Input ? "input" : "output"));
+	}
+
+	// read more input into the buffer, false at the end of the file
+	bool fill() {
+		if(m_begin == m_end)
+			m_begin = m_end = 0;
+		if(m_end == m_buf.size()) { // make room for the rest of a long line
+			if(m_begin > 0) {
+				std::memmove(m_buf.data(), m_buf.data() + m_begin, m_end - m_begin);
+				m_end -= m_begin;
+				m_begin = 0;
+			} else {
+				m_buf.resize(m_buf.size() * 2);
+			}
+		}
+		ssize_t n;
+		while((n = ::read(m_fd, m_buf.data() + m_end, m_buf.size() - m_end)) < 0) {
+			if(errno != EINTR)
+				fail("read");
+		}
+		m_end += n;
+		return n > 0;
+	}
+
+	void writeAll(const char* data, size_t size) {
+		while(size > 0) {
+			ssize_t n = ::write(m_fd, data, size);
+			if(n < 0) {
+				if(errno == EINTR)
+					continue;
+				fail("write");
+			}
+			data += n;
+			size -= n;
+		}
+	}
+
+  public:
+	Port(const std::string& path, Mode mode):
+		m_mode(mode), m_name(path), m_buf(bufferSize) {
+		int flags = mode == Mode::Input ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC;
+		m_fd      = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+		if(m_fd < 0)
+			fail("open");
+	}
+	Port(const Port&) = delete;
+	Port& operator=(const Port&) = delete;
+	~Port() {
+		try {
+			close();
+		} catch(EvalError&) {
+			// nobody is left to report a failed write to
+		}
+	}
+
+	[[nodiscard]] Mode               mode() const { return m_mode; }
+	[[nodiscard]] const std::string& name() const { return m_name; }
+	[[nodiscard]] bool               closed() const { return m_fd < 0; }
+
+	/** The next line without its line feed, nothing at the end of the file **/
+	std::optional<std::string> readLine() {
+		checkMode(Mode::Input);
+		size_t scanned = m_begin;
+		for(;;) {
+			auto* newline = static_cast<char*>(std::memchr(m_buf.data() + scanned, '\n', m_end - scanned));
+			if(newline) {
+				std::string line(m_buf.data() + m_begin, newline);
+				m_begin = newline - m_buf.data() + 1;
+				return line;
+			}
+			scanned = m_end - m_begin; // fill() may move the unread input to the front
+			if(!fill())
+				break;
+			scanned += m_begin;
+		}
+		if(m_begin == m_end)
+			return std::nullopt;
+		std::string line(m_buf.data() + m_begin, m_buf.data() + m_end);
+		m_begin = m_end;
+		return line;
+	}
+
+	/** Up to count bytes, nothing at the end of the file **/
+	std::optional<std::string> readBytes(size_t count) {
+		checkMode(Mode::Input);
+		std::string bytes;
+		size_t      buffered = std::min(count, m_end - m_begin);
+		bytes.reserve(count);
+		bytes.append(m_buf.data() + m_begin, buffered);
+		m_begin += buffered;
+		if(bytes.size() < count && count - bytes.size() >= m_buf.size()) {
+			// large read, skip the buffer
+			bytes.resize(count);
+			size_t read = buffered;
+			while(read < count) {
+				ssize_t n = ::read(m_fd, bytes.data() + read, count - read);
+				if(n < 0 && errno == EINTR)
+					continue;
+				if(n < 0)
+					fail("read");
+				if(n == 0)
+					break;
+				read += n;
+			}
+			bytes.resize(read);
+		} else {
+			while(bytes.size() < count && (m_begin < m_end || fill())) {
+				size_t n = std::min(count - bytes.size(), m_end - m_begin);
+				bytes.append(m_buf.data() + m_begin, n);
+				m_begin += n;
+			}
+		}
+		if(bytes.empty() && count > 0)
+			return std::nullopt;
+		return bytes;
+	}
+
+	void write(std::string_view data) {
+		checkMode(Mode::Output);
+		if(m_end + data.size() > m_buf.size()) {
+			flush();
+			if(data.size() >= m_buf.size()) { // large write, skip the buffer
+				writeAll(data.data(), data.size());
+				return;
+			}
+		}
+		std::memcpy(m_buf.data() + m_end, data.data(), data.size());
+		m_end += data.size();
+	}
+
+	void flush() {
+		checkMode(Mode::Output);
+		writeAll(m_buf.data(), m_end);
+		m_end = 0;
+	}
+
+	void close() {
+		if(m_fd < 0)
+			return;
+		if(m_mode == Mode::Output && m_end > 0) {
+			try {
+				flush();
+			} catch(EvalError&) {
+				::close(m_fd);
+				m_fd = -1;
+				throw;
+			}
+		}
+		::close(m_fd);
+		m_fd = -1;
+	}
+};
+
+#endif //LISP_PORT_H
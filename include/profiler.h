@@ -0,0 +1,268 @@
+#ifndef LISP_PROFILER_H
+#define LISP_PROFILER_H
+
+#include "atom.h"
+#include "format.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/time.h>
+
+/** Identifies a closure or built-in function by its address **/
+inline const void* functionKey(const Atom& fn) {
+	if(fn.type == Type::Builtin)
+		return reinterpret_cast<const void*>(std::get<Atom::builtin_t>(fn.value));
+	return std::get<std::shared_ptr<Pair>>(fn.value).get();
+}
+
+/** The functions among bindings by their key, a function bound to several names gets the first **/
+using FunctionNames = std::unordered_map<const void*, std::string>;
+inline FunctionNames functionNames(const std::vector<std::pair<std::string, Atom>>& bindings) {
+	FunctionNames names;
+	for(auto& [name, value]: bindings) {
+		if(value.type == Type::Closure || value.type == Type::Builtin)
+			names.emplace(functionKey(value), name);
+	}
+	return names;
+}
+
+/**
+ * Call count & sampling profiler of the lisp functions an interpreter applies
+ * apply reports every call of a closure or built-in function: the profiler counts the calls and
+ * measures the inclusive & exclusive time and the pairs allocated by each function. A SIGPROF
+ * timer samples the stack of lisp functions every interval of CPU time, the samples are written
+ * as collapsed stacks ("outer;inner count" lines) for flame graph tools.
+ * Only the thread which created the profiler is measured, green threads switching on that thread
+ * share one stack, so their frames are attributed approximately. One profiler samples at a time.
+ */
+class Profiler {
+  public:
+	struct Entry {
+		Atom          function; // keeps the closure alive, so its address is not reused while profiling
+		std::uint64_t calls       = 0;
+		std::int64_t  inclusive   = 0; // ns, recursive calls are only counted once
+		std::int64_t  exclusive   = 0; // ns
+		std::uint64_t allocations = 0; // pairs allocated by the function itself
+		size_t        active      = 0; // calls on the stack
+	};
+
+	static constexpr size_t maxDepth       = 256;     // frames recorded per sample, the outermost are kept
+	static constexpr size_t sampleCapacity = 1 << 20; // frame slots for samples, later samples are dropped
+
+  private:
+	struct Frame {
+		Entry*        entry;
+		std::int64_t  start;
+		std::int64_t  children           = 0; // ns spent in the functions called
+		std::uint64_t allocations        = 0; // pairs the thread allocated when the call started
+		std::uint64_t childAllocations   = 0;
+	};
+
+	std::thread::id                            m_owner;
+	std::chrono::microseconds                  m_interval;
+	std::unordered_map<const void*, Entry>     m_entries;
+	std::vector<Frame>                         m_stack;
+	// the stack as seen by the signal handler, which may run on any thread
+	std::atomic<const void*>                   m_keys[maxDepth];
+	std::atomic<size_t>                        m_depth = 0;
+	// samples, a sample is a slot holding its depth + 1, followed by its keys
+	std::unique_ptr<std::atomic<const void*>[]> m_samples;
+	std::atomic<size_t>                        m_sampleEnd = 0;
+	std::atomic<size_t>                        m_dropped   = 0;
+	bool                                       m_sampling  = false;
+	struct sigaction                           m_previousAction {};
+
+	static inline std::atomic<Profiler*> s_sampled = nullptr;
+
+	static std::int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static void onSignal(int) {
+		Profiler* profiler = s_sampled.load(std::memory_order_acquire);
+		if(!profiler)
+			return;
+		size_t depth = std::min(profiler->m_depth.load(std::memory_order_acquire), maxDepth);
+		size_t at    = profiler->m_sampleEnd.fetch_add(depth + 1, std::memory_order_relaxed);
+		if(at + depth + 1 > sampleCapacity) {
+			profiler->m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		for(size_t i = 0; i < depth; i++)
+			profiler->m_samples[at + 1 + i].store(profiler->m_keys[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		profiler->m_samples[at].store(reinterpret_cast<const void*>(depth + 1), std::memory_order_release);
+	}
+
+  public:
+	/**
+	 * @param interval CPU time between samples, zero only counts calls
+	 */
+	explicit Profiler(std::chrono::microseconds interval = std::chrono::microseconds(1000)):
+		m_owner(std::this_thread::get_id()), m_interval(interval) {
+		m_stack.reserve(maxDepth);
+	}
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+	~Profiler() { stop(); }
+
+	/** Start sampling, false when another profiler is sampling already **/
+	bool start() {
+		if(m_sampling || m_interval.count() <= 0)
+			return m_sampling;
+		Profiler* expected = nullptr;
+		if(!s_sampled.compare_exchange_strong(expected, this))
+			return false;
+		if(!m_samples)
+			m_samples = std::make_unique<std::atomic<const void*>[]>(sampleCapacity);
+		struct sigaction action {};
+		action.sa_handler = onSignal;
+		action.sa_flags   = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGPROF, &action, &m_previousAction);
+		itimerval timer {};
+		timer.it_interval.tv_sec  = m_interval.count() / 1000000;
+		timer.it_interval.tv_usec = m_interval.count() % 1000000;
+		timer.it_value            = timer.it_interval;
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		m_sampling = true;
+		return true;
+	}
+
+	/** Stop sampling, calls are still counted **/
+	void stop() {
+		if(!m_sampling)
+			return;
+		itimerval timer {};
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		sigaction(SIGPROF, &m_previousAction, nullptr);
+		s_sampled.store(nullptr, std::memory_order_release);
+		m_sampling = false;
+	}
+
+	/** Whether calls on the calling thread are measured **/
+	[[nodiscard]] bool measures() const { return std::this_thread::get_id() == m_owner; }
+
+	/** A call of fn starts, returns the depth of its frame **/
+	size_t enter(const Atom& fn) {
+		const void* key   = functionKey(fn);
+		Entry&      entry = m_entries[key];
+		if(entry.calls++ == 0)
+			entry.function = fn;
+		entry.active++;
+		size_t depth = m_stack.size();
+		m_stack.push_back({&entry, now(), 0, memory::allocations(memory::Kind::Pair), 0});
+		if(depth < maxDepth)
+			m_keys[depth].store(key, std::memory_order_relaxed);
+		m_depth.store(depth + 1, std::memory_order_release);
+		return depth;
+	}
+
+	/** The call entered at depth returned (or threw) **/
+	void exit(size_t depth) {
+		// a green thread may have left frames above this one, they are dropped
+		if(depth >= m_stack.size())
+			return;
+		while(m_stack.size() > depth + 1) {
+			m_stack.back().entry->active--;
+			m_stack.pop_back();
+		}
+		Frame&        frame       = m_stack.back();
+		std::int64_t  elapsed     = now() - frame.start;
+		std::uint64_t allocations = memory::allocations(memory::Kind::Pair) - frame.allocations;
+		Entry&        entry       = *frame.entry;
+		if(--entry.active == 0)
+			entry.inclusive += elapsed;
+		entry.exclusive += elapsed - frame.children;
+		entry.allocations += allocations - frame.childAllocations;
+		m_stack.pop_back();
+		m_depth.store(depth, std::memory_order_release);
+		if(!m_stack.empty()) {
+			m_stack.back().children += elapsed;
+			m_stack.back().childAllocations += allocations;
+		}
+	}
+
+	/** Reports a call to the profiler for as long as it exists **/
+	class Call {
+		Profiler* m_profiler;
+		size_t    m_depth;
+
+	  public:
+		Call(Profiler* profiler, const Atom& fn):
+			m_profiler(profiler), m_depth(profiler->enter(fn)) {}
+		Call(const Call&) = delete;
+		Call& operator=(const Call&) = delete;
+		~Call() { m_profiler->exit(m_depth); }
+	};
+
+	[[nodiscard]] const std::unordered_map<const void*, Entry>& entries() const { return m_entries; }
+	[[nodiscard]] size_t                                        dropped() const { return m_dropped.load(); }
+
+	/** Names of the profiled functions, the name a function is bound to or its address **/
+	using Names = FunctionNames;
+	Names names(const std::vector<std::pair<std::string, Atom>>& bindings) const {
+		Names names = functionNames(bindings);
+		for(auto& [key, entry]: m_entries) {
+			if(!names.count(key))
+				names.emplace(key, format("lambda@{}", key));
+		}
+		return names;
+	}
+
+	/** A table of the functions by exclusive time **/
+	void report(std::ostream& os, const Names& names) const {
+		std::vector<const std::pair<const void* const, Entry>*> sorted;
+		for(auto& entry: m_entries)
+			sorted.push_back(&entry);
+		std::sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) { return a->second.exclusive > b->second.exclusive; });
+		os << std::setw(12) << "calls" << std::setw(16) << "inclusive ms" << std::setw(16) << "exclusive ms" << std::setw(14) << "allocations"
+		   << "  function\n";
+		for(auto* entry: sorted) {
+			auto& [key, stats] = *entry;
+			os << std::setw(12) << stats.calls << std::setw(16) << std::fixed << std::setprecision(3) << stats.inclusive / 1e6 << std::setw(16)
+			   << stats.exclusive / 1e6 << std::setw(14) << stats.allocations << "  " << names.at(key) << "\n";
+		}
+		os.unsetf(std::ios::floatfield);
+		if(size_t dropped = m_dropped.load())
+			os << format("{} samples dropped", dropped) << "\n";
+	}
+
+	/** The samples as collapsed stacks, a line of the frames from the outermost & the sample count per stack **/
+	void collapsed(std::ostream& os, const Names& names) const {
+		if(!m_samples)
+			return;
+		std::map<std::string, size_t> stacks;
+		size_t                        end = std::min(m_sampleEnd.load(std::memory_order_acquire), sampleCapacity);
+		for(size_t at = 0; at < end;) {
+			auto header = reinterpret_cast<size_t>(m_samples[at].load(std::memory_order_acquire));
+			if(header == 0) { // reserved, but did not fit
+				at++;
+				continue;
+			}
+			std::string stack;
+			for(size_t i = 0; i + 1 < header; i++) {
+				auto name = names.find(m_samples[at + 1 + i].load(std::memory_order_relaxed));
+				stack += (i ? ";" : "") + (name != names.end() ? name->second : std::string("?"));
+			}
+			stacks[stack.empty() ? "(top-level)" : stack]++;
+			at += header;
+		}
+		for(auto& [stack, count]: stacks)
+			os << stack << " " << count << "\n";
+	}
+};
+
+#endif //LISP_PROFILER_H
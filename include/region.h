@@ -0,0 +1,111 @@
+#ifndef LISP_REGION_H
+#define LISP_REGION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/**
+ * Stack allocation of objects that die when the call creating them returns
+ * Every thread has a region it allocates from by bumping an offset, blocks are freed in any order
+ * & from any thread by marking them dead, the owning thread pops the dead blocks at the top. Calls
+ * nest, so the blocks of a call that returned are at the top & the region shrinks back on return.
+ * A block that outlives its call, eg. held by an error thrown, is never reused while it is alive:
+ * it only keeps the blocks below it from being reclaimed until it is freed. So the region is only
+ * asked for objects expected to die with their call (see escape.h), others would pin it.
+ * Once the region is full blocks come from the heap, with the same header.
+ */
+namespace region {
+	constexpr size_t capacity = 1024 * 1024; // address space, pages are only touched as the region grows
+
+	// as aligned as operator new aligns, so blocks on the heap need no aligned allocation
+	struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header {
+		std::atomic<bool> live;
+		std::uint32_t     previous; // offset of the block below, none at the bottom, heap outside the region
+	};
+	constexpr std::uint32_t none = UINT32_MAX;
+	constexpr std::uint32_t heap = UINT32_MAX - 1;
+
+	class Stack {
+		std::byte*    m_base = nullptr;
+		std::uint32_t m_top  = 0;
+		std::uint32_t m_last = none; // the block at the top
+
+		Header* header(std::uint32_t offset) const { return reinterpret_cast<Header*>(m_base + offset); }
+
+		void pop() {
+			while(m_last != none && !header(m_last)->live.load(std::memory_order_acquire)) {
+				m_top  = m_last;
+				m_last = header(m_last)->previous;
+			}
+		}
+
+	  public:
+		Stack() = default;
+		Stack(const Stack&) = delete;
+		Stack& operator=(const Stack&) = delete;
+		// blocks still alive when the thread exits are left to whoever holds them, with the region
+		~Stack() {
+			pop();
+			if(m_last == none)
+				::operator delete(m_base);
+		}
+
+		[[nodiscard]] bool owns(const void* block) const { return block >= m_base && block < m_base + capacity; }
+		/** Bytes allocated in the region, dead blocks below a live one included **/
+		[[nodiscard]] size_t used() const { return m_top; }
+
+		void* allocate(size_t bytes) {
+			size_t size = sizeof(Header) + (bytes + alignof(Header) - 1) / alignof(Header) * alignof(Header);
+			if(!m_base)
+				m_base = static_cast<std::byte*>(::operator new(capacity));
+			if(m_top + size > capacity)
+				pop(); // blocks freed by other threads
+			Header* block;
+			if(m_top + size <= capacity) {
+				block  = new(m_base + m_top) Header {{true}, m_last};
+				m_last = m_top;
+				m_top += std::uint32_t(size);
+			} else {
+				block = new(::operator new(size)) Header {{true}, heap};
+			}
+			return block + 1;
+		}
+
+		void free(void* memory) {
+			Header* block = static_cast<Header*>(memory) - 1;
+			if(block->previous == heap) {
+				block->~Header();
+				::operator delete(block);
+				return;
+			}
+			block->live.store(false, std::memory_order_release);
+			if(owns(block))
+				pop();
+		}
+	};
+
+	inline thread_local Stack t_stack;
+
+	/** The region of the calling thread **/
+	inline Stack& stack() { return t_stack; }
+
+	/** Allocates in the region of the calling thread, frees to the region of the block **/
+	template<typename T>
+	struct Allocator {
+		using value_type = T;
+
+		Allocator() = default;
+		template<typename U>
+		Allocator(const Allocator<U>&) {} // rebound by allocate_shared
+
+		T*   allocate(size_t n) { return static_cast<T*>(t_stack.allocate(n * sizeof(T))); }
+		void deallocate(T* p, size_t) { t_stack.free(p); }
+
+		template<typename U>
+		bool operator==(const Allocator<U>&) const { return true; }
+	};
+} // namespace region
+
+#endif //LISP_REGION_H
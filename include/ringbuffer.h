@@ -1,7 +1,17 @@
 #ifndef LISP_CIRCULARBUFFER_H
 #define LISP_CIRCULARBUFFER_H
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <utility>
+
+/**
+ * Fixed size ring buffer, overwriting the oldest element once full
+ * Not thread-safe, see SPSCQueue & MPMCQueue to pass elements between threads
+ */
 template <class T, size_t Size> class RingBuffer {
   public:
     using value_type = T;
@@ -35,7 +45,7 @@ template <class T, size_t Size> class RingBuffer {
 		m_full = false;
 	}
 	bool empty() const {
-        return m_full && (m_head == m_tail);
+        return !m_full && (m_head == m_tail);
 	}
 	bool full() const {
         return m_full;
@@ -72,9 +82,167 @@ template <class T, size_t Size> class RingBuffer {
 		return val;
     }
 
+    // index 0 is the oldest element
     T &operator[](size_t index) {
-        return *(m_buf + (((m_head - m_buf) + index) % Size));
+        return *(m_buf + (((m_tail - m_buf) + index) % Size));
+	}
+};
+
+/**
+ * The last Size elements pushed, for recording on a hot path
+ * A push is a store & an increment, the oldest element is overwritten without a check.
+ * Not thread-safe.
+ */
+template <class T, size_t Size> class HistoryBuffer {
+	static_assert(Size > 0 && (Size & (Size - 1)) == 0, "Size of a history must be a power of two");
+
+	T             m_buf[Size];
+	std::uint64_t m_pushed = 0;
+
+  public:
+	void push(const T& val) { m_buf[m_pushed++ & (Size - 1)] = val; }
+	// the slot of the next element, to be written in place
+	T& next() { return m_buf[m_pushed++ & (Size - 1)]; }
+
+	size_t        size() const { return m_pushed < Size ? m_pushed : Size; }
+	std::uint64_t pushed() const { return m_pushed; }
+	void          clear() { m_pushed = 0; }
+	constexpr size_t capacity() const { return Size; }
+
+	// index 0 is the oldest element
+	const T& operator[](size_t index) const { return m_buf[(m_pushed - size() + index) & (Size - 1)]; }
+};
+
+// keeps the indices the producer & consumer write on separate cache lines
+inline constexpr size_t cacheLineSize = 64;
+
+/**
+ * Bounded lock-free single producer, single consumer queue
+ * The producer only writes the head, the consumer only writes the tail, each keeps a cached
+ * copy of the other index so it only touches the shared cache line when the queue looks full/empty
+ */
+template <class T, size_t Size> class SPSCQueue {
+	static_assert(Size > 0 && (Size & (Size - 1)) == 0, "Size of a queue must be a power of two");
+
+	alignas(cacheLineSize) std::atomic<size_t> m_head = 0;
+	size_t m_cachedTail = 0;
+	alignas(cacheLineSize) std::atomic<size_t> m_tail = 0;
+	size_t m_cachedHead = 0;
+	alignas(cacheLineSize) T m_buf[Size];
+
+  public:
+	// from the producer, false when full
+	bool tryPush(T&& val) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if(head - m_cachedTail == Size) {
+			m_cachedTail = m_tail.load(std::memory_order_acquire);
+			if(head - m_cachedTail == Size)
+				return false;
+		}
+		m_buf[head & (Size - 1)] = std::move(val);
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+	bool tryPush(const T& val) { return tryPush(T(val)); }
+
+	// from the consumer, nothing when empty
+	std::optional<T> tryPop() {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if(tail == m_cachedHead) {
+			m_cachedHead = m_head.load(std::memory_order_acquire);
+			if(tail == m_cachedHead)
+				return std::nullopt;
+		}
+		std::optional<T> val(std::move(m_buf[tail & (Size - 1)]));
+		m_buf[tail & (Size - 1)] = T();
+		m_tail.store(tail + 1, std::memory_order_release);
+		return val;
+	}
+
+	// approximate while the other side is active
+	size_t size() const { return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire); }
+	bool   empty() const { return size() == 0; }
+	constexpr size_t capacity() const { return Size; }
+};
+
+/**
+ * Bounded lock-free multi producer, multi consumer queue (Vyukov)
+ * Every cell carries a sequence number telling whether it is free for the producer of a position
+ * or filled for its consumer, producers & consumers claim positions with a compare-exchange
+ */
+template <class T, size_t Size> class MPMCQueue {
+	static_assert(Size > 0 && (Size & (Size - 1)) == 0, "Size of a queue must be a power of two");
+
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T                   value;
+	};
+	alignas(cacheLineSize) Cell m_cells[Size];
+	alignas(cacheLineSize) std::atomic<size_t> m_head = 0;
+	alignas(cacheLineSize) std::atomic<size_t> m_tail = 0;
+
+  public:
+	MPMCQueue() {
+		for(size_t i = 0; i < Size; i++)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	MPMCQueue(const MPMCQueue&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+	// false when full
+	bool tryPush(T&& val) {
+		size_t pos = m_head.load(std::memory_order_relaxed);
+		for(;;) {
+			Cell&     cell = m_cells[pos & (Size - 1)];
+			size_t    seq  = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = ptrdiff_t(seq) - ptrdiff_t(pos);
+			if(diff == 0) {
+				if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.value = std::move(val);
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if(diff < 0) {
+				return false;
+			} else {
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	bool tryPush(const T& val) {
+		T copy(val);
+		return tryPush(std::move(copy));
+	}
+
+	// nothing when empty
+	std::optional<T> tryPop() {
+		size_t pos = m_tail.load(std::memory_order_relaxed);
+		for(;;) {
+			Cell&     cell = m_cells[pos & (Size - 1)];
+			size_t    seq  = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t diff = ptrdiff_t(seq) - ptrdiff_t(pos + 1);
+			if(diff == 0) {
+				if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					std::optional<T> val(std::move(cell.value));
+					cell.value = T();
+					cell.sequence.store(pos + Size, std::memory_order_release);
+					return val;
+				}
+			} else if(diff < 0) {
+				return std::nullopt;
+			} else {
+				pos = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// approximate while producers or consumers are active
+	size_t size() const {
+		size_t head = m_head.load(std::memory_order_acquire), tail = m_tail.load(std::memory_order_acquire);
+		return head > tail ? head - tail : 0;
 	}
+	bool   empty() const { return size() == 0; }
+	constexpr size_t capacity() const { return Size; }
 };
 
 #endif //LISP_CIRCULARBUFFER_H
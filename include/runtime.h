@@ -0,0 +1,182 @@
+#ifndef LISP_RUNTIME_H
+#define LISP_RUNTIME_H
+
+#include "atom.h"
+#include "builtin.h"
+#include "debug.h"
+#include "environment.h"
+#include "eval.h"
+#include "interpreter.h"
+#include "namespace.h"
+
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Runtime of programs translated to C++ by lisp --emit-cpp (see aot.h)
+ * A translated program is a single translation unit including this header, linked with the
+ * lisp_runtime library. It runs on an Interpreter like the lisp binary does, so the built-in
+ * functions, the global environment & the forms left to the tree walker behave the same.
+ * A lambda becomes a struct holding the variables it captures, its closures are ordinary closure
+ * atoms whose frame binds those variables, told apart by the code pair (params . body) as the
+ * closures of the compiler are, so built-in functions & the tree walker apply them as any other.
+ */
+namespace runtime {
+	/** Calls a closure of a translated lambda with its arguments **/
+	using Entry = Atom (*)(Interpreter& interp, const Atom& closure, const Atom* args);
+	/** A translated top level expression **/
+	using Form = Atom (*)(Interpreter& interp);
+
+	/** A translated lambda, code is the pair (params . body) shared by its closures **/
+	struct Lambda {
+		const Atom* code;
+		size_t      arity;
+		Entry       entry;
+	};
+
+	inline const Pair* codeOf(const Atom& closure) { return std::get<std::shared_ptr<Pair>>(closure.cdr().value).get(); }
+
+	/** The evaluator of a translated program, applying the closures of its lambdas **/
+	class Program: public Evaluator {
+		std::shared_ptr<Namespace>                     m_ns;
+		std::vector<Lambda>                            m_lambdas;
+		std::unordered_map<const Pair*, const Lambda*> m_codes;
+
+	  public:
+		Program(Interpreter& interp, std::initializer_list<Lambda> lambdas):
+			m_ns(*interp.global().atom().car().ns()), m_lambdas(lambdas) {
+			for(auto& lambda: m_lambdas)
+				m_codes.emplace(std::get<std::shared_ptr<Pair>>(lambda.code->value).get(), &lambda);
+		}
+
+		static Program& of(Interpreter& interp) { return static_cast<Program&>(*interp.evaluator()); }
+
+		[[nodiscard]] Namespace& ns() const { return *m_ns; }
+		[[nodiscard]] const Lambda* find(const Pair* code) const {
+			auto it = m_codes.find(code);
+			return it != m_codes.end() ? it->second : nullptr;
+		}
+
+		Atom eval(Interpreter& interp, const Atom& expr, Environment& env) override { return ::eval(interp, expr, env); }
+
+		std::optional<Atom> applyClosure(Interpreter& interp, const Atom& fn, const Atom& args) override {
+			const Lambda* lambda = find(codeOf(fn));
+			if(!lambda)
+				return std::nullopt;
+			bindArguments(lambda->code->car(), args); // raises the error of the tree walker
+			std::vector<Atom> values;
+			for(Atom p = args; !p.isNil(); p = p.cdr())
+				values.push_back(p.car());
+			return lambda->entry(interp, fn, values.data());
+		}
+	};
+
+	/** A global variable, its hash computed once **/
+	class Global {
+		std::string m_name;
+		size_t      m_hash;
+
+	  public:
+		explicit Global(std::string name):
+			m_name(std::move(name)), m_hash(Namespace::hash(m_name)) {}
+
+		[[nodiscard]] Atom get(Interpreter& interp) const {
+			if(auto value = Program::of(interp).ns().lookup(m_name, m_hash))
+				return *value;
+			throw EnvError(interp.global(), nil, format("Unexpected identifier {}, have you defined {}?", m_name, m_name));
+		}
+	};
+
+	/** A list of items ending in tail **/
+	inline Atom list(std::initializer_list<Atom> items, const Atom& tail = nil) {
+		Atom list = tail;
+		for(auto it = std::rbegin(items); it != std::rend(items); it++)
+			list = Atom(*it, list);
+		return list;
+	}
+
+	/** A call of any function, the lambda of the last closure called is cached **/
+	class CallSite {
+		std::atomic<const Lambda*> m_cached = nullptr;
+
+	  public:
+		Atom operator()(Interpreter& interp, const Atom& fn, std::initializer_list<Atom> args) {
+			if(fn.type == Type::Closure) {
+				const Pair*   code   = codeOf(fn);
+				const Lambda* lambda = m_cached.load(std::memory_order_acquire);
+				if(!lambda || std::get<std::shared_ptr<Pair>>(lambda->code->value).get() != code) {
+					if((lambda = Program::of(interp).find(code)))
+						m_cached.store(lambda, std::memory_order_release);
+				}
+				if(lambda && lambda->arity == args.size())
+					return lambda->entry(interp, fn, args.begin());
+			}
+			Atom f = fn;
+			return ::apply(interp, f, list(args));
+		}
+	};
+
+	inline const Atom t = Atom("t");
+
+	/** A closure of the lambda of code, its frame binding the captured variables **/
+	inline Atom closure(Interpreter& interp, const Atom& code, std::initializer_list<std::pair<const char*, Atom>> captured) {
+		Atom bindings;
+		for(auto it = std::rbegin(captured); it != std::rend(captured); it++)
+			bindings = Atom(Atom(Atom(it->first), it->second), bindings);
+		memory::allocated(memory::Kind::Closure, 0);
+		// a lambda capturing nothing closes over the global frame itself, as at the top level
+		Atom closure(captured.size() ? Atom(interp.global().atom(), bindings) : interp.global().atom(), code);
+		closure.type = Type::Closure;
+		return closure;
+	}
+
+	/** The value of the next captured variable in the bindings of a closure frame **/
+	inline Atom next(Atom& bindings) {
+		Atom value = bindings.car().cdr();
+		bindings   = bindings.cdr();
+		return value;
+	}
+
+	inline Atom define(Interpreter& interp, const char* name, const Atom& value) {
+		Atom symbol(name);
+		interp.global().set(symbol, value);
+		return symbol;
+	}
+
+	/** Evaluate a top level expression the translator left to the tree walker, expanding its macros **/
+	inline Atom evaluate(Interpreter& interp, const Atom& expr) { return evalTopLevel(interp, expr, interp.global()); }
+
+	/**
+	 * Run the forms of a translated program in order, printing the value of the last one as
+	 * lisp prints the value of a file
+	 * @return 0, 1 when the program raised an error
+	 */
+	inline int run(std::initializer_list<Form> forms, std::initializer_list<Lambda> lambdas) {
+		Interpreter interp(builtin::table());
+		interp.setEvaluator(std::make_unique<Program>(interp, lambdas));
+		try {
+			Atom result;
+			for(Form form: forms)
+				result = form(interp);
+			interp.scheduler().run(); // let the remaining green threads finish
+			interp.out() << result << "\n";
+			return 0;
+		} catch(EnvError& err) {
+			interp.err() << err.what() << "\n";
+		} catch(EvalError& err) {
+			interp.err() << err.what() << "\n";
+			dynamicError(err, interp.err());
+		} catch(TypeError& err) {
+			interp.err() << err.what() << "\n";
+		}
+		dumpTrace(interp, interp.err(), 32);
+		return 1;
+	}
+} // namespace runtime
+
+#endif //LISP_RUNTIME_H
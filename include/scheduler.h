@@ -0,0 +1,213 @@
+#ifndef LISP_SCHEDULER_H
+#define LISP_SCHEDULER_H
+
+#include "atom.h"
+#include "debug.h"
+#include "fiber.h"
+
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+/**
+ * A green thread, a lisp function running on its own fiber
+ */
+struct Task {
+	enum class State {
+		Ready,
+		Sleeping,
+		Done
+	};
+	using Clock = std::chrono::steady_clock;
+
+	Fiber              fiber;
+	State              state = State::Ready;
+	Clock::time_point  wake;
+	Atom               result;
+	std::exception_ptr error;
+	memory::Counted<memory::Kind::Task> counted{sizeof(Task)};
+
+	// errors body raises are stored, to be raised by whoever joins the task
+	Task(std::function<Atom()> body, FiberStack stack):
+		fiber([this, body = std::move(body)]() {
+			try {
+				result = body();
+			} catch(...) {
+				error = std::current_exception();
+			}
+			state = State::Done;
+		},
+			  std::move(stack)) {}
+};
+
+/**
+ * Cooperative scheduler for the green threads of an interpreter
+ * Tasks only switch when they yield, sleep or wait, so they need no locking between them.
+ * All tasks of a scheduler run on the thread driving it: tasks progress whenever the main
+ * program yields, sleeps, joins a task or finishes. Tasks still suspended when the scheduler
+ * is destroyed are dropped without unwinding.
+ */
+class Scheduler {
+	std::deque<std::shared_ptr<Task>>  m_ready;
+	std::vector<std::shared_ptr<Task>> m_sleeping;
+	std::shared_ptr<Task>              m_current;
+	std::vector<FiberStack>            m_stacks; // stacks of finished tasks, for reuse
+	std::thread::id                    m_owner;
+
+	static constexpr size_t maxCachedStacks = 64;
+
+	// run a single task until it suspends
+	void step(const std::shared_ptr<Task>& task) {
+		m_current = task;
+		task->fiber.resume();
+		m_current = nullptr;
+		switch(task->state) {
+		case Task::State::Ready: m_ready.push_back(task); break;
+		case Task::State::Sleeping: m_sleeping.push_back(task); break;
+		case Task::State::Done:
+			if(m_stacks.size() < maxCachedStacks)
+				m_stacks.push_back(task->fiber.release());
+			break;
+		}
+	}
+
+	// move the sleeping tasks which are due to the ready queue, returns the earliest other wake up
+	std::optional<Task::Clock::time_point> wakeSleeping() {
+		auto                                   now = Task::Clock::now();
+		std::optional<Task::Clock::time_point> next;
+		for(size_t i = 0; i < m_sleeping.size();) {
+			auto& task = m_sleeping[i];
+			if(task->wake <= now) {
+				task->state = Task::State::Ready;
+				m_ready.push_back(task);
+				task = m_sleeping.back();
+				m_sleeping.pop_back();
+			} else {
+				next = next ? std::min(*next, task->wake) : task->wake;
+				i++;
+			}
+		}
+		return next;
+	}
+
+	/**
+	 * Schedule until done returns true or no task is left, from the driving thread
+	 * When every task sleeps the thread sleeps until the first one is due
+	 */
+	void runUntil(const std::function<bool()>& done) {
+		while(!done()) {
+			auto next = wakeSleeping();
+			if(m_ready.empty()) {
+				if(!next)
+					return;
+				std::this_thread::sleep_until(*next);
+				continue;
+			}
+			auto task = m_ready.front();
+			m_ready.pop_front();
+			step(task);
+		}
+	}
+
+	void checkThread() {
+		if(m_owner == std::thread::id())
+			m_owner = std::this_thread::get_id();
+		else if(m_owner != std::this_thread::get_id())
+			throw EvalError(nil, "Green threads can only be used from the thread that first used them");
+	}
+
+  public:
+	Scheduler() = default;
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(const Scheduler&) = delete;
+
+	/** The task the calling code runs on, if any **/
+	[[nodiscard]] const std::shared_ptr<Task>& current() const { return m_current; }
+	[[nodiscard]] bool                         drives() const { return m_owner == std::this_thread::get_id(); }
+	[[nodiscard]] size_t                       size() const { return m_ready.size() + m_sleeping.size() + (m_current ? 1 : 0); }
+
+	/**
+	 * Create a task running body, it first runs when the scheduler is driven
+	 * @param body computes the result of the task
+	 * @return
+	 */
+	std::shared_ptr<Task> spawn(std::function<Atom()> body) {
+		checkThread();
+		FiberStack stack;
+		if(!m_stacks.empty()) {
+			stack = std::move(m_stacks.back());
+			m_stacks.pop_back();
+		} else {
+			stack = FiberStack(FiberStack::defaultSize);
+		}
+		auto task = std::make_shared<Task>(std::move(body), std::move(stack));
+		m_ready.push_back(task);
+		return task;
+	}
+
+	/** Let the other tasks run, from a task this suspends it, from the main program it runs every ready task once **/
+	void yield() {
+		checkThread();
+		if(m_current) {
+			m_current->state = Task::State::Ready;
+			m_current->fiber.suspend();
+			return;
+		}
+		wakeSleeping();
+		for(size_t n = m_ready.size(); n > 0 && !m_ready.empty(); n--) {
+			auto task = m_ready.front();
+			m_ready.pop_front();
+			step(task);
+		}
+	}
+
+	/** Suspend the calling task (or drive the others from the main program) for a duration **/
+	void sleep(std::chrono::nanoseconds duration) {
+		checkThread();
+		auto wake = Task::Clock::now() + duration;
+		if(m_current) {
+			m_current->state = Task::State::Sleeping;
+			m_current->wake  = wake;
+			m_current->fiber.suspend();
+			return;
+		}
+		runUntil([&] { return Task::Clock::now() >= wake; });
+		std::this_thread::sleep_until(wake);
+	}
+
+	/**
+	 * Wait for a task to finish
+	 * @param task
+	 * @return its result, or rethrows the error it raised
+	 */
+	Atom join(const std::shared_ptr<Task>& task) {
+		checkThread();
+		if(m_current == task)
+			throw EvalError(nil, "A task can not join itself");
+		if(m_current) {
+			while(task->state != Task::State::Done)
+				yield();
+		} else {
+			runUntil([&] { return task->state == Task::State::Done; });
+		}
+		if(task->state != Task::State::Done)
+			throw EvalError(nil, "Joined task can not finish");
+		if(task->error)
+			std::rethrow_exception(task->error);
+		return task->result;
+	}
+
+	/** Run until every task has finished, from the main program **/
+	void run() {
+		if(m_current || size() == 0)
+			return;
+		runUntil([] { return false; });
+	}
+};
+
+#endif //LISP_SCHEDULER_H
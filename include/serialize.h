@@ -0,0 +1,264 @@
+#ifndef LISP_SERIALIZE_H
+#define LISP_SERIALIZE_H
+
+#include "atom.h"
+#include "debug.h"
+#include "namespace.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Binary encoding of an atom graph
+ * Pairs are written as a node table and referred to by index, which keeps shared structure
+ * (and cycles, eg. closures in the environment they are defined in) intact and makes the
+ * encoding independent of where the atoms lived in memory.
+ *
+ * Built-in functions are written by the name they are registered under, never by address.
+ *
+ * layout:
+ *   u32 symbol count,  { u32 length, bytes }*
+ *   u32 builtin count, { u32 length, bytes }*
+ *   u32 namespace count
+ *   u32 node count,    { ref car, ref cdr }*
+ *   { ref bindings }* per namespace, a list of (symbol . value)
+ *   ref root
+ * where a ref is a type byte followed by its payload, strings are written inline
+ */
+constexpr std::uint32_t serializeFormat = 4;
+
+class SerializeError: std::exception {
+	std::string m_msg;
+
+  public:
+	explicit SerializeError(std::string msg):
+		m_msg(std::move(msg)) {}
+	std::string what() { return m_msg; }
+};
+
+class AtomWriter {
+	std::string&                                        m_out;
+	const BuiltinTable*                                 m_table;
+	std::unordered_map<std::string, std::uint32_t>      m_symbols;
+	std::unordered_map<Atom::builtin_t, std::uint32_t>  m_builtins;
+	std::unordered_map<const Pair*, std::uint32_t>      m_nodes;
+	std::vector<const Pair*>                            m_order;
+	std::unordered_map<const Namespace*, std::uint32_t> m_namespaces;
+	std::vector<Atom>                                   m_namespaceBindings; // snapshot per namespace
+
+	void collect(const Atom& root) {
+		std::vector<Atom> stack = {root};
+		while(!stack.empty()) {
+			Atom atom = stack.back();
+			stack.pop_back();
+			if(atom.type == Type::Symbol) {
+				m_symbols.emplace(*atom.symbol(), m_symbols.size());
+			} else if(atom.type == Type::Builtin) {
+				m_builtins.emplace(*atom.builtin(), m_builtins.size());
+			} else if(atom.type == Type::Pair || atom.type == Type::Closure) {
+				const Pair* pair = std::get<std::shared_ptr<Pair>>(atom.value).get();
+				if(m_nodes.emplace(pair, m_order.size()).second) {
+					m_order.push_back(pair);
+					stack.push_back(pair->cdr);
+					stack.push_back(pair->car);
+				}
+			} else if(atom.type == Type::Namespace) {
+				const Namespace* ns = std::get<std::shared_ptr<Namespace>>(atom.value).get();
+				if(m_namespaces.emplace(ns, m_namespaceBindings.size()).second) {
+					Atom bindings;
+					for(auto& [name, value]: ns->bindings())
+						bindings = Atom(Atom(Atom(name), value), bindings);
+					m_namespaceBindings.push_back(bindings);
+					stack.push_back(bindings);
+				}
+			}
+		}
+	}
+
+	void ref(const Atom& atom) {
+		put<std::uint8_t>(std::uint8_t(atom.type));
+		switch(atom.type) {
+		case Type::Nil: break;
+		case Type::Integer: put<std::int64_t>(*atom.integer()); break;
+		case Type::Rational: put<double>(*atom.rational()); break;
+		case Type::Symbol: put<std::uint32_t>(m_symbols.at(*atom.symbol())); break;
+		case Type::Builtin: put<std::uint32_t>(m_builtins.at(*atom.builtin())); break;
+		case Type::String: putString(std::get<std::string>(atom.value)); break;
+		case Type::Namespace: put<std::uint32_t>(m_namespaces.at(std::get<std::shared_ptr<Namespace>>(atom.value).get())); break;
+		case Type::Pair: [[fallthrough]];
+		case Type::Closure:
+			put<std::uint32_t>(m_nodes.at(std::get<std::shared_ptr<Pair>>(atom.value).get()));
+			break;
+		default:
+			throw SerializeError(format("Atoms of type {} can not be serialized", toString(atom.type)));
+		}
+	}
+
+	std::string_view builtinName(Atom::builtin_t fn) {
+		if(m_table) {
+			for(auto& [name, builtin]: *m_table) {
+				if(builtin == fn)
+					return name;
+			}
+		}
+		throw SerializeError("Built-in function without a registered name can not be serialized");
+	}
+
+  public:
+	/**
+	 * @param out buffer the encoding is appended to
+	 * @param builtins names of the built-in functions, required when the graph contains any
+	 */
+	explicit AtomWriter(std::string& out, const BuiltinTable* builtins = nullptr):
+		m_out(out), m_table(builtins) {}
+
+	template<typename T>
+	void put(T value) {
+		m_out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	void putString(std::string_view str) {
+		put<std::uint32_t>(str.size());
+		m_out.append(str);
+	}
+
+	void write(const Atom& root) {
+		collect(root);
+		std::vector<const std::string*> symbols(m_symbols.size());
+		for(auto& [name, index]: m_symbols)
+			symbols[index] = &name;
+		put<std::uint32_t>(symbols.size());
+		for(auto* name: symbols)
+			putString(*name);
+
+		std::vector<std::string_view> builtins(m_builtins.size());
+		for(auto& [fn, index]: m_builtins)
+			builtins[index] = builtinName(fn);
+		put<std::uint32_t>(builtins.size());
+		for(auto name: builtins)
+			putString(name);
+
+		put<std::uint32_t>(m_namespaceBindings.size());
+		put<std::uint32_t>(m_order.size());
+		for(auto* pair: m_order) {
+			ref(pair->car);
+			ref(pair->cdr);
+		}
+		for(auto& bindings: m_namespaceBindings)
+			ref(bindings);
+		ref(root);
+	}
+};
+
+class AtomReader {
+	std::string_view                   m_in;
+	size_t                             m_pos = 0;
+	const BuiltinTable*                m_table;
+	std::vector<Atom>                  m_symbols;
+	std::vector<Atom>                  m_builtins;
+	std::vector<std::shared_ptr<Pair>> m_nodes;
+	std::vector<Atom>                  m_namespaces;
+
+	Atom ref() {
+		Atom atom;
+		atom.type = Type(get<std::uint8_t>());
+		switch(atom.type) {
+		case Type::Nil: break;
+		case Type::Integer: atom.value = long(get<std::int64_t>()); break;
+		case Type::Rational: atom.value = get<double>(); break;
+		case Type::Symbol: atom = m_symbols[index(m_symbols.size())]; break;
+		case Type::Builtin: atom = m_builtins[index(m_builtins.size())]; break;
+		case Type::String: atom.value = std::string(string()); break;
+		case Type::Namespace: atom = m_namespaces[index(m_namespaces.size())]; break;
+		case Type::Pair: [[fallthrough]];
+		case Type::Closure: atom.value = m_nodes[index(m_nodes.size())]; break;
+		default: throw SerializeError("Unknown atom type in serialized data");
+		}
+		return atom;
+	}
+	std::uint32_t index(size_t size) {
+		auto i = get<std::uint32_t>();
+		if(i >= size)
+			throw SerializeError("Reference out of range in serialized data");
+		return i;
+	}
+
+	Atom builtin(std::string_view name) {
+		if(m_table) {
+			for(auto& [builtinName, fn]: *m_table) {
+				if(builtinName == name)
+					return Atom(fn);
+			}
+		}
+		throw SerializeError(format("Unknown built-in function {} in serialized data", name));
+	}
+
+  public:
+	/**
+	 * @param in the encoded data
+	 * @param builtins the built-in functions names are resolved against
+	 */
+	explicit AtomReader(std::string_view in, const BuiltinTable* builtins = nullptr):
+		m_in(in), m_table(builtins) {}
+
+	size_t position() const { return m_pos; }
+
+	template<typename T>
+	T get() {
+		if(m_pos + sizeof(T) > m_in.size())
+			throw SerializeError("Unexpected end of serialized data");
+		T value;
+		std::memcpy(&value, m_in.data() + m_pos, sizeof(T));
+		m_pos += sizeof(T);
+		return value;
+	}
+	std::string_view string() {
+		auto size = get<std::uint32_t>();
+		if(m_pos + size > m_in.size())
+			throw SerializeError("Unexpected end of serialized data");
+		auto str = m_in.substr(m_pos, size);
+		m_pos += size;
+		return str;
+	}
+
+	Atom read() {
+		auto symbols = get<std::uint32_t>();
+		m_symbols.reserve(symbols);
+		for(std::uint32_t i = 0; i < symbols; i++)
+			m_symbols.emplace_back(std::string(string()));
+
+		auto builtins = get<std::uint32_t>();
+		m_builtins.reserve(builtins);
+		for(std::uint32_t i = 0; i < builtins; i++)
+			m_builtins.push_back(builtin(string()));
+
+		auto namespaces = get<std::uint32_t>();
+		for(std::uint32_t i = 0; i < namespaces; i++)
+			m_namespaces.emplace_back(std::make_shared<Namespace>());
+
+		auto nodes = get<std::uint32_t>();
+		m_nodes.reserve(nodes);
+		// allocate every node first so references can point forward (or form cycles)
+		for(std::uint32_t i = 0; i < nodes; i++)
+			m_nodes.push_back(std::make_shared<Pair>(nil, nil));
+		for(auto& node: m_nodes) {
+			node->car = ref();
+			node->cdr = ref();
+		}
+		for(auto& ns: m_namespaces) {
+			for(Atom bindings = ref(); bindings.type == Type::Pair; bindings = bindings.cdr()) {
+				Atom binding = bindings.car();
+				if(binding.type != Type::Pair || binding.car().type != Type::Symbol)
+					throw SerializeError("Malformed namespace in serialized data");
+				(*ns.ns())->define(*binding.car().symbol(), binding.cdr());
+			}
+		}
+		return ref();
+	}
+};
+
+#endif //LISP_SERIALIZE_H
@@ -0,0 +1,520 @@
+#ifndef LISP_SERVER_H
+#define LISP_SERVER_H
+
+#include "atom.h"
+#include "debug.h"
+#include "environment.h"
+#include "eval.h"
+#include "interpreter.h"
+#include "stack.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Framing of the evaluation server, all integers in host byte order (the socket is local)
+ *   request:  u32 length, u32 id, u32 timeout in ms (0 for the default of the server), source
+ *   response: u32 length, u32 id, u8 status, printed result or error message
+ * where length counts the bytes after the header. Requests on one connection may be
+ * pipelined, responses are sent as requests finish, so they are matched by id, not by order.
+ */
+namespace protocol {
+	enum class Status : std::uint8_t {
+		Ok,
+		Error,
+		Timeout
+	};
+	constexpr size_t requestHeaderSize  = 3 * sizeof(std::uint32_t);
+	constexpr size_t responseHeaderSize = 2 * sizeof(std::uint32_t) + sizeof(std::uint8_t);
+	constexpr size_t maxFrameSize       = 64 * 1024 * 1024;
+
+	struct Request {
+		std::uint32_t id;
+		std::uint32_t timeout;
+		std::string   source;
+	};
+	struct Response {
+		std::uint32_t id;
+		Status        status;
+		std::string   payload;
+	};
+
+	template<typename T>
+	void put(std::string& out, T value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	template<typename T>
+	T get(const char* in) {
+		T value;
+		std::memcpy(&value, in, sizeof(T));
+		return value;
+	}
+
+	inline void encode(std::string& out, const Request& request) {
+		put<std::uint32_t>(out, request.source.size());
+		put<std::uint32_t>(out, request.id);
+		put<std::uint32_t>(out, request.timeout);
+		out += request.source;
+	}
+	inline void encode(std::string& out, const Response& response) {
+		put<std::uint32_t>(out, response.payload.size());
+		put<std::uint32_t>(out, response.id);
+		put<std::uint8_t>(out, std::uint8_t(response.status));
+		out += response.payload;
+	}
+
+	/**
+	 * Take the frames which are complete from the front of a buffer
+	 * @return false when the buffer holds a frame larger than allowed
+	 */
+	inline bool decode(std::string& in, std::vector<Request>& requests) {
+		size_t pos = 0;
+		while(in.size() - pos >= requestHeaderSize) {
+			auto length = get<std::uint32_t>(in.data() + pos);
+			if(length > maxFrameSize)
+				return false;
+			if(in.size() - pos < requestHeaderSize + length)
+				break;
+			requests.push_back({get<std::uint32_t>(in.data() + pos + 4), get<std::uint32_t>(in.data() + pos + 8),
+								in.substr(pos + requestHeaderSize, length)});
+			pos += requestHeaderSize + length;
+		}
+		in.erase(0, pos);
+		return true;
+	}
+	inline bool decode(std::string& in, std::vector<Response>& responses) {
+		size_t pos = 0;
+		while(in.size() - pos >= responseHeaderSize) {
+			auto length = get<std::uint32_t>(in.data() + pos);
+			if(length > maxFrameSize)
+				return false;
+			if(in.size() - pos < responseHeaderSize + length)
+				break;
+			responses.push_back({get<std::uint32_t>(in.data() + pos + 4), Status(get<std::uint8_t>(in.data() + pos + 8)),
+								 in.substr(pos + responseHeaderSize, length)});
+			pos += responseHeaderSize + length;
+		}
+		in.erase(0, pos);
+		return true;
+	}
+
+	inline sockaddr_un address(const std::string& path) {
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(addr.sun_path))
+			throw std::runtime_error(format("Socket path {} is too long", path));
+		std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+		return addr;
+	}
+} // namespace protocol
+
+/**
+ * Evaluation server on a Unix domain socket
+ * One thread multiplexes the connections with epoll and decodes requests, a pool of workers
+ * evaluates them. Every worker owns an interpreter which is prepared once at startup, so a
+ * request only pays for its own evaluation. A request is evaluated in a fresh environment on
+ * top of the global one of its worker, its definitions are dropped afterwards, and anything it
+ * writes to its output port is sent in front of the printed result.
+ */
+class Server {
+  public:
+	struct Options {
+		size_t                            workers = std::max(1u, std::thread::hardware_concurrency());
+		std::chrono::milliseconds         timeout{5000}; // for requests without a timeout of their own
+		std::function<void(Interpreter&)> prepare;       // run on every interpreter before serving
+	};
+
+  private:
+	struct Connection {
+		int           fd;
+		std::string   in;
+		std::mutex    lock; // guards the fields below, which workers write to
+		std::string   out;
+		size_t        pending    = 0;
+		bool          readClosed = false;
+		std::uint32_t events     = EPOLLIN | EPOLLRDHUP; // watched by the event loop
+		explicit Connection(int fd):
+			fd(fd) {}
+	};
+	struct Job {
+		std::shared_ptr<Connection> connection;
+		protocol::Request           request;
+	};
+
+	std::string                                          m_path;
+	Options                                              m_options;
+	const BuiltinTable&                                  m_builtins;
+	int                                                  m_listen = -1, m_epoll = -1, m_wake = -1;
+	std::atomic<bool>                                    m_stop   = false;
+	std::unordered_map<int, std::shared_ptr<Connection>> m_connections;
+	// jobs for the workers
+	std::mutex              m_jobLock;
+	std::condition_variable m_jobReady;
+	std::deque<Job>         m_jobs;
+	// connections with new output, for the event loop
+	std::mutex                               m_doneLock;
+	std::vector<std::shared_ptr<Connection>> m_done;
+	std::vector<std::thread>                 m_workers;
+	// workers which finished preparing
+	std::mutex              m_prepareLock;
+	std::condition_variable m_prepared;
+	size_t                  m_ready = 0;
+	std::exception_ptr      m_prepareError;
+
+	[[noreturn]] static void fail(const char* action) {
+		throw std::runtime_error(format("Server failed to {}: {}", action, std::strerror(errno)));
+	}
+
+	void watch(int fd, std::uint32_t events, int op) {
+		epoll_event event{};
+		event.events  = events;
+		event.data.fd = fd;
+		if(::epoll_ctl(m_epoll, op, fd, &event) < 0)
+			fail("watch a descriptor");
+	}
+
+	void closeConnection(const std::shared_ptr<Connection>& connection) {
+		::epoll_ctl(m_epoll, EPOLL_CTL_DEL, connection->fd, nullptr);
+		::close(connection->fd);
+		m_connections.erase(connection->fd);
+		connection->fd = -1;
+	}
+
+	void accept() {
+		for(;;) {
+			int fd = ::accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if(fd < 0) {
+				if(errno == EINTR)
+					continue;
+				return; // EAGAIN, or out of descriptors: retried on the next event
+			}
+			m_connections.emplace(fd, std::make_shared<Connection>(fd));
+			watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+		}
+	}
+
+	void read(const std::shared_ptr<Connection>& connection) {
+		char buf[64 * 1024];
+		for(;;) {
+			ssize_t n = ::recv(connection->fd, buf, sizeof(buf), 0);
+			if(n > 0) {
+				connection->in.append(buf, n);
+				continue;
+			}
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			// the client is done sending, answer what it sent before closing
+			std::lock_guard<std::mutex> guard(connection->lock);
+			connection->readClosed = true;
+			break;
+		}
+
+		std::vector<protocol::Request> requests;
+		if(!protocol::decode(connection->in, requests)) {
+			closeConnection(connection);
+			return;
+		}
+		if(!requests.empty()) {
+			{
+				std::lock_guard<std::mutex> guard(connection->lock);
+				connection->pending += requests.size();
+			}
+			{
+				std::lock_guard<std::mutex> guard(m_jobLock);
+				for(auto& request: requests)
+					m_jobs.push_back({connection, std::move(request)});
+			}
+			m_jobReady.notify_all();
+		}
+		flush(connection);
+	}
+
+	// write the output of a connection, closing it once it is finished
+	void flush(const std::shared_ptr<Connection>& connection) {
+		if(connection->fd < 0)
+			return;
+		std::unique_lock<std::mutex> guard(connection->lock);
+		while(!connection->out.empty()) {
+			ssize_t n = ::send(connection->fd, connection->out.data(), connection->out.size(), MSG_NOSIGNAL);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if(n < 0) { // the client went away
+				guard.unlock();
+				closeConnection(connection);
+				return;
+			}
+			connection->out.erase(0, n);
+		}
+		// stop reading once the client is done sending, wait for writing while the socket is full
+		bool          blocked = !connection->out.empty();
+		std::uint32_t events  = (connection->readClosed ? 0 : EPOLLIN | EPOLLRDHUP) | (blocked ? EPOLLOUT : 0);
+		if(events != connection->events) {
+			connection->events = events;
+			watch(connection->fd, events, EPOLL_CTL_MOD);
+		}
+		if(connection->readClosed && connection->pending == 0 && !blocked) {
+			guard.unlock();
+			closeConnection(connection);
+		}
+	}
+
+	protocol::Response evaluate(Interpreter& interp, std::stringstream& out, const protocol::Request& request) {
+		protocol::Response response{request.id, protocol::Status::Ok, {}};
+		auto               timeout = request.timeout ? std::chrono::milliseconds(request.timeout) : m_options.timeout;
+		out.str({});
+		interp.setDeadline(std::chrono::steady_clock::now() + timeout);
+		try {
+			MacroTable::Scope macros(interp.macros());
+			Environment       env(interp.global().atom());
+			Atom              result = interpret(interp, Source(request.source, "request"), env);
+			interp.scheduler().run();
+			out << result;
+			response.payload = out.str();
+		} catch(TimeoutError& err) {
+			response = {request.id, protocol::Status::Timeout, err.what()};
+		} catch(ProgramError& err) {
+			std::stringstream message;
+			staticError(err, message);
+			response = {request.id, protocol::Status::Error, message.str()};
+		} catch(RunTimeError& err) {
+			response = {request.id, protocol::Status::Error, err.what()};
+		} catch(std::exception& err) {
+			response = {request.id, protocol::Status::Error, err.what()};
+		}
+		interp.clearDeadline();
+		return response;
+	}
+
+	void work() {
+		stack::Guard      stackGuard; // deep recursion in a request fails it, not the server
+		std::stringstream in, out;
+		Interpreter       interp(m_builtins, in, out, out);
+		std::exception_ptr error;
+		try {
+			if(m_options.prepare)
+				m_options.prepare(interp);
+		} catch(...) {
+			error = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> guard(m_prepareLock);
+			if(error)
+				m_prepareError = error;
+			m_ready++;
+		}
+		m_prepared.notify_all();
+		for(;;) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> guard(m_jobLock);
+				m_jobReady.wait(guard, [this] { return m_stop || !m_jobs.empty(); });
+				if(m_stop)
+					return;
+				job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+			}
+			auto response = evaluate(interp, out, job.request);
+			{
+				std::lock_guard<std::mutex> guard(job.connection->lock);
+				protocol::encode(job.connection->out, response);
+				job.connection->pending--;
+			}
+			{
+				std::lock_guard<std::mutex> guard(m_doneLock);
+				m_done.push_back(std::move(job.connection));
+			}
+			wake();
+		}
+	}
+
+	void wake() {
+		std::uint64_t one = 1;
+		while(::write(m_wake, &one, sizeof(one)) < 0 && errno == EINTR) {}
+	}
+
+  public:
+	/**
+	 * Listen on a socket, replacing a stale socket file at path
+	 * @param path
+	 * @param builtins the built-in functions of the worker interpreters
+	 * @param options
+	 */
+	Server(std::string path, const BuiltinTable& builtins, Options options):
+		m_path(std::move(path)), m_options(std::move(options)), m_builtins(builtins) {
+		auto addr = protocol::address(m_path);
+		m_listen  = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(m_listen < 0)
+			fail("create a socket");
+		::unlink(m_path.c_str());
+		if(::bind(m_listen, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(m_listen, SOMAXCONN) < 0) {
+			::close(m_listen);
+			fail("listen");
+		}
+		m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+		m_wake  = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(m_epoll < 0 || m_wake < 0)
+			fail("create an event loop");
+		watch(m_listen, EPOLLIN, EPOLL_CTL_ADD);
+		watch(m_wake, EPOLLIN, EPOLL_CTL_ADD);
+	}
+	Server(const Server&) = delete;
+	Server& operator=(const Server&) = delete;
+	~Server() {
+		stop();
+		for(auto& worker: m_workers)
+			worker.join();
+		for(auto& [fd, connection]: m_connections)
+			::close(fd);
+		::close(m_listen);
+		::close(m_epoll);
+		::close(m_wake);
+		::unlink(m_path.c_str());
+	}
+
+	/** Start the workers & wait until their interpreters are prepared, rethrows an error preparing them **/
+	void start() {
+		for(size_t i = 0; i < m_options.workers; i++)
+			m_workers.emplace_back([this] { work(); });
+		std::unique_lock<std::mutex> guard(m_prepareLock);
+		m_prepared.wait(guard, [this] { return m_ready == m_workers.size(); });
+		if(m_prepareError)
+			std::rethrow_exception(m_prepareError);
+	}
+
+	/** Serve until stop() is called, from the thread calling it **/
+	void run() {
+		if(m_workers.empty())
+			start();
+		std::vector<epoll_event> events(256);
+		while(!m_stop) {
+			int count = ::epoll_wait(m_epoll, events.data(), int(events.size()), -1);
+			if(count < 0) {
+				if(errno == EINTR)
+					continue;
+				fail("wait for events");
+			}
+			for(int i = 0; i < count; i++) {
+				int fd = events[i].data.fd;
+				if(fd == m_listen) {
+					accept();
+				} else if(fd == m_wake) {
+					std::uint64_t value;
+					while(::read(m_wake, &value, sizeof(value)) < 0 && errno == EINTR) {}
+					std::vector<std::shared_ptr<Connection>> done;
+					{
+						std::lock_guard<std::mutex> guard(m_doneLock);
+						done.swap(m_done);
+					}
+					for(auto& connection: done)
+						flush(connection);
+				} else if(auto it = m_connections.find(fd); it != m_connections.end()) {
+					auto connection = it->second;
+					if(events[i].events & (EPOLLHUP | EPOLLERR)) {
+						// reported whatever is watched, the socket is gone both ways: drop what is still pending
+						closeConnection(connection);
+						continue;
+					}
+					if(events[i].events & (EPOLLIN | EPOLLRDHUP))
+						read(connection);
+					if(events[i].events & EPOLLOUT)
+						flush(connection);
+				}
+			}
+		}
+	}
+
+	/** Stop serving, safe to call from any thread **/
+	void stop() {
+		{
+			std::lock_guard<std::mutex> guard(m_jobLock);
+			m_stop = true;
+		}
+		m_jobReady.notify_all();
+		if(m_wake >= 0)
+			wake();
+	}
+};
+
+/**
+ * Blocking client of the evaluation server
+ */
+class ServerClient {
+	int         m_fd;
+	std::string m_in;
+
+  public:
+	explicit ServerClient(const std::string& path) {
+		auto addr = protocol::address(path);
+		m_fd      = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(m_fd < 0 || ::connect(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			if(m_fd >= 0)
+				::close(m_fd);
+			throw std::runtime_error(format("Failed to connect to {}: {}", path, std::strerror(errno)));
+		}
+	}
+	ServerClient(const ServerClient&) = delete;
+	ServerClient& operator=(const ServerClient&) = delete;
+	~ServerClient() { ::close(m_fd); }
+
+	[[nodiscard]] int fd() const { return m_fd; }
+
+	/** Send requests without waiting for their responses **/
+	void send(const std::vector<protocol::Request>& requests) {
+		std::string out;
+		for(auto& request: requests)
+			protocol::encode(out, request);
+		for(size_t sent = 0; sent < out.size();) {
+			ssize_t n = ::send(m_fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n < 0)
+				throw std::runtime_error(format("Failed to send request: {}", std::strerror(errno)));
+			sent += n;
+		}
+	}
+	void send(const protocol::Request& request) { send(std::vector<protocol::Request>{request}); }
+
+	/** Wait for at least one response **/
+	std::vector<protocol::Response> receive() {
+		std::vector<protocol::Response> responses;
+		char                            buf[64 * 1024];
+		for(;;) {
+			if(!protocol::decode(m_in, responses))
+				throw std::runtime_error("Malformed response");
+			if(!responses.empty())
+				return responses;
+			ssize_t n = ::recv(m_fd, buf, sizeof(buf), 0);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				throw std::runtime_error("Connection to server closed");
+			m_in.append(buf, n);
+		}
+	}
+};
+
+#endif //LISP_SERVER_H
@@ -0,0 +1,71 @@
+#ifndef LISP_SOURCE_H
+#define LISP_SOURCE_H
+
+#include "token.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * The source buffer tokens refer into
+ * Line / column positions are not stored per token, instead they are computed
+ * from an index of line starts which is only built once a diagnostic needs it
+ */
+class Source {
+	std::string                        m_name;
+	std::string                        m_text;
+	mutable std::vector<std::uint32_t> m_lines; // offset of every line start
+
+	void index() const {
+		if(!m_lines.empty())
+			return;
+		m_lines.push_back(0);
+		for(size_t i = 0; i < m_text.size(); i++) {
+			if(m_text[i] == '\n')
+				m_lines.push_back(i + 1);
+		}
+	}
+
+  public:
+	struct Position {
+		size_t line = 0, column = 0;
+	};
+
+	explicit Source(std::string text, std::string name = "REPL"):
+		m_name(std::move(name)), m_text(std::move(text)) {}
+
+	[[nodiscard]] const std::string& name() const { return m_name; }
+	[[nodiscard]] const std::string& text() const { return m_text; }
+
+	/** The text a token spans **/
+	[[nodiscard]] std::string_view text(const Token& token) const {
+		return std::string_view(m_text).substr(token.offset, token.length);
+	}
+
+	/**
+	 * Zero based line & column of a token
+	 * @param token
+	 * @return
+	 */
+	[[nodiscard]] Position position(const Token& token) const {
+		index();
+		// the last line start at or before the token
+		auto it = std::upper_bound(m_lines.begin(), m_lines.end(), token.offset) - 1;
+		return {size_t(it - m_lines.begin()), size_t(token.offset - *it)};
+	}
+
+	/** The full text of a zero based line, without the newline **/
+	[[nodiscard]] std::string_view line(size_t line) const {
+		index();
+		if(line >= m_lines.size())
+			return {};
+		size_t begin = m_lines[line];
+		size_t end   = line + 1 < m_lines.size() ? m_lines[line + 1] - 1 : m_text.size();
+		return std::string_view(m_text).substr(begin, end - begin);
+	}
+};
+
+#endif //LISP_SOURCE_H
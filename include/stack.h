@@ -0,0 +1,52 @@
+#ifndef LISP_STACK_H
+#define LISP_STACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+
+/**
+ * Bound on the machine stack of a thread
+ * The evaluator is recursive, so deep recursion in a program overflows the stack of the thread
+ * evaluating it. A thread which guards its stack has eval check the stack pointer against a
+ * limit a margin above the end, and a program going past it fails with an error instead of
+ * taking the process down. Fibers set the limit of their own stack while they run.
+ */
+namespace stack {
+	constexpr size_t margin = 256 * 1024; // for the frames between two checks, builtins which recurse included
+
+	inline thread_local const char* t_limit = nullptr; // unchecked when null
+
+	/** The limit for a stack of size bytes starting at the lowest address base **/
+	inline const char* limitOf(const void* base, size_t size) {
+		return static_cast<const char*>(base) + (size > 2 * margin ? margin : size / 2);
+	}
+
+	/** Whether the calling frame is past the limit of the thread **/
+	inline bool exhausted() {
+		return t_limit && static_cast<const char*>(__builtin_frame_address(0)) < t_limit;
+	}
+
+	/** Guards the stack of the calling thread for its lifetime **/
+	class Guard {
+		const char* m_saved;
+
+	  public:
+		Guard():
+			m_saved(t_limit) {
+			pthread_attr_t attr;
+			void*          base = nullptr;
+			size_t         size = 0;
+			if(::pthread_getattr_np(::pthread_self(), &attr) != 0)
+				return;
+			if(::pthread_attr_getstack(&attr, &base, &size) == 0)
+				t_limit = limitOf(base, size);
+			::pthread_attr_destroy(&attr);
+		}
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+		~Guard() { t_limit = m_saved; }
+	};
+} // namespace stack
+
+#endif //LISP_STACK_H
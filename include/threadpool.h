@@ -0,0 +1,180 @@
+#ifndef LISP_THREADPOOL_H
+#define LISP_THREADPOOL_H
+
+#include "stack.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A work stealing thread pool
+ * Every worker owns a deque of tasks, it pushes & pops its own work at the back (so recently
+ * split, cache warm work runs first) and steals from the front of the other deques, where the
+ * oldest and therefore largest pieces of work are, once it runs out.
+ * Threads waiting for work to finish help by running queued tasks instead of blocking.
+ */
+class ThreadPool {
+  public:
+	using Task = std::function<void()>;
+
+  private:
+	struct Worker {
+		std::mutex       lock;
+		std::deque<Task> tasks;
+	};
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread>             m_threads;
+	std::atomic<bool>                    m_stop    = false;
+	std::atomic<size_t>                  m_pending = 0; // queued, not yet started tasks
+	std::atomic<size_t>                  m_next    = 0; // round robin for external submissions
+	std::mutex                           m_sleepLock;
+	std::condition_variable              m_wake;
+
+	// the pool & worker index of the current thread, if it is a worker
+	static inline thread_local ThreadPool* t_pool  = nullptr;
+	static inline thread_local size_t      t_index = 0;
+
+	bool pop(size_t index, Task& task, bool back) {
+		Worker&                     worker = *m_workers[index];
+		std::lock_guard<std::mutex> guard(worker.lock);
+		if(worker.tasks.empty())
+			return false;
+		if(back) {
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+		} else {
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+		}
+		m_pending--;
+		return true;
+	}
+
+	void work(size_t index) {
+		stack::Guard guard; // tasks evaluate
+		t_pool  = this;
+		t_index = index;
+		while(!m_stop) {
+			if(runOne())
+				continue;
+			std::unique_lock<std::mutex> lock(m_sleepLock);
+			m_wake.wait(lock, [&] { return m_stop || m_pending > 0; });
+		}
+	}
+
+  public:
+	explicit ThreadPool(size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+		threads = std::max<size_t>(threads, 1);
+		for(size_t i = 0; i < threads; i++)
+			m_workers.push_back(std::make_unique<Worker>());
+		for(size_t i = 0; i < threads; i++)
+			m_threads.emplace_back(&ThreadPool::work, this, i);
+	}
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(m_sleepLock);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for(auto& thread: m_threads)
+			thread.join();
+	}
+
+	[[nodiscard]] size_t size() const { return m_threads.size(); }
+
+	/**
+	 * Queue a task, on the deque of the current worker or, from outside the pool, round robin
+	 * @param task
+	 */
+	void submit(Task task) {
+		size_t index = t_pool == this ? t_index : m_next++ % m_workers.size();
+		{
+			std::lock_guard<std::mutex> guard(m_workers[index]->lock);
+			m_workers[index]->tasks.push_back(std::move(task));
+		}
+		m_pending++;
+		{
+			std::lock_guard<std::mutex> guard(m_sleepLock);
+		}
+		m_wake.notify_one();
+	}
+
+	/**
+	 * Run a single queued task on the calling thread, own work first, stolen work otherwise
+	 * @return whether a task was run
+	 */
+	bool runOne() {
+		if(m_pending == 0)
+			return false;
+		Task   task;
+		size_t self = t_pool == this ? t_index : 0;
+		bool   found = t_pool == this && pop(self, task, true);
+		for(size_t i = 1; !found && i <= m_workers.size(); i++)
+			found = pop((self + i) % m_workers.size(), task, false);
+		if(!found)
+			return false;
+		task();
+		return true;
+	}
+
+	/**
+	 * Run body over [0, n) in ranges of at most grain elements
+	 * Ranges are split in halves on demand, so idle workers steal large pieces and busy ones
+	 * keep splitting their own work; small inputs never leave the calling thread.
+	 * The first exception thrown (by lowest range start) is rethrown once all work is done.
+	 * @param n
+	 * @param grain
+	 * @param body called with [begin, end)
+	 */
+	void parallelFor(size_t n, size_t grain, const std::function<void(size_t, size_t)>& body) {
+		grain = std::max<size_t>(grain, 1);
+		if(n <= grain || size() == 1) {
+			if(n > 0)
+				body(0, n);
+			return;
+		}
+
+		std::atomic<size_t> remaining = n;
+		std::mutex          errorLock;
+		std::exception_ptr  error;
+		size_t              errorAt = n;
+
+		std::function<void(size_t, size_t)> run = [&](size_t begin, size_t end) {
+			while(end - begin > grain) {
+				size_t middle = begin + (end - begin) / 2;
+				submit([&run, middle, end] { run(middle, end); });
+				end = middle;
+			}
+			try {
+				body(begin, end);
+			} catch(...) {
+				std::lock_guard<std::mutex> guard(errorLock);
+				if(begin < errorAt) {
+					errorAt = begin;
+					error   = std::current_exception();
+				}
+			}
+			remaining -= end - begin;
+		};
+		run(0, n);
+		// help instead of blocking until every range has run
+		while(remaining > 0) {
+			if(!runOne())
+				std::this_thread::yield();
+		}
+		if(error)
+			std::rethrow_exception(error);
+	}
+};
+
+#endif //LISP_THREADPOOL_H
@@ -1,18 +1,20 @@
 #ifndef LISP_TOKEN_H
 #define LISP_TOKEN_H
 
-enum class TokenType {
+#include <cstdint>
+
+enum class TokenType : std::uint8_t {
 	LEFT_PAREN,
 	RIGHT_PAREN, // ()
 	LEFT_BRACKET,
 	RIGHT_BRACKET, // []
 	LEFT_BRACE,
 	RIGHT_BRACE, // {}
-	IDK,         // ~@
+	IDK,         // ~@ ,@ unquote-splicing
 	CARET,       // ^
 	AT,          // @
-	GRAVE,       //`
-	TILDE,       // ~
+	GRAVE,       // ` quasiquote
+	TILDE,       // ~ , unquote
 	QUOTE,       // '
 	DOT,         // .
 	STRING,
@@ -20,10 +22,15 @@ enum class TokenType {
 	NUMBER
 };
 
+/**
+ * A token is a typed span of the source buffer it was read from,
+ * its text and line / column are resolved through the Source (see source.h)
+ */
 struct Token {
-	TokenType   type;
-	std::string value;
-	size_t      line = 0, column = 0;
+	TokenType     type;
+	std::uint32_t offset = 0, length = 0;
 };
 
+static_assert(sizeof(Token) <= 12, "Tokens should stay compact");
+
 #endif //LISP_TOKEN_H
@@ -3,38 +3,37 @@
 
 #include "debug.h"
 #include "format.h"
+#include "source.h"
 #include "token.h"
 
-#include <iostream>
 #include <deque>
+#include <iostream>
+#include <limits>
 #include <set>
 #include <utility>
 
-std::deque<Token> tokenizer(const std::string& input) {
-	std::deque<Token> tokens;
-	auto              current = input.begin();
-	size_t            line = 0, column = 0;
+std::deque<Token> tokenizer(const Source& source) {
+	const std::string& input = source.text();
+	std::deque<Token>  tokens;
+	size_t             current = 0;
+
+	if(input.size() > std::numeric_limits<std::uint32_t>::max())
+		throw LexError(source, Token{TokenType::IDENTIFIER}, "Source exceeds the maximum size of 4 GiB");
 
 	/** Helper functions **/
-	auto is_end = [&]() { return *current == '\0' || *current == EOF; };
+	// std::string is null terminated, so input[input.size()] is '\0'
+	auto is_end = [&]() { return current >= input.size() || input[current] == '\0' || input[current] == EOF; };
 	// peek n places forward
-	auto peek = [&](size_t n = 1) { return *(current + n); };
-
-	auto newline = [&]() { line++; column = 0; };
-	// advance a character & column || line
-	auto advance = [&]() {
-		if(*current == '\n')
-			newline();
-		else
-			column++;
-		current++;
-	};
+	auto peek = [&](size_t n = 1) { return current + n < input.size() ? input[current + n] : '\0'; };
+	// advance a character
+	auto advance = [&]() { current++; };
 
-	auto add_token = [&](TokenType type, const std::string& str) {
-		tokens.push_back({type, str, line, column});
+	// add a token spanning [start, end)
+	auto add_token = [&](TokenType type, size_t start, size_t end) {
+		tokens.push_back({type, std::uint32_t(start), std::uint32_t(end - start)});
 	};
 
-	auto number = [&]() -> Token {
+	auto number = [&]() {
 		auto start = current;
 		while(isdigit(peek()))
 			advance();
@@ -43,10 +42,7 @@ std::deque<Token> tokenizer(const std::string& input) {
 			while(isdigit(peek()))
 				advance();
 		}
-		// todo: check if necessary
-		//if(start == current)
-		advance();
-		return Token{TokenType::NUMBER, std::string(start, current + 1), line, column};
+		add_token(TokenType::NUMBER, start, current + 1);
 	};
 
 	// Whitelist all accepted identifiers
@@ -56,39 +52,75 @@ std::deque<Token> tokenizer(const std::string& input) {
                acceptedIdentifiers.find(c) != acceptedIdentifiers.end();
 	};
 
-	auto identifier = [&]() -> Token {
+	// a dot inside an identifier is part of it (eg. file names), a lone dot is a DOT token
+	auto identifier = [&]() {
 		auto start = current;
-		while(is_identifier(peek()) || isdigit(peek()))
+		while(is_identifier(peek()) || isdigit(peek()) || peek() == '.' && is_identifier(peek(2)))
 			advance();
-		return Token{TokenType::IDENTIFIER, std::string(start, current + 1), line, column};
+		add_token(TokenType::IDENTIFIER, start, current + 1);
+	};
+
+	// a string literal including its quotes, escapes are resolved by the parser
+	auto string = [&]() {
+		auto start = current;
+		for(;;) {
+			if(current + 1 >= input.size())
+				throw LexError(source, Token{TokenType::STRING, std::uint32_t(start), 1}, "Unterminated string literal");
+			advance();
+			if(input[current] == '\\')
+				advance();
+			else if(input[current] == '"')
+				break;
+		}
+		add_token(TokenType::STRING, start, current + 1);
 	};
 
 	while(!is_end()) {
+		// a comment runs to the end of the line
+		if(input[current] == ';') {
+			while(!is_end() && input[current] != '\n')
+				advance();
+			continue;
+		}
 		/** Tokenize multi character tokens **/
-		if(isdigit(*current))
-			tokens.push_back(number());
-		if(is_identifier(*current))
-			tokens.push_back(identifier());
+		if(isdigit(input[current]))
+			number();
+		else if(is_identifier(input[current]))
+			identifier();
+		else if(input[current] == '"')
+			string();
 
 		// Tokenize all single character tokens
-		switch(*current) {
-		// !is_end()
-		case '\0': [[fallthrough]];
-		case EOF: continue; // go to while start
+		switch(input[current]) {
 		case ' ': [[fallthrough]];
-		case '\t':
-			break;
+		case '\t': [[fallthrough]];
 		case '\n':
-			newline();
 			break;
 		case '(':
-			add_token(TokenType::LEFT_PAREN, "(");
+			add_token(TokenType::LEFT_PAREN, current, current + 1);
 			break;
 		case ')':
-			add_token(TokenType::RIGHT_PAREN, ")");
+			add_token(TokenType::RIGHT_PAREN, current, current + 1);
 			break;
 		case '.':
-			add_token(TokenType::DOT, ".");
+			add_token(TokenType::DOT, current, current + 1);
+			break;
+		// reader macros, the parser wraps the expression following them
+		case '\'':
+			add_token(TokenType::QUOTE, current, current + 1);
+			break;
+		case '`':
+			add_token(TokenType::GRAVE, current, current + 1);
+			break;
+		case ',':
+			[[fallthrough]];
+		case '~':
+			if(peek() == '@') {
+				add_token(TokenType::IDK, current, current + 2);
+				advance();
+			} else {
+				add_token(TokenType::TILDE, current, current + 1);
+			}
 			break;
 		default:
 			// just create identifiers of all remaining characters
@@ -0,0 +1,183 @@
+#ifndef LISP_TRACE_H
+#define LISP_TRACE_H
+
+#include "atom.h"
+#include "debug.h"
+#include "profiler.h"
+#include "ringbuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Flight recorder of the evaluation
+ * Every thread records compact events (the evaluation of a list, the application of a closure or
+ * built-in function, its return or unwinding by an error) in a fixed size history, overwriting the
+ * oldest. Recording is a few stores & a timestamp counter read, so it stays enabled; the history is
+ * decoded when an error is reported or on demand with (dump-trace).
+ * Events hold no references: functions are recorded by address & named when decoded, if they are
+ * still bound in the global environment, operators by the first characters of their symbol.
+ */
+namespace trace {
+	enum class Kind : std::uint8_t {
+		Eval,    // a list is evaluated, text is its operator
+		Apply,   // a closure is applied
+		Builtin, // a built-in function is applied
+		Return,  // the function returned a value of type
+		Unwind   // the function was left by an error
+	};
+
+	struct Event {
+		std::uint64_t time; // timestamp counter
+		Kind          kind;
+		std::uint8_t  type; // a Type
+		std::uint16_t depth; // applications on the stack
+		std::uint8_t  length;
+		union {
+			char        text[16];
+			const void* function;
+		};
+	};
+	static_assert(sizeof(Event) <= 32, "events are recorded on every evaluation");
+
+	constexpr size_t capacity = 2048; // events per thread
+
+	inline thread_local HistoryBuffer<Event, capacity> t_events;
+	inline thread_local std::uint16_t                 t_depth = 0;
+	inline std::atomic<bool>                          enabled = true;
+
+	inline std::uint64_t timestamp() {
+#if defined(__x86_64__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// timestamps of a known moment, to convert timestamp counts to time when decoding
+	struct Calibration {
+		std::uint64_t                         ticks = timestamp();
+		std::chrono::steady_clock::time_point time  = std::chrono::steady_clock::now();
+	};
+	inline const Calibration calibration;
+
+	inline double ticksPerNanosecond() {
+#if defined(__x86_64__)
+		auto   ticks   = timestamp() - calibration.ticks;
+		double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - calibration.time).count();
+		return elapsed > 0 ? ticks / elapsed : 1.0;
+#else
+		return 1.0;
+#endif
+	}
+
+	/** A list with operator op is evaluated **/
+	inline void eval(const Atom& op) {
+		if(!enabled.load(std::memory_order_relaxed))
+			return;
+		Event& event = t_events.next();
+		event.time   = timestamp();
+		event.kind   = Kind::Eval;
+		event.depth  = t_depth;
+		if(op.type == Type::Symbol) {
+			auto& symbol = std::get<std::string>(op.value);
+			event.length = std::min(symbol.size(), sizeof(event.text));
+			std::memcpy(event.text, symbol.data(), event.length);
+		} else {
+			event.length = 0;
+		}
+	}
+
+	/** Records the application of a function, & how it was left **/
+	class Call {
+		const void* m_function = nullptr;
+
+		static void record(Kind kind, const void* function, Type type) {
+			Event& event   = t_events.next();
+			event.time     = timestamp();
+			event.kind     = kind;
+			event.type     = std::uint8_t(type);
+			event.depth    = t_depth;
+			event.function = function;
+		}
+
+	  public:
+		explicit Call(const Atom& fn) {
+			if(!enabled.load(std::memory_order_relaxed))
+				return;
+			m_function = functionKey(fn);
+			record(fn.type == Type::Builtin ? Kind::Builtin : Kind::Apply, m_function, fn.type);
+			t_depth++;
+		}
+		Call(const Call&) = delete;
+		Call& operator=(const Call&) = delete;
+
+		/** The function returned result **/
+		void returned(const Atom& result) {
+			if(!m_function)
+				return;
+			t_depth--;
+			record(Kind::Return, m_function, result.type);
+			m_function = nullptr;
+		}
+		~Call() {
+			if(!m_function)
+				return;
+			t_depth--;
+			record(Kind::Unwind, m_function, Type::Nil);
+		}
+	};
+
+	/** Forget the events of the calling thread **/
+	inline void clear() {
+		t_events.clear();
+		t_depth = 0;
+	}
+
+	/**
+	 * Decode the last count events of the calling thread, oldest first, each with the time before the last one
+	 * @param names of the functions, others are printed by address
+	 */
+	inline void dump(std::ostream& os, size_t count, const FunctionNames& names) {
+		size_t size  = t_events.size();
+		size_t first = size - std::min(count, size);
+		if(first == size) {
+			os << "no events recorded\n";
+			return;
+		}
+		double perNanosecond = ticksPerNanosecond();
+		auto   last          = t_events[size - 1].time;
+		auto   name          = [&](const void* function) {
+            auto it = names.find(function);
+            return it != names.end() ? it->second : format("lambda@{}", function);
+		};
+		os << format("{} of {} events, times in us before the last", size - first, t_events.pushed()) << "\n";
+		for(size_t i = first; i < size; i++) {
+			const Event& event = t_events[i];
+			double before = double(last - event.time) / perNanosecond / 1000;
+			os << std::setw(12) << std::fixed << std::setprecision(3) << (before > 0 ? -before : 0.0) << "  "
+			   << std::string(std::min<size_t>(event.depth, 32) * 2, ' ');
+			switch(event.kind) {
+			case Kind::Eval: os << "eval (" << (event.length ? std::string(event.text, event.length) : "...") << " ...)"; break;
+			case Kind::Apply: os << "apply " << name(event.function); break;
+			case Kind::Builtin: os << "builtin " << name(event.function); break;
+			case Kind::Return: os << "return " << name(event.function) << " -> " << toString(Type(event.type)); break;
+			case Kind::Unwind: os << "unwind " << name(event.function); break;
+			}
+			os << "\n";
+		}
+		os.unsetf(std::ios::floatfield);
+	}
+} // namespace trace
+
+#endif //LISP_TRACE_H
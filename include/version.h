@@ -0,0 +1,11 @@
+#ifndef LISP_VERSION_H
+#define LISP_VERSION_H
+
+#include <cstdint>
+
+// bump whenever the meaning of parsed or serialized data changes
+constexpr const char* interpreterVersion = "0.1.0";
+// bump whenever the tokenizer or the parser reads a source differently: 1 ; comments, 2 reader macros
+constexpr std::uint32_t readerVersion = 2;
+
+#endif //LISP_VERSION_H
@@ -0,0 +1,36 @@
+; Standard library, load it with (import library/std.lisp)
+; nil is false and the empty list, every other value is true
+
+; Logic & numbers
+(define not (lambda (x) (if x nil t)))
+(define null? (lambda (x) (if x nil t)))
+(define <= (lambda (a b) (not (< b a))))
+(define abs (lambda (x) (if (< x 0) (- 0 x) x)))
+(define min (lambda (a b) (if (< b a) b a)))
+(define max (lambda (a b) (if (< a b) b a)))
+(define square (lambda (x) (* x x)))
+(define even? (lambda (n) (= n (* (/ n 2) 2))))
+(define odd? (lambda (n) (not (even? n))))
+
+; Lists
+(define length-onto (lambda (l n) (if l (length-onto (cdr l) (+ n 1)) n)))
+(define length (lambda (l) (length-onto l 0)))
+(define reverse-onto (lambda (l acc) (if l (reverse-onto (cdr l) (cons (car l) acc)) acc)))
+(define reverse (lambda (l) (reverse-onto l nil)))
+(define append (lambda (a b) (if a (cons (car a) (append (cdr a) b)) b)))
+(define nth (lambda (l n) (if (= n 0) (car l) (nth (cdr l) (- n 1)))))
+(define last (lambda (l) (if (cdr l) (last (cdr l)) (car l))))
+(define take (lambda (l n) (if (if l (< 0 n) nil) (cons (car l) (take (cdr l) (- n 1))) nil)))
+(define drop (lambda (l n) (if (if l (< 0 n) nil) (drop (cdr l) (- n 1)) l)))
+; the integers from a up to, not including, b
+(define range (lambda (a b) (if (< a b) (cons a (range (+ a 1) b)) nil)))
+
+; Higher order functions
+(define map (lambda (f l) (if l (cons (f (car l)) (map f (cdr l))) nil)))
+(define filter (lambda (p l) (if l (if (p (car l)) (cons (car l) (filter p (cdr l))) (filter p (cdr l))) nil)))
+(define foldl (lambda (f acc l) (if l (foldl f (f acc (car l)) (cdr l)) acc)))
+(define foldr (lambda (f acc l) (if l (f (car l) (foldr f acc (cdr l))) acc)))
+(define any? (lambda (p l) (if l (if (p (car l)) t (any? p (cdr l))) nil)))
+(define all? (lambda (p l) (if l (if (p (car l)) (all? p (cdr l)) nil) t)))
+(define sum (lambda (l) (foldl + 0 l)))
+(define compose (lambda (f g) (lambda (x) (f (g x)))))
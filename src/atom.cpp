@@ -1,9 +1,30 @@
 #include "atom.h"
 //#include "debug.h"
+#include "compact.h"
 #include "environment.h"
+#include "region.h"
 
 Atom::Atom(const Atom& car, const Atom& cdr):
-	value(std::make_shared<Pair>(Pair(car, cdr))), type(Type::Pair) {}
+	value(std::make_shared<Pair>(car, cdr)), type(Type::Pair) {}
+
+Atom Atom::local(const Atom& car, const Atom& cdr) {
+	Atom pair;
+	pair.value = std::allocate_shared<Pair>(region::Allocator<Pair>(), car, cdr);
+	pair.type  = Type::Pair;
+	return pair;
+}
+
+Atom Atom::list(const std::vector<Atom>& items, const Atom& tail) {
+	Atom  result;
+	Atom* last = &result;
+	for(const auto& item: items) {
+		last->value = std::allocate_shared<Pair>(compact::Allocator<Pair>(), item, Atom());
+		last->type  = Type::Pair;
+		last        = &last->cdr();
+	}
+	*last = tail;
+	return result;
+}
 
 #define OPTIONAL(name, atomTypeValue, staticType)  \
 	std::optional<staticType> Atom::name() const { \
@@ -15,6 +36,7 @@ Atom::Atom(const Atom& car, const Atom& cdr):
 OPTIONAL(symbol, Symbol, std::string)
 OPTIONAL(integer, Integer, long)
 OPTIONAL(rational, Rational, double)
+OPTIONAL(string, String, std::string)
 
 #undef OPTIONAL
 
@@ -36,6 +58,36 @@ std::optional<Atom::builtin_t> Atom::builtin() const {
 	return *std::get<builtin_t>(value);
 }
 
+std::optional<std::shared_ptr<Future>> Atom::future() const {
+	if(type != Type::Future)
+		return std::nullopt;
+	return std::get<std::shared_ptr<Future>>(value);
+}
+
+std::optional<std::shared_ptr<Task>> Atom::task() const {
+	if(type != Type::Task)
+		return std::nullopt;
+	return std::get<std::shared_ptr<Task>>(value);
+}
+
+std::optional<std::shared_ptr<Port>> Atom::port() const {
+	if(type != Type::Port)
+		return std::nullopt;
+	return std::get<std::shared_ptr<Port>>(value);
+}
+
+std::optional<std::shared_ptr<Namespace>> Atom::ns() const {
+	if(type != Type::Namespace)
+		return std::nullopt;
+	return std::get<std::shared_ptr<Namespace>>(value);
+}
+
+std::optional<std::shared_ptr<Channel>> Atom::channel() const {
+	if(type != Type::Channel)
+		return std::nullopt;
+	return std::get<std::shared_ptr<Channel>>(value);
+}
+
 Atom& Atom::cdr() {
 	return std::get<std::shared_ptr<Pair>>(value)->cdr;
 }
@@ -50,15 +102,13 @@ Atom& Atom::car() const {
 }
 
 Atom::Atom(std::string symbol):
-	value(symbol), type(Type::Symbol) {
-	symbolTable[symbol];
-}
+	value(std::move(symbol)), type(Type::Symbol) {}
 
 Atom::Atom(Environment& env, Atom& params, Atom& body):
 	type(Type::Closure) {
 
-	if(params.isNil() || body.isNil()) {
-        throw EvalError(params, "Closure parameters and body are nil");
+	if(body.isNil()) {
+        throw EvalError(params, "Closure body is nil");
 	}
 
 	// all parameter names should be symbols
@@ -72,6 +122,7 @@ Atom::Atom(Environment& env, Atom& params, Atom& body):
 	}
 	*this = Atom(env.atom(), Atom(params, body));
 	this->type = Type::Closure;
+	memory::allocated(memory::Kind::Closure, 0);
 }
 
 bool Atom::isProperList() {
@@ -0,0 +1,47 @@
+#include "fiber.h"
+
+#if defined(__x86_64__)
+// System V x86-64 context switch
+// Pushes the callee saved registers & floating point control state onto the current stack,
+// stores the stack pointer in *save (rdi), switches to load (rsi) and pops the same state.
+// The trampoline is where a new fiber starts: it calls r13 with r12 as argument.
+// The section is restored at the end, for the code the compiler emits after the block.
+asm(R"(
+	.pushsection .text
+	.globl lisp_fiber_switch
+	.type lisp_fiber_switch, @function
+lisp_fiber_switch:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size lisp_fiber_switch, .-lisp_fiber_switch
+
+	.globl lisp_fiber_trampoline
+	.type lisp_fiber_trampoline, @function
+lisp_fiber_trampoline:
+	movq %r12, %rdi
+	andq $-16, %rsp
+	callq *%r13
+	ud2
+	.size lisp_fiber_trampoline, .-lisp_fiber_trampoline
+	.popsection
+)");
+#endif
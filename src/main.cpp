@@ -1,55 +1,50 @@
+#include "aot.h"
 #include "atom.h"
+#include "batch.h"
 #include "builtin.h"
+#include "compiler.h"
 #include "environment.h"
 #include "eval.h"
+#include "image.h"
 #include "parser.h"
 #include "ringbuffer.h"
+#include "server.h"
 #include "tokenizer.h"
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <optional>
 
-void interpretFile(const std::string& fileName, Environment& env) {
-	std::ifstream file(fileName, std::ios::binary);
-	std::string   input;
-	if(!file.is_open()) {
-		std::cerr << format("Failed to open file {}.", fileName) << "\n";
-	}
+// events of the flight recorder printed with a runtime error
+constexpr size_t errorTraceEvents = 32;
+
+/** @return whether the file was evaluated without an error **/
+bool interpretFile(const std::string& fileName, Interpreter& interp) {
 	try {
-		file >> input;
-		auto tokens = tokenizer(input);
-
-		//            totalExpectedRightParen += balanced(tokens);
-		// see if we need to add a new line
-		//			if(totalExpectedRightParen) {
-		//				unbalanced = true;
-		//				unbalancedTokens.insert(unbalancedTokens.end(), tokens.begin(), tokens.end());
-		//				continue;
-		//			} else {
-		//                unbalanced = false;
-		//				unbalancedTokens.clear();
-		//			}
-
-		Atom root = expression(tokens);
-
-		//std::cout << root << std::endl;
-		Atom s = eval(root, env);
-		std::cout << s << std::endl;
+		Source source(sourceFromFile(fileName), fileName);
+		Atom   s = interpret(interp, source);
+		interp.scheduler().run(); // let the remaining green threads finish
+		interp.out() << s << "\n";
+		return true;
 	} catch(EnvError& err) {
-		std::cerr << err.what() << "\n";
+		interp.err() << err.what() << "\n";
+		dumpTrace(interp, interp.err(), errorTraceEvents);
 	} catch(ProgramError& err) {
-		std::cerr << err.what() << "\n";
-		staticError(err);
+		staticError(err, interp.err());
 	} catch(EvalError& err) {
-		std::cerr << err.what() << "\n";
-		dynamicError(err);
+		interp.err() << err.what() << "\n";
+		dynamicError(err, interp.err());
+		dumpTrace(interp, interp.err(), errorTraceEvents);
 	} catch(TypeError& err) {
-		std::cerr << err.what() << "\n";
-		//dynamicError(err);
+		interp.err() << err.what() << "\n";
+		//dynamicError(err, interp.err());
+		dumpTrace(interp, interp.err(), errorTraceEvents);
 	}
+	return false;
 }
 
-void repl(const std::string& prompt, const std::string& continuePrompt, Environment& env) {
+void repl(const std::string& prompt, const std::string& continuePrompt, Interpreter& interp) {
 	std::string                 input;
 	RingBuffer<std::string, 50> history;
 	std::vector<Token>          unbalancedTokens;
@@ -69,16 +64,18 @@ void repl(const std::string& prompt, const std::string& continuePrompt, Environm
 
 	for(;;) {
 		if(unbalanced)
-			std::cout << continuePrompt;
+			interp.out() << continuePrompt;
 		else
-			std::cout << prompt;
+			interp.out() << prompt;
+		interp.out().flush(); // output is only flushed before waiting for input
 
-		std::getline(std::cin, input); // read
+		if(!std::getline(interp.in(), input)) // read
+			break;
 		history.push_back(input);
 		if(input == ":history") {
 			const size_t size = history.size();
 			for(int i = 0; i < size; i++) {
-				std::cout << history[i] << "\n";
+				interp.out() << history[i] << "\n";
 			}
 		}
 
@@ -91,7 +88,8 @@ void repl(const std::string& prompt, const std::string& continuePrompt, Environm
 		}
         if(input.size() == 0) continue;
 		try {
-			auto tokens = tokenizer(input);
+			Source source(input);
+			auto   tokens = tokenizer(source);
 
 			//            totalExpectedRightParen += balanced(tokens);
 			// see if we need to add a new line
@@ -104,42 +102,215 @@ void repl(const std::string& prompt, const std::string& continuePrompt, Environm
 			//				unbalancedTokens.clear();
 			//			}
 
-			Atom root = expression(tokens);
+			Atom root = expression(tokens, source);
 
 			//std::cout << root << std::endl;
-			Atom s = eval(root, env);
-			std::cout << s << std::endl;
+			trace::clear(); // an error only shows the events of its input
+			Atom s = evalTopLevel(interp, root, interp.global());
+			interp.scheduler().run();
+			interp.out() << s << "\n";
 		} catch(EnvError& err) {
-			std::cerr << err.what() << "\n";
+			interp.err() << err.what() << "\n";
+			dumpTrace(interp, interp.err(), errorTraceEvents);
 		} catch(ProgramError& err) {
-			std::cerr << err.what() << "\n";
-			staticError(err);
+			staticError(err, interp.err());
 		} catch(EvalError& err) {
-			std::cerr << err.what() << "\n";
-			dynamicError(err);
+			interp.err() << err.what() << "\n";
+			dynamicError(err, interp.err());
+			dumpTrace(interp, interp.err(), errorTraceEvents);
 		} catch(TypeError& err) {
-			std::cerr << err.what() << "\n";
-			//dynamicError(err);
+			interp.err() << err.what() << "\n";
+			//dynamicError(err, interp.err());
+			dumpTrace(interp, interp.err(), errorTraceEvents);
+		}
+	}
+}
+
+/**
+ * Evaluate the scripts listed (a path per line) in listFile, or on stdin for "-", after the prelude
+ * Prints a tab separated line of the script, status, milliseconds & result for every script
+ * @return 0 when every script succeeded
+ */
+int runBatch(const std::string& listFile, const std::string& prelude, const batch::Options& options, Interpreter& interp) {
+	std::vector<std::string> scripts;
+	std::ifstream            file;
+	if(listFile != "-")
+		file.open(listFile);
+	std::istream& list = listFile == "-" ? interp.in() : file;
+	if(!list) {
+		interp.err() << format("Failed to open file {}.", listFile) << "\n";
+		return 1;
+	}
+	for(std::string line; std::getline(list, line);) {
+		if(!line.empty())
+			scripts.push_back(line);
+	}
+	try {
+		if(!prelude.empty())
+			interpret(interp, Source(sourceFromFile(prelude), prelude));
+		auto start   = std::chrono::steady_clock::now();
+		auto results = batch::evaluate(interp, scripts, options);
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		size_t failed = 0;
+		for(auto& result: results) {
+			std::replace(result.text.begin(), result.text.end(), '\n', ' ');
+			interp.out() << result.script << "\t" << batch::toString(result.status) << "\t"
+						 << std::chrono::duration<double, std::milli>(result.duration).count() << "\t" << result.text << "\n";
+			failed += result.status != batch::Status::Ok;
 		}
+		interp.err() << format("{} scripts, {} failed, in {} s ({} scripts/s)", results.size(), failed, elapsed, size_t(results.size() / std::max(elapsed, 1e-9))) << "\n";
+		return failed ? 2 : 0;
+	} catch(ProgramError& err) {
+		staticError(err, interp.err());
+	} catch(RunTimeError& err) {
+		interp.err() << err.what() << "\n";
+	}
+	return 1;
+}
+
+/**
+ * Print the memory statistics, a summary to stderr and/or JSON to a file ("-" for stdout)
+ */
+void printStats(bool summary, const std::string& jsonFile) {
+	auto stats = memory::stats();
+	if(summary)
+		memory::summary(std::cerr, stats);
+	if(jsonFile == "-") {
+		memory::json(std::cout, stats);
+	} else if(!jsonFile.empty()) {
+		std::ofstream file(jsonFile);
+		if(!file.is_open())
+			std::cerr << format("Failed to open file {}.", jsonFile) << "\n";
+		memory::json(file, stats);
 	}
 }
 
 int main(int argv, char** argc) {
-	Environment env(nil, {{"car", builtin::car},
-						  {"cdr", builtin::cdr},
-						  {"cons", builtin::cons},
-						  {"+", builtin::add},
-						  {"-", builtin::sub},
-						  {"*", builtin::mul},
-						  {"/", builtin::div},
-						  {"=", builtin::eq},
-						  {"<", builtin::less},
-						  {"getchar", builtin::getchar},
-						  {"putchar", builtin::putchar}});
-	env.set(Atom("t"), Atom("t"));
-	if(argv == 2) {
-		interpretFile(argc[1], env);
-	} else {
-		repl(">> ", ".. ", env);
+	std::string     image, savedImage, fileName, socket, batchList, profile, statsJson, output;
+	bool            stats = false, compile = false, emitCpp = false;
+	Server::Options serverOptions;
+	batch::Options  batchOptions;
+	for(int i = 1; i < argv; i++) {
+		std::string arg = argc[i];
+		if(arg == "--image" && i + 1 < argv) {
+			image = argc[++i];
+		} else if(arg == "--save-image" && i + 1 < argv) {
+			savedImage = argc[++i];
+		} else if(arg == "--serve" && i + 1 < argv) {
+			socket = argc[++i];
+		} else if(arg == "--batch" && i + 1 < argv) {
+			batchList = argc[++i];
+		} else if(arg == "--profile" && i + 1 < argv) {
+			profile = argc[++i];
+		} else if(arg == "--compile") {
+			compile = true;
+		} else if(arg == "--emit-cpp") {
+			emitCpp = true;
+		} else if(arg == "-o" && i + 1 < argv) {
+			output = argc[++i];
+		} else if(arg == "--stats") {
+			stats = true;
+		} else if(arg == "--stats-json" && i + 1 < argv) {
+			statsJson = argc[++i];
+		} else if(arg == "--workers" && i + 1 < argv) {
+			serverOptions.workers = batchOptions.workers = std::max(1, std::atoi(argc[++i]));
+		} else if(arg == "--timeout" && i + 1 < argv) {
+			serverOptions.timeout = std::chrono::milliseconds(std::atol(argc[++i]));
+			batchOptions.timeout  = serverOptions.timeout;
+		} else {
+			fileName = arg;
+		}
+	}
+
+	// the file translated to C++ on stdout or into the output file
+	if(emitCpp) {
+		try {
+			std::string cpp = aot::translate(Source(sourceFromFile(fileName), fileName));
+			if(output.empty()) {
+				std::cout << cpp;
+				return 0;
+			}
+			std::ofstream file(output);
+			if(!file.is_open()) {
+				std::cerr << format("Failed to open file {}.", output) << "\n";
+				return 1;
+			}
+			file << cpp;
+			return 0;
+		} catch(ProgramError& err) {
+			staticError(err);
+			return 1;
+		}
+	}
+
+	if(!socket.empty()) {
+		// every worker starts from the image and the file, if given
+		serverOptions.prepare = [&](Interpreter& interp) {
+			if(!image.empty())
+				loadImage(image, interp);
+			if(compile)
+				interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins()));
+			if(!fileName.empty())
+				interpret(interp, Source(sourceFromFile(fileName), fileName));
+		};
+		try {
+			Server server(socket, builtin::table(), serverOptions);
+			server.start();
+			std::cerr << format("Serving on {} with {} workers", socket, serverOptions.workers) << "\n";
+			server.run();
+		} catch(std::exception& err) {
+			std::cerr << err.what() << "\n";
+			return 1;
+		} catch(SerializeError& err) {
+			std::cerr << err.what() << "\n";
+			return 1;
+		} catch(ProgramError& err) {
+			staticError(err);
+			return 1;
+		} catch(RunTimeError& err) {
+			std::cerr << err.what() << "\n";
+			return 1;
+		}
+		return 0;
 	}
-}
\ No newline at end of file
+
+	try {
+		Interpreter interp(builtin::table());
+		if(!image.empty())
+			loadImage(image, interp);
+		// closures are compiled to trees of specialized nodes instead of being tree walked, hot ones to native code
+		if(compile)
+			interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins()));
+		if(!batchList.empty()) {
+			int status = runBatch(batchList, fileName, batchOptions, interp);
+			printStats(stats, statsJson);
+			return status;
+		}
+		// measures the file or the session, the collapsed stacks are written to the profile file
+		std::optional<Profiler> profiler;
+		if(!profile.empty()) {
+			profiler.emplace();
+			profiler->start();
+			interp.setProfiler(&*profiler);
+		}
+		bool failed = !fileName.empty() && !interpretFile(fileName, interp);
+		if(!savedImage.empty())
+			saveImage(savedImage, interp);
+		else if(fileName.empty())
+			repl(">> ", ".. ", interp);
+		if(profiler) {
+			interp.setProfiler(nullptr);
+			profiler->stop();
+			reportProfile(interp, *profiler, profile);
+		}
+		printStats(stats, statsJson);
+		return failed ? 1 : 0;
+	} catch(SerializeError& err) {
+		std::cerr << err.what() << "\n";
+		return 1;
+	} catch(EvalError& err) {
+		std::cerr << err.what() << "\n";
+		return 1;
+	}
+}
@@ -0,0 +1,15 @@
+# Runs a program with the interpreter and as translated to C++ (add_lisp_executable),
+# both have to succeed and print the same
+#   cmake -DLISP=<lisp> -DTRANSLATED=<binary> -DPROGRAM=<file.lisp> -P aot.cmake
+execute_process(COMMAND ${LISP} ${PROGRAM} OUTPUT_VARIABLE expected ERROR_VARIABLE errors)
+if(NOT errors STREQUAL "")
+	message(FATAL_ERROR "lisp ${PROGRAM} failed:\n${errors}")
+endif()
+execute_process(COMMAND ${TRANSLATED} OUTPUT_VARIABLE actual ERROR_VARIABLE errors RESULT_VARIABLE status)
+if(NOT status EQUAL 0 OR NOT errors STREQUAL "")
+	message(FATAL_ERROR "${TRANSLATED} failed (${status}):\n${errors}")
+endif()
+if(NOT actual STREQUAL expected)
+	message(FATAL_ERROR "${TRANSLATED} printed\n${actual}the interpreter printed\n${expected}")
+endif()
+message(STATUS "${PROGRAM}: ${actual}")
@@ -0,0 +1,22 @@
+; translated to C++ by the aot test, the binary has to print what the interpreter prints
+(import library/std.lisp)
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(define make-adder (lambda (n) (lambda (x) (+ x n))))
+; a define in a lambda binds in its frame, the tree walker evaluates this one
+(define counter (lambda (n) ((lambda (ignored) (+ total n)) (define total (* n 2)))))
+(define half (lambda (x) (/ x 2.0)))
+; expanded while translating, a template built at run time is left to the tree walker
+(defmacro unless (c body) `(if ,c nil ,body))
+(define positive (lambda (n) (unless (< n 1) n)))
+; a parameter shadows the macro of its name
+(define shadowed (lambda (unless) (unless 5)))
+(define tagged (lambda (n) `(n ,n ,@(range 0 n))))
+(define describe (lambda (l) (cons (quote (items of)) (cons (length l) (cons "a \"text\"" nil)))))
+(cons (fib 15)
+  (cons ((make-adder 3) 4)
+    (cons (counter 5)
+      (cons (half 3)
+        (cons (describe (range 0 4))
+          (cons (preduce + 0 (pmap (make-adder 1) (range 0 10)))
+            (cons (sum (map square (range 0 5))) (cons ((compose half square) 3)
+              (cons (positive 4) (cons (positive 0) (cons (tagged 2) (cons (shadowed (lambda (y) y)) nil))))))))))))
@@ -1,11 +1,143 @@
+#include "builtin.h"
+#include "channel.h"
+#include "compiler.h"
+#include "fiber.h"
+#include "namespace.h"
+#include "parser.h"
+#include "port.h"
 #include "tokenizer.h"
 
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
 #include <benchmark/benchmark.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Benchmarks of every stage, run with --benchmark_format=json (or the bench_json target) to
+ * track trends. Benchmarks which allocate report the heap allocations per iteration, counted
+ * by the replaced global operator new, and every benchmark reports the hardware counters of its
+ * loop per iteration where the kernel offers them (the perf_events context entry tells).
+ */
+static std::atomic<size_t> allocations = 0;
+
+void* operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if(void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// counts the allocations of the timed loop of a benchmark
+class AllocationCounter {
+	benchmark::State& m_state;
+	size_t            m_start;
+
+  public:
+	explicit AllocationCounter(benchmark::State& state):
+		m_state(state), m_start(allocations.load(std::memory_order_relaxed)) {}
+	~AllocationCounter() {
+		m_state.counters["allocs/iter"] = benchmark::Counter(double(allocations.load(std::memory_order_relaxed) - m_start), benchmark::Counter::kAvgIterations);
+	}
+};
+/**
+ * Hardware counters of the calling thread, read with perf_event_open around the timed loop
+ * The counters are one group, so they count the same instructions, scaled when the kernel had to
+ * multiplex them. Counters the CPU, the kernel or the container does not offer are left out,
+ * without any the benchmark only reports its time. Paused timing is counted too.
+ */
+class PerfCounters {
+	struct Event {
+		const char*   name;
+		std::uint32_t type;
+		std::uint64_t config;
+	};
+	static constexpr Event events[] = {
+		{"cycles/iter", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{"instructions/iter", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{"L1d-misses/iter", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+		{"LLC-misses/iter", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		{"branch-misses/iter", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+	benchmark::State&        m_state;
+	std::vector<int>         m_fds; // the first is the group leader
+	std::vector<const char*> m_names;
+
+	static int open(const Event& event, int group) {
+		perf_event_attr attr {};
+		attr.size           = sizeof(attr);
+		attr.type           = event.type;
+		attr.config         = event.config;
+		attr.disabled       = group < 0; // members follow the leader
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return int(::syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+	}
+
+  public:
+	explicit PerfCounters(benchmark::State& state):
+		m_state(state) {
+		for(auto& event: events) {
+			int fd = open(event, m_fds.empty() ? -1 : m_fds.front());
+			if(fd < 0)
+				continue;
+			m_fds.push_back(fd);
+			m_names.push_back(event.name);
+		}
+		if(m_fds.empty())
+			return;
+		::ioctl(m_fds.front(), PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		::ioctl(m_fds.front(), PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+	~PerfCounters() {
+		if(m_fds.empty())
+			return;
+		::ioctl(m_fds.front(), PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		// count, time enabled, time running, a value per counter
+		std::vector<std::uint64_t> values(3 + m_fds.size());
+		if(::read(m_fds.front(), values.data(), values.size() * sizeof(std::uint64_t)) > 0 && values[2] > 0) {
+			double scale = double(values[1]) / double(values[2]);
+			for(size_t i = 0; i < m_names.size(); i++)
+				m_state.counters[m_names[i]] = benchmark::Counter(double(values[3 + i]) * scale, benchmark::Counter::kAvgIterations);
+		}
+		for(int fd: m_fds)
+			::close(fd);
+	}
+
+	/** Which counters can be read, or why none **/
+	static std::string available() {
+		std::string names;
+		for(auto& event: events) {
+			int fd = open(event, -1);
+			if(fd < 0)
+				continue;
+			::close(fd);
+			names += (names.empty() ? "" : ", ") + std::string(event.name, std::strchr(event.name, '/'));
+		}
+		if(names.empty())
+			return format("unavailable ({}), wall time only", std::strerror(errno));
+		return names;
+	}
+};
+
 std::string input = "(+ 3 (3 5 2 (* 5 (- 6 2))))";
 
 class Tokenizer {
 	size_t                      line = 0, column = 0;
-	std::string::const_iterator current;
+	std::string::const_iterator begin, current;
 	auto                        is_end() { return *current == '\0' || *current == EOF; };
 	auto                        peek(size_t n = 1) { return (*current + 1); };
 	auto                        advance() {
@@ -21,19 +153,19 @@ class Tokenizer {
 			while(isdigit(peek()))
 				advance();
 		}
-		return Token{TokenType::NUMBER, std::string(start, current), line, column};
+		return Token{TokenType::NUMBER, std::uint32_t(start - begin), std::uint32_t(current - start)};
 	};
 	auto identifier() -> Token {
 		auto start = current;
 		while(isalpha(peek()) || isdigit(peek()))
 			advance();
-		return Token{TokenType::IDENTIFIER, std::string(start, current), line, column};
+		return Token{TokenType::IDENTIFIER, std::uint32_t(start - begin), std::uint32_t(current - start)};
 	};
 
   public:
 	std::deque<Token> tokenizer(const std::string& input) {
 		std::deque<Token> tokens;
-		current = input.begin();
+		begin = current = input.begin();
 
 		while(!is_end()) {
 			if(isdigit(*current))
@@ -49,10 +181,10 @@ class Tokenizer {
 				column = 0;
 				break;
 			case '(':
-				tokens.push_front(Token{TokenType::LEFT_PAREN, "(", line, column});
+				tokens.push_front(Token{TokenType::LEFT_PAREN, std::uint32_t(current - begin), 1});
 				break;
 			case ')':
-				tokens.push_front(Token{TokenType::RIGHT_PAREN, ")", line, column});
+				tokens.push_front(Token{TokenType::RIGHT_PAREN, std::uint32_t(current - begin), 1});
 				break;
 			default:
 				break;
@@ -64,19 +196,261 @@ class Tokenizer {
 };
 
 static void BM_class_tokenizer(benchmark::State& state) {
-	Tokenizer tokenizer;
+	Tokenizer    tokenizer;
+	PerfCounters perf(state);
 	for(auto _: state) {
 		tokenizer.tokenizer(input);
 	}
 }
 
 static void BM_lambda_tokenizer(benchmark::State& state) {
+	Source       source(input);
+	PerfCounters perf(state);
+	for(auto _: state) {
+		tokenizer(source);
+	}
+}
+
+// a round trip into a fiber & back, two context switches
+static void BM_fiber_switch(benchmark::State& state) {
+	Fiber* self  = nullptr;
+	bool   stop  = false;
+	Fiber  fiber([&]() {
+        while(!stop)
+            self->suspend();
+	 },
+				 FiberStack(FiberStack::defaultSize));
+	self = &fiber;
+	PerfCounters perf(state);
+	for(auto _: state) {
+		fiber.resume();
+	}
+	stop = true;
+	fiber.resume();
+	state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// message rate from a producer thread to the benchmark thread, make(i) creates the i'th message
+template<typename Queue, typename Make>
+static void queueThroughput(benchmark::State& state, Queue& queue, Make make) {
+	std::atomic<bool> stop = false;
+	std::thread       producer([&]() {
+        for(long i = 0; !stop.load(std::memory_order_relaxed); i++) {
+            auto message = make(i);
+            while(!queue.tryPush(std::move(message)) && !stop.load(std::memory_order_relaxed))
+                std::this_thread::yield();
+        }
+	});
+	{
+		PerfCounters perf(state);
+		for(auto _: state) {
+			while(!queue.tryPop())
+				std::this_thread::yield();
+		}
+	}
+	stop = true;
+	producer.join();
+	state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_spsc_queue(benchmark::State& state) {
+	auto queue = std::make_unique<SPSCQueue<long, 1024>>();
+	queueThroughput(state, *queue, [](long i) { return i; });
+}
+
+static void BM_mpmc_queue(benchmark::State& state) {
+	auto queue = std::make_unique<MPMCQueue<long, 1024>>();
+	queueThroughput(state, *queue, [](long i) { return i; });
+}
+
+// what send & receive do, a list of 3 deep copied per message
+static void BM_channel(benchmark::State& state) {
+	auto channel = std::make_shared<Channel>();
+	Atom message(Atom(1L), Atom(Atom(2L), Atom(Atom(3L), nil)));
+	queueThroughput(state, channel->queue, [&](long) { return deepCopy(message); });
+}
+
+// bulk output & line input through ports, 16 MiB of 64 byte lines per iteration
+static const std::string portFile = "/tmp/lisp-bench-port.txt";
+static const std::string portLine = std::string(63, 'x') + "\n";
+static constexpr size_t  portLines = 256 * 1024;
+
+static void BM_port_write(benchmark::State& state) {
+	PerfCounters perf(state);
+	for(auto _: state) {
+		Port out(portFile, Port::Mode::Output);
+		for(size_t i = 0; i < portLines; i++)
+			out.write(portLine);
+		out.close();
+	}
+	state.SetBytesProcessed(state.iterations() * portLines * portLine.size());
+}
+
+static void BM_port_read_line(benchmark::State& state) {
+	{
+		Port out(portFile, Port::Mode::Output);
+		for(size_t i = 0; i < portLines; i++)
+			out.write(portLine);
+	}
+	PerfCounters perf(state);
+	for(auto _: state) {
+		Port in(portFile, Port::Mode::Input);
+		while(auto line = in.readLine())
+			benchmark::DoNotOptimize(line);
+	}
+	state.SetBytesProcessed(state.iterations() * portLines * portLine.size());
+}
+
+// lookups in a namespace of 1000 bindings, from several threads at once
+static void BM_namespace_lookup(benchmark::State& state) {
+	static Namespace ns;
+	if(state.thread_index() == 0 && ns.size() == 0) {
+		for(long i = 0; i < 1000; i++)
+			ns.define(std::to_string(i), Atom(i));
+	}
+	std::string  name = std::to_string(state.thread_index() * 7);
+	PerfCounters perf(state);
+	for(auto _: state) {
+		benchmark::DoNotOptimize(ns.lookup(name));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+/** Tokenizer & parser **/
+// top level forms of nested arithmetic, symbols & literals, roughly size bytes
+static std::string generateSource(size_t size) {
+	static const char* forms[] = {
+		"(define square (lambda (x) (* x x)))\n",
+		"(+ 3 (- 12 4) (* 5 (/ 6.25 2)) (square 42))\n",
+		"(if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))\n",
+		"(cons \"a string\" (cons (quote symbol) nil))\n"};
+	std::string source;
+	source.reserve(size + 64);
+	for(size_t i = 0; source.size() < size; i++)
+		source += forms[i % std::size(forms)];
+	return source;
+}
+
+static void BM_tokenizer(benchmark::State& state) {
+	Source source(generateSource(state.range(0)));
+	AllocationCounter counter(state);
+	PerfCounters      perf(state);
+	for(auto _: state) {
+		benchmark::DoNotOptimize(tokenizer(source));
+	}
+	state.SetBytesProcessed(state.iterations() * source.text().size());
+}
+
+static void BM_parser(benchmark::State& state) {
+	Source source(generateSource(state.range(0)));
+	auto   tokens = tokenizer(source);
+	AllocationCounter counter(state);
+	PerfCounters      perf(state);
 	for(auto _: state) {
-		tokenizer(input);
+		state.PauseTiming();
+		auto copy = tokens;
+		state.ResumeTiming();
+		benchmark::DoNotOptimize(program(copy, source));
 	}
+	state.SetBytesProcessed(state.iterations() * source.text().size());
 }
 
+/** Environment **/
+// a global looked up from the innermost of depth frames, the local frames bind size other symbols each
+static void BM_environment_get(benchmark::State& state) {
+	size_t                   size = state.range(0), depth = state.range(1);
+	std::vector<Environment> frames;
+	frames.push_back(Environment::global({}));
+	for(size_t d = 1; d < depth; d++)
+		frames.emplace_back(frames.back().atom());
+	for(size_t d = 0; d < depth; d++) {
+		for(size_t i = 0; i < size; i++)
+			frames[d].set(Atom(format("local{}_{}", d, i)), Atom(long(i)));
+	}
+	frames.front().set(Atom("global"), Atom(1L));
+	Atom              symbol("global");
+	AllocationCounter counter(state);
+	PerfCounters      perf(state);
+	for(auto _: state) {
+		benchmark::DoNotOptimize(frames.back().get(symbol));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+/** Interpreter kernels **/
+static const char* kernelDefinitions =
+	"(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+	"(define tak (lambda (x y z) (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z)))"
+	"(define ack (lambda (m n) (if (= m 0) (+ n 1) (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1)))))))"
+	"(define abs (lambda (x) (if (< x 0) (- 0 x) x)))"
+	"(define safe? (lambda (row dist placed) (if placed (if (= (car placed) row) nil (if (= (abs (- (car placed) row)) dist) nil (safe? row (+ dist 1) (cdr placed)))) t)))"
+	"(define queens (lambda (n k placed) (if (= k n) 1 (try-rows n k placed 1))))"
+	"(define try-rows (lambda (n k placed row) (if (< n row) 0 (+ (if (safe? row 1 placed) (queens n (+ k 1) (cons row placed)) 0) (try-rows n k placed (+ row 1))))))"
+	"(define build (lambda (n acc) (if (< n 1) acc (build (- n 1) (cons n acc)))))"
+	"(define reverse (lambda (l acc) (if l (reverse (cdr l) (cons (car l) acc)) acc)))"
+	"(define make-adder (lambda (n) (lambda (x) (+ x n))))"
+	"(define sum-adders (lambda (i acc) (if (< i 1) acc (sum-adders (- i 1) ((make-adder i) acc)))))"
+	"(define harmonic (lambda (i acc) (if (< i 1) acc (harmonic (- i 1) (+ acc (/ 1.0 i))))))";
+
+// the evaluator a kernel runs on: tree walked, node trees or node trees & native code
+enum class Tier { Tree, Nodes, Native };
+
+static void kernel(benchmark::State& state, const char* expression, Tier tier) {
+	std::stringstream in, out;
+	Interpreter       interp(builtin::table(), in, out, out);
+	if(tier != Tier::Tree)
+		interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins(), tier == Tier::Native));
+	interpret(interp, Source(kernelDefinitions));
+	Source source(expression);
+	auto   tokens = tokenizer(source);
+	Atom   parsed = program(tokens, source);
+	AllocationCounter counter(state);
+	PerfCounters      perf(state);
+	for(auto _: state) {
+		benchmark::DoNotOptimize(evalProgram(interp, parsed, interp.global()));
+	}
+}
+
+BENCHMARK_CAPTURE(kernel, fib, "(fib 18)", Tier::Tree);
+BENCHMARK_CAPTURE(kernel, tak, "(tak 12 8 4)", Tier::Tree);
+BENCHMARK_CAPTURE(kernel, ackermann, "(ack 2 9)", Tier::Tree);
+BENCHMARK_CAPTURE(kernel, nqueens, "(queens 6 0 nil)", Tier::Tree);
+BENCHMARK_CAPTURE(kernel, list_reverse, "(reverse (build 1000 nil) nil)", Tier::Tree);
+BENCHMARK_CAPTURE(kernel, make_adder, "(sum-adders 1000 0)", Tier::Tree);
+BENCHMARK_CAPTURE(kernel, harmonic, "(harmonic 1000 0.0)", Tier::Tree);
+// the same kernels compiled to node trees (--compile)
+BENCHMARK_CAPTURE(kernel, fib_compiled, "(fib 18)", Tier::Nodes);
+BENCHMARK_CAPTURE(kernel, tak_compiled, "(tak 12 8 4)", Tier::Nodes);
+BENCHMARK_CAPTURE(kernel, ackermann_compiled, "(ack 2 9)", Tier::Nodes);
+BENCHMARK_CAPTURE(kernel, nqueens_compiled, "(queens 6 0 nil)", Tier::Nodes);
+BENCHMARK_CAPTURE(kernel, list_reverse_compiled, "(reverse (build 1000 nil) nil)", Tier::Nodes);
+BENCHMARK_CAPTURE(kernel, make_adder_compiled, "(sum-adders 1000 0)", Tier::Nodes);
+BENCHMARK_CAPTURE(kernel, harmonic_compiled, "(harmonic 1000 0.0)", Tier::Nodes);
+// the integer kernels in native code once hot
+BENCHMARK_CAPTURE(kernel, fib_native, "(fib 18)", Tier::Native);
+BENCHMARK_CAPTURE(kernel, tak_native, "(tak 12 8 4)", Tier::Native);
+BENCHMARK_CAPTURE(kernel, ackermann_native, "(ack 2 9)", Tier::Native);
+
+BENCHMARK(BM_tokenizer)->RangeMultiplier(10)->Range(1 << 10, 100 << 20)->Unit(benchmark::kMillisecond);
+// parsing builds the whole tree, 100 MB of source would need several GB
+BENCHMARK(BM_parser)->RangeMultiplier(10)->Range(1 << 10, 10 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_environment_get)->ArgsProduct({{1, 16, 256}, {1, 4, 16}});
 BENCHMARK(BM_lambda_tokenizer);
 BENCHMARK(BM_class_tokenizer);
+BENCHMARK(BM_fiber_switch);
+BENCHMARK(BM_spsc_queue);
+BENCHMARK(BM_mpmc_queue);
+BENCHMARK(BM_channel);
+BENCHMARK(BM_port_write);
+BENCHMARK(BM_port_read_line);
+BENCHMARK(BM_namespace_lookup)->ThreadRange(1, 8);
 
-BENCHMARK_MAIN();
+int main(int argc, char** argv) {
+	benchmark::Initialize(&argc, argv);
+	if(benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::AddCustomContext("perf_events", PerfCounters::available());
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
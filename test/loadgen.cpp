@@ -0,0 +1,106 @@
+/**
+ * Load generator for the evaluation server (lisp --serve <socket>)
+ *   loadgen <socket> [--requests n] [--connections c] [--depth d] [--timeout ms] [--expr source]
+ * Every connection keeps up to depth requests in flight (pipelining) until n requests were
+ * answered in total, then the throughput & the latency distribution are printed.
+ */
+#include "server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+	std::vector<double> latencies; // in microseconds
+	size_t              errors = 0, timeouts = 0;
+};
+
+Result drive(const std::string& path, size_t requests, size_t depth, std::uint32_t timeout, const std::string& expr) {
+	ServerClient                                    client(path);
+	Result                                          result;
+	std::unordered_map<std::uint32_t, Clock::time_point> sent;
+	std::uint32_t                                   next = 0;
+	size_t                                          done = 0;
+	result.latencies.reserve(requests);
+	while(done < requests) {
+		std::vector<protocol::Request> batch;
+		while(sent.size() + batch.size() < depth && next < requests) {
+			sent.emplace(next, Clock::now());
+			batch.push_back({next++, timeout, expr});
+		}
+		if(!batch.empty())
+			client.send(batch);
+		for(auto& response: client.receive()) {
+			auto it = sent.find(response.id);
+			if(it == sent.end())
+				continue;
+			result.latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - it->second).count());
+			sent.erase(it);
+			done++;
+			if(response.status == protocol::Status::Error)
+				result.errors++;
+			else if(response.status == protocol::Status::Timeout)
+				result.timeouts++;
+		}
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	if(argc < 2) {
+		std::cerr << "usage: loadgen <socket> [--requests n] [--connections c] [--depth d] [--timeout ms] [--expr source]\n";
+		return 1;
+	}
+	std::string   path = argv[1], expr = "(+ 1 2)";
+	size_t        requests = 100000, connections = 1, depth = 16;
+	std::uint32_t timeout = 0;
+	for(int i = 2; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+		if(arg == "--requests")
+			requests = std::stoul(argv[i + 1]);
+		else if(arg == "--connections")
+			connections = std::max<size_t>(1, std::stoul(argv[i + 1]));
+		else if(arg == "--depth")
+			depth = std::max<size_t>(1, std::stoul(argv[i + 1]));
+		else if(arg == "--timeout")
+			timeout = std::stoul(argv[i + 1]);
+		else if(arg == "--expr")
+			expr = argv[i + 1];
+	}
+
+	std::vector<Result>      results(connections);
+	std::vector<std::thread> threads;
+	auto                     start = Clock::now();
+	try {
+		for(size_t c = 0; c < connections; c++) {
+			size_t share = requests / connections + (c < requests % connections ? 1 : 0);
+			threads.emplace_back([&, c, share] { results[c] = drive(path, share, depth, timeout, expr); });
+		}
+		for(auto& thread: threads)
+			thread.join();
+	} catch(std::exception& err) {
+		std::cerr << err.what() << "\n";
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Result total;
+	for(auto& result: results) {
+		total.latencies.insert(total.latencies.end(), result.latencies.begin(), result.latencies.end());
+		total.errors += result.errors;
+		total.timeouts += result.timeouts;
+	}
+	std::sort(total.latencies.begin(), total.latencies.end());
+	auto percentile = [&](double p) {
+		return total.latencies.empty() ? 0.0 : total.latencies[std::min(total.latencies.size() - 1, size_t(p * total.latencies.size()))];
+	};
+	std::cout << format("{} requests over {} connection(s), depth {}: {} requests/s\n", total.latencies.size(), connections, depth, size_t(total.latencies.size() / seconds));
+	std::cout << format("latency us: p50 {} p90 {} p99 {} max {}\n", percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0));
+	std::cout << format("errors {} timeouts {}\n", total.errors, total.timeouts);
+	return total.errors || total.timeouts ? 2 : 0;
+}
@@ -0,0 +1,7 @@
+; creating & applying closures, every adder captures its own environment
+(import library/std.lisp)
+(define make-adder (lambda (n) (lambda (x) (+ x n))))
+(define sum-adders (lambda (i acc) (if (< i 1) acc (sum-adders (- i 1) ((make-adder i) acc)))))
+(define twice (lambda (f) (compose f f)))
+(define repeat (lambda (i acc) (if (< i 1) acc (repeat (- i 1) (+ acc (sum-adders 500 ((twice (make-adder 1)) 0)))))))
+(repeat 5 0)
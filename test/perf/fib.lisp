@@ -0,0 +1,3 @@
+; doubly recursive calls & integer arithmetic
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 16)
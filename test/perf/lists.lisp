@@ -0,0 +1,7 @@
+; allocation heavy list processing with the higher order functions of the standard library
+(import library/std.lisp)
+(define numbers (range 0 500))
+(define round (lambda (i acc)
+  (if (< i 1) acc
+      (round (- i 1) (+ acc (sum (filter even? (map square (reverse numbers)))))))))
+(round 2 0)
@@ -0,0 +1,12 @@
+; backtracking search over lists, the number of solutions of 5 queens
+(import library/std.lisp)
+(define safe? (lambda (row dist placed)
+  (if placed
+      (if (= (car placed) row) nil
+          (if (= (abs (- (car placed) row)) dist) nil (safe? row (+ dist 1) (cdr placed))))
+      t)))
+(define queens (lambda (n k placed) (if (= k n) 1 (try-rows n k placed 1))))
+(define try-rows (lambda (n k placed row)
+  (if (< n row) 0
+      (+ (if (safe? row 1 placed) (queens n (+ k 1) (cons row placed)) 0) (try-rows n k placed (+ row 1))))))
+(queens 5 0 nil)
@@ -0,0 +1,10 @@
+; green threads passing messages through a channel
+(define producer (lambda (channel n)
+  (if (< n 1) (send channel nil) ((lambda (sent) (producer channel (- n 1))) (send channel n)))))
+(define consumer (lambda (channel acc)
+  ((lambda (message) (if message (consumer channel (+ acc message)) acc)) (receive channel))))
+(define pipeline (lambda (channel n)
+  ((lambda (producing) (join (spawn (lambda () (consumer channel 0)))))
+   (spawn (lambda () (producer channel n))))))
+(define rounds (lambda (i acc) (if (< i 1) acc (rounds (- i 1) (+ acc (pipeline (make-channel) 400))))))
+(rounds 3 0)
@@ -0,0 +1,225 @@
+/**
+ * Performance gate over a corpus of lisp programs (test/perf)
+ *   perfgate --lisp <binary> --baseline <json> [--runs n] [--time-threshold f] [--rss-threshold f]
+ *            [--build name] [--update] programs...
+ * Every program is run n times, its median wall time & median peak RSS are compared with the
+ * baseline: the gate fails when either exceeds the baseline by more than its threshold (0.3 is
+ * 30% slower), or when a program fails or prints something else than when the baseline was
+ * recorded. --update records a new baseline instead. A baseline holds the numbers of one build
+ * type, for another build the gate is skipped (exit code 77).
+ */
+#include "format.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr int skipped = 77; // CTest's SKIP_RETURN_CODE
+
+struct Measurement {
+	double      milliseconds = 0;
+	long        rssKilobytes = 0;
+	std::string output;
+};
+
+struct Run {
+	bool        ok;
+	double      milliseconds;
+	long        rssKilobytes;
+	std::string output, errors;
+};
+
+std::string readAll(int fd) {
+	std::string text;
+	char        buf[4096];
+	::lseek(fd, 0, SEEK_SET);
+	for(ssize_t n; (n = ::read(fd, buf, sizeof(buf))) > 0;)
+		text.append(buf, n);
+	return text;
+}
+
+// a run of the lisp binary on program, its output captured in temporary files
+Run run(const std::string& lisp, const std::string& program) {
+	FILE* out = std::tmpfile();
+	FILE* err = std::tmpfile();
+	auto  start = std::chrono::steady_clock::now();
+	pid_t pid   = ::fork();
+	if(pid == 0) {
+		::dup2(::fileno(out), STDOUT_FILENO);
+		::dup2(::fileno(err), STDERR_FILENO);
+		int null = ::open("/dev/null", O_RDONLY);
+		::dup2(null, STDIN_FILENO);
+		::execl(lisp.c_str(), lisp.c_str(), program.c_str(), nullptr);
+		::_exit(127);
+	}
+	int     status = 0;
+	rusage  usage {};
+	while(::wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	Run    result {WIFEXITED(status) && WEXITSTATUS(status) == 0, milliseconds, usage.ru_maxrss, readAll(::fileno(out)), readAll(::fileno(err))};
+	std::fclose(out);
+	std::fclose(err);
+	// the interpreter reports errors on stderr without failing
+	result.ok = result.ok && result.errors.empty();
+	return result;
+}
+
+template<typename T>
+T median(std::vector<T> values) {
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+std::string escape(const std::string& text) {
+	std::string escaped;
+	for(char c: text) {
+		if(c == '"' || c == '\\')
+			escaped += '\\';
+		if(c == '\n')
+			escaped += "\\n";
+		else
+			escaped += c;
+	}
+	return escaped;
+}
+
+std::string unescape(const std::string& text) {
+	std::string plain;
+	for(size_t i = 0; i < text.size(); i++) {
+		if(text[i] == '\\' && i + 1 < text.size())
+			plain += text[++i] == 'n' ? '\n' : text[i];
+		else
+			plain += text[i];
+	}
+	return plain;
+}
+
+// the baseline as written by write(), not a general JSON parser
+bool read(const std::string& path, std::string& build, std::map<std::string, Measurement>& programs) {
+	std::ifstream file(path);
+	if(!file.is_open())
+		return false;
+	std::stringstream text;
+	text << file.rdbuf();
+	std::string json = text.str();
+	std::smatch match;
+	if(std::regex_search(json, match, std::regex(R"re("build":\s*"([^"]*)")re")))
+		build = match[1];
+	std::regex entry(R"re("([^"]+)":\s*\{\s*"median_ms":\s*([0-9.eE+-]+),\s*"peak_rss_kb":\s*([0-9]+),\s*"output":\s*"((?:[^"\\]|\\.)*)"\s*\})re");
+	for(auto it = std::sregex_iterator(json.begin(), json.end(), entry); it != std::sregex_iterator(); ++it)
+		programs[(*it)[1]] = {std::stod((*it)[2]), std::stol((*it)[3]), unescape((*it)[4])};
+	return true;
+}
+
+void write(const std::string& path, const std::string& build, const std::map<std::string, Measurement>& programs) {
+	std::ofstream file(path);
+	file << "{\n  \"build\": \"" << build << "\",\n  \"programs\": {\n";
+	size_t i = 0;
+	for(auto& [name, measurement]: programs) {
+		file << "    \"" << name << "\": {\"median_ms\": " << std::fixed << std::setprecision(1) << measurement.milliseconds
+			 << ", \"peak_rss_kb\": " << measurement.rssKilobytes << ", \"output\": \"" << escape(measurement.output) << "\"}"
+			 << (++i < programs.size() ? "," : "") << "\n";
+	}
+	file << "  }\n}\n";
+}
+
+int main(int argc, char** argv) {
+	std::string              lisp, baselinePath, build = "default";
+	size_t                   runs          = 3;
+	double                   timeThreshold = 0.3, rssThreshold = 0.2;
+	bool                     update        = false;
+	std::vector<std::string> programs;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "--lisp" && i + 1 < argc)
+			lisp = argv[++i];
+		else if(arg == "--baseline" && i + 1 < argc)
+			baselinePath = argv[++i];
+		else if(arg == "--runs" && i + 1 < argc)
+			runs = std::max(1, std::atoi(argv[++i]));
+		else if(arg == "--time-threshold" && i + 1 < argc)
+			timeThreshold = std::atof(argv[++i]);
+		else if(arg == "--rss-threshold" && i + 1 < argc)
+			rssThreshold = std::atof(argv[++i]);
+		else if(arg == "--build" && i + 1 < argc)
+			build = argv[++i];
+		else if(arg == "--update")
+			update = true;
+		else
+			programs.push_back(arg);
+	}
+	if(lisp.empty() || baselinePath.empty() || programs.empty()) {
+		std::cerr << "usage: perfgate --lisp <binary> --baseline <json> [--runs n] [--time-threshold f] [--rss-threshold f] [--build name] [--update] programs...\n";
+		return 1;
+	}
+
+	std::string                        baselineBuild;
+	std::map<std::string, Measurement> baseline;
+	bool                               haveBaseline = read(baselinePath, baselineBuild, baseline);
+	if(!update && (!haveBaseline || baselineBuild != build)) {
+		std::cout << format("No baseline for the {} build in {}, record one with --update", build, baselinePath) << "\n";
+		return skipped;
+	}
+
+	std::map<std::string, Measurement> measured;
+	bool                               failed = false;
+	std::cout << format("{} runs per program, thresholds: time +{}%, peak RSS +{}%", runs, timeThreshold * 100, rssThreshold * 100) << "\n";
+	for(auto& program: programs) {
+		std::string         name = std::filesystem::path(program).filename().string();
+		std::vector<double> times;
+		std::vector<long>   rss;
+		std::string         output;
+		bool                ok = true;
+		for(size_t r = 0; r < runs && ok; r++) {
+			Run result = run(lisp, program);
+			if(!result.ok) {
+				std::cout << format("{}: failed\n{}", name, result.errors) << "\n";
+				ok = false;
+				break;
+			}
+			times.push_back(result.milliseconds);
+			rss.push_back(result.rssKilobytes);
+			output = result.output;
+		}
+		if(!ok) {
+			failed = true;
+			continue;
+		}
+		Measurement measurement {median(times), median(rss), output};
+		measured[name] = measurement;
+		auto expected  = baseline.find(name);
+		if(update || expected == baseline.end()) {
+			std::cout << format("{}: {} ms, {} KiB{}", name, measurement.milliseconds, measurement.rssKilobytes, update ? "" : " (no baseline)") << "\n";
+			continue;
+		}
+		double time   = measurement.milliseconds / expected->second.milliseconds;
+		double memory = double(measurement.rssKilobytes) / double(expected->second.rssKilobytes);
+		bool   slower = time > 1 + timeThreshold, larger = memory > 1 + rssThreshold, changed = output != expected->second.output;
+		std::cout << format("{}: {} ms ({}x), {} KiB ({}x){}{}{}", name, measurement.milliseconds, time, measurement.rssKilobytes, memory,
+							slower ? " TIME REGRESSION" : "", larger ? " RSS REGRESSION" : "", changed ? " OUTPUT CHANGED" : "")
+				  << "\n";
+		if(changed)
+			std::cout << format("  expected {}  printed {}", expected->second.output, output);
+		failed = failed || slower || larger || changed;
+	}
+
+	if(update) {
+		write(baselinePath, build, measured);
+		std::cout << format("Baseline written to {}", baselinePath) << "\n";
+	}
+	return failed ? 1 : 0;
+}
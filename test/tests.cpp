@@ -140,3 +140,905 @@
 //
 //TEST(Evaluation, SideEffects) {
 //}
+
+#include "aot.h"
+#include "batch.h"
+#include "builtin.h"
+#include "compiler.h"
+#include "image.h"
+#include "parser.h"
+#include "server.h"
+#include "tokenizer.h"
+
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <thread>
+
+
+TEST(TokenizerTest, CompactTokens) {
+	Source source(" ( abc\n(dev . 42.5))");
+	auto   tokens = tokenizer(source);
+	ASSERT_EQ(tokens.size(), 8);
+	ASSERT_EQ(tokens[1].type, TokenType::IDENTIFIER);
+	ASSERT_EQ(source.text(tokens[1]), "abc");
+	ASSERT_EQ(source.text(tokens[5]), "42.5");
+	ASSERT_EQ(tokens[5].type, TokenType::NUMBER);
+
+	auto position = source.position(tokens[3]);
+	ASSERT_EQ(position.line, 1);
+	ASSERT_EQ(position.column, 1);
+	ASSERT_EQ(source.line(1), "(dev . 42.5))");
+}
+
+TEST(TokenizerTest, NumberBoundaries) {
+	Source source("(+ 1 23)");
+	auto   tokens = tokenizer(source);
+	ASSERT_EQ(tokens.size(), 5);
+	ASSERT_EQ(source.text(tokens[2]), "1");
+	ASSERT_EQ(source.text(tokens[3]), "23");
+	ASSERT_EQ(tokens[4].type, TokenType::RIGHT_PAREN);
+}
+
+TEST(TokenizerTest, Comments) {
+	Source source("(+ 1 2) ; (car\n; ignored\nx");
+	auto   tokens = tokenizer(source);
+	ASSERT_EQ(tokens.size(), 6);
+	ASSERT_EQ(tokens[4].type, TokenType::RIGHT_PAREN);
+	ASSERT_EQ(source.text(tokens[5]), "x");
+}
+
+TEST(Parser, ErrorPosition) {
+	Source source("(a b)\n  )", "test.lisp");
+	auto   tokens = tokenizer(source);
+	tokens.erase(tokens.begin(), tokens.begin() + 4);
+	try {
+		expression(tokens, source);
+		FAIL(); // a stray ')' is not an expression
+	} catch(SyntaxError& err) {
+		ASSERT_EQ(err.sourceName(), "test.lisp");
+		ASSERT_EQ(err.line(), 1);
+		ASSERT_EQ(err.column(), 2);
+		ASSERT_EQ(err.lineText(), "  )");
+	}
+}
+
+TEST(Parser, UnclosedLists) {
+	// the last form of a program needs no parenthesis
+	Source source("(define x 5)\nx");
+	auto   tokens = tokenizer(source);
+	Atom   parsed = program(tokens, source);
+	ASSERT_EQ(*parsed.cdr().car().symbol(), "x");
+	Interpreter interp(builtin::table());
+	ASSERT_EQ(*interpret(interp, source).integer(), 5);
+	ASSERT_EQ(*interpret(interp, Source("(define y 'z) 'y")).symbol(), "y");
+	// a list the source ends in
+	for(const char* text: {"(a (b c)", "(a .", "(a . b", "x (a"}) {
+		Source unclosed(text);
+		auto   rest = tokenizer(unclosed);
+		try {
+			program(rest, unclosed);
+			FAIL() << text;
+		} catch(SyntaxError& err) {
+			ASSERT_EQ(err.what(), "Expected )");
+		}
+	}
+}
+
+TEST(Parser, ReaderMacros) {
+	Source source("'a `(b ,c ,@d ~e ~@f)");
+	auto   tokens = tokenizer(source);
+	Atom   parsed = program(tokens, source);
+	ASSERT_EQ(*parsed.car().car().symbol(), "quote");
+	ASSERT_EQ(*parsed.car().cdr().car().symbol(), "a");
+	Atom quasiquoted = parsed.cdr().car();
+	ASSERT_EQ(*quasiquoted.car().symbol(), "quasiquote");
+	std::vector<std::string> heads;
+	for(Atom p = quasiquoted.cdr().car().cdr(); !p.isNil(); p = p.cdr())
+		heads.push_back(*p.car().car().symbol());
+	ASSERT_EQ(heads, (std::vector<std::string>{"unquote", "unquote-splicing", "unquote", "unquote-splicing"}));
+	Source dangling("(a ')");
+	auto   rest = tokenizer(dangling);
+	ASSERT_THROW(program(rest, dangling), SyntaxError);
+}
+
+TEST(Evaluation, SideEffects) {
+	Interpreter interp(builtin::table());
+	interpret(interp, Source("(define square (lambda (x) (* x x)))"));
+	ASSERT_EQ(*interpret(interp, Source("(square 4)")).integer(), 16);
+	// evaluating the body must not overwrite it with the previous arguments
+	ASSERT_EQ(*interpret(interp, Source("(square 5)")).integer(), 25);
+}
+
+TEST(Module, ImportOnceAndCache) {
+	auto dir = std::filesystem::temp_directory_path() / "lisp-module-test";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	auto file = (dir / "counter.lisp").string();
+	std::ofstream(file) << "(define counter (+ counter 1))\n(define double (lambda (x) (* x 2.5)))";
+
+	Interpreter interp(builtin::table());
+	interp.global().set(Atom("counter"), Atom(long(0)));
+	interpret(interp, Source("(import " + file + ")"));
+	interpret(interp, Source("(import " + file + ")"));
+	ASSERT_EQ(*interpret(interp, Source("counter")).integer(), 1);
+
+	// the parsed form round trips through the on-disk cache
+	ModuleCache cache(dir / "cache");
+	std::string text   = sourceFromFile(file);
+	Source      source(text);
+	auto        tokens = tokenizer(source);
+	cache.store(text, program(tokens, source));
+	auto cached = cache.load(text);
+	ASSERT_TRUE(cached.has_value());
+	ASSERT_EQ(*cached->car().car().symbol(), "define");
+	Atom body = cached->cdr().car().cdr().cdr().car().cdr().cdr().car(); // (* x 2.5)
+	ASSERT_DOUBLE_EQ(*body.cdr().cdr().car().rational(), 2.5);
+	ASSERT_FALSE(cache.load(text + " ").has_value());
+
+	// threads storing the same entry at once each write a file of their own, so readers never
+	// see one truncated by another writer
+	std::atomic<size_t>      misses = 0;
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 8; t++)
+		threads.emplace_back([&, t] {
+			for(int i = 0; i < 50; i++) {
+				if(t % 2)
+					cache.store(text, *cached);
+				else if(!cache.load(text))
+					misses++;
+			}
+		});
+	for(auto& thread: threads)
+		thread.join();
+	ASSERT_EQ(misses, 0);
+	ASSERT_EQ(std::distance(std::filesystem::directory_iterator(dir / "cache"), std::filesystem::directory_iterator()), 1);
+	std::filesystem::remove_all(dir);
+}
+
+TEST(Image, RoundTrip) {
+	auto path = (std::filesystem::temp_directory_path() / "lisp-image-test.img").string();
+	{
+		Interpreter interp(builtin::table());
+		interpret(interp, Source("(define make-adder (lambda (x) (lambda (y) (+ x y))))"
+								 "(define add-two (make-adder 2))"
+								 "(defmacro unless (c body) `(if ,c nil ,body))"));
+		saveImage(path, interp);
+	}
+	Interpreter interp(builtin::table());
+	loadImage(path, interp);
+	// closures keep their captured environment, builtins are resolved by name
+	ASSERT_EQ(*interpret(interp, Source("(add-two 5)")).integer(), 7);
+	ASSERT_EQ(*interpret(interp, Source("((make-adder 1) (car (cons 2 nil)))")).integer(), 3);
+	// as do macros
+	ASSERT_EQ(*interpret(interp, Source("(unless nil (add-two 5))")).integer(), 7);
+	ASSERT_TRUE(interpret(interp, Source("(unless 1 2)")).isNil());
+	std::filesystem::remove(path);
+}
+
+TEST(Interpreter, Isolation) {
+	std::vector<long>        results(4);
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < results.size(); i++) {
+		threads.emplace_back([&results, i]() {
+			std::stringstream out;
+			Interpreter       interp(builtin::table(), std::cin, out);
+			// every interpreter binds n to its own value in its own global environment
+			interpret(interp, Source(format("(define n {})", i)));
+			interpret(interp, Source("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"));
+			results[i] = *interpret(interp, Source("(+ (fib 15) n)")).integer();
+		});
+	}
+	for(auto& thread: threads)
+		thread.join();
+	for(size_t i = 0; i < results.size(); i++)
+		ASSERT_EQ(results[i], 610 + long(i));
+}
+
+TEST(Parallel, MapReduce) {
+	Interpreter interp(builtin::table());
+	interpret(interp, Source("(define range (lambda (a b) (if (< a b) (cons a (range (+ a 1) b)) nil)))"
+							 "(define xs (range 0 200))"));
+	// results keep the order of the list, whatever the grain size
+	for(auto* grain: {"", "1", "7", "500"}) {
+		Atom squares = interpret(interp, Source(format("(pmap (lambda (x) (* x x)) xs {})", grain)));
+		for(long i = 0; i < 200; i++, squares = squares.cdr())
+			ASSERT_EQ(*squares.car().integer(), i * i);
+		ASSERT_TRUE(squares.isNil());
+		ASSERT_EQ(*interpret(interp, Source(format("(preduce + 1000 xs {})", grain))).integer(), 1000 + 199 * 200 / 2);
+	}
+	ASSERT_TRUE(interpret(interp, Source("(pmap car nil)")).isNil());
+	ASSERT_TRUE(interpret(interp, Source("(pfor-each (lambda (x) x) xs 3)")).isNil());
+	// errors raised on a worker reach the caller
+	ASSERT_THROW(interpret(interp, Source("(pmap (lambda (x) (car x)) xs 1)")), TypeError);
+}
+
+TEST(Parallel, Futures) {
+	Interpreter interp(builtin::table());
+	interpret(interp, Source("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+							 "(define a (future (fib 15)))"
+							 "(define b (future (fib 16)))"));
+	ASSERT_EQ(*interpret(interp, Source("(+ (touch a) (await b))")).integer(), 610 + 987);
+	ASSERT_FALSE(interpret(interp, Source("(future-ready? a)")).isNil());
+	// futures capture their lexical environment
+	ASSERT_EQ(*interpret(interp, Source("((lambda (x) (touch (future (* x 2)))) 21)")).integer(), 42);
+	// errors are raised when the future is touched
+	interpret(interp, Source("(define c (future (car 1)))"));
+	ASSERT_THROW(interpret(interp, Source("(touch c)")), TypeError);
+}
+
+TEST(GreenThreads, SpawnYieldJoin) {
+	Interpreter interp(builtin::table());
+	interpret(interp, Source("(define count (lambda (n acc) (if (< n 1) acc ((lambda (ignored) (count (- n 1) (+ acc 1))) (yield)))))"
+							 "(define spawn-all (lambda (n) (if (< n 1) nil (cons (spawn (lambda () (count 10 0))) (spawn-all (- n 1))))))"
+							 "(define join-all (lambda (tasks) (if tasks (+ (join (car tasks)) (join-all (cdr tasks))) 0)))"));
+	// 1000 tasks, each yielding 10 times
+	ASSERT_EQ(*interpret(interp, Source("(join-all (spawn-all 1000))")).integer(), 1000 * 10);
+	ASSERT_EQ(interp.scheduler().size(), 0);
+
+	// sleeping tasks wake up in order of their deadline
+	std::stringstream out;
+	Interpreter       sleeper(builtin::table(), std::cin, out);
+	interpret(sleeper, Source("(spawn (lambda () ((lambda (x) (putchar 98)) (sleep 20))))"
+							  "(spawn (lambda () ((lambda (x) (putchar 97)) (sleep 5))))"));
+	sleeper.scheduler().run();
+	ASSERT_EQ(out.str(), "ab");
+
+	// errors are raised by join
+	ASSERT_THROW(interpret(interp, Source("(join (spawn (lambda () (car 1))))")), TypeError);
+}
+
+TEST(Channels, RingBuffer) {
+	RingBuffer<int, 4> ring;
+	ASSERT_TRUE(ring.empty());
+	for(int i = 0; i < 6; i++)
+		ring.push_back(i);
+	// the two oldest were overwritten
+	ASSERT_EQ(ring.size(), 4);
+	ASSERT_EQ(ring[0], 2);
+	ASSERT_EQ(ring[3], 5);
+	ASSERT_EQ(ring.pop(), 2);
+	ASSERT_EQ(ring.size(), 3);
+}
+
+TEST(Channels, Queues) {
+	constexpr long count = 100000;
+	SPSCQueue<long, 64> spsc;
+	std::thread         producer([&] {
+        for(long i = 0; i < count; i++)
+            while(!spsc.tryPush(i)) std::this_thread::yield();
+	});
+	for(long i = 0; i < count; i++) {
+		std::optional<long> value;
+		while(!(value = spsc.tryPop())) std::this_thread::yield();
+		ASSERT_EQ(*value, i); // in order
+	}
+	producer.join();
+
+	MPMCQueue<long, 64>      mpmc;
+	std::atomic<long>        sum = 0;
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 2; t++) {
+		threads.emplace_back([&] {
+			for(long i = 1; i <= count; i++)
+				while(!mpmc.tryPush(i)) std::this_thread::yield();
+		});
+		threads.emplace_back([&] {
+			for(long i = 0; i < count; i++) {
+				std::optional<long> value;
+				while(!(value = mpmc.tryPop())) std::this_thread::yield();
+				sum += *value;
+			}
+		});
+	}
+	for(auto& thread: threads)
+		thread.join();
+	ASSERT_EQ(sum, 2 * count * (count + 1) / 2);
+	ASSERT_TRUE(mpmc.empty());
+}
+
+TEST(Channels, BetweenInterpreters) {
+	Interpreter producer(builtin::table()), consumer(builtin::table());
+	interpret(producer, Source("(define ch (make-channel))"));
+	consumer.global().set(Atom("ch"), interpret(producer, Source("ch")));
+
+	// more messages than the channel holds, so the producer waits for the consumer
+	std::thread thread([&] {
+		interpret(producer, Source("(define produce (lambda (n) (if (< n 1) (send ch nil) ((lambda (x) (produce (- n 1))) (send ch (cons n n))))))"
+								   "(produce 2000)"));
+	});
+	interpret(consumer, Source("(define consume (lambda (acc) ((lambda (msg) (if msg (consume (+ acc (car msg))) acc)) (receive ch))))"));
+	ASSERT_EQ(*interpret(consumer, Source("(consume 0)")).integer(), 2000 * 2001 / 2);
+	thread.join();
+
+	// received values are copies
+	interpret(producer, Source("(define l (cons 1 (cons 2 nil)))"));
+	Atom list     = interpret(producer, Source("l"));
+	Atom received = interpret(producer, Source("((lambda (x) (receive ch)) (send ch l))"));
+	ASSERT_EQ(*received.car().integer(), 1);
+	ASSERT_NE(received.pairPtr(), list.pairPtr());
+	ASSERT_THROW(interpret(producer, Source("(send ch (spawn (lambda () 1)))")), TypeError);
+}
+
+TEST(Channels, GreenThreadPipeline) {
+	Interpreter interp(builtin::table());
+	// receiving from the empty channel lets the producer, a green thread, run
+	interpret(interp, Source("(define ch (make-channel))"
+							 "(define produce (lambda (n) (if (< n 1) nil ((lambda (x) (produce (- n 1))) (send ch n)))))"
+							 "(spawn (lambda () (produce 500)))"
+							 "(define consume (lambda (n acc) (if (< n 1) acc (consume (- n 1) (+ acc (receive ch))))))"));
+	ASSERT_EQ(*interpret(interp, Source("(consume 500 0)")).integer(), 500 * 501 / 2);
+}
+
+TEST(Ports, Strings) {
+	Interpreter interp(builtin::table());
+	Atom        str = interpret(interp, Source(R"("a \"quoted\" line\n")"));
+	ASSERT_EQ(str.type, Type::String);
+	ASSERT_EQ(*str.string(), "a \"quoted\" line\n");
+	std::stringstream printed;
+	printed << str;
+	ASSERT_EQ(printed.str(), R"("a \"quoted\" line\n")");
+	ASSERT_THROW(interpret(interp, Source(R"("unterminated)")), LexError);
+}
+
+TEST(Ports, Files) {
+	auto path = (std::filesystem::temp_directory_path() / "lisp-port-test.txt").string();
+	{
+		Interpreter interp(builtin::table());
+		interpret(interp, Source(format("(define out (open-output-file \"{}\"))", path)));
+		// enough lines to fill the buffer several times
+		interpret(interp, Source("(define line \"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef012\\n\")"));
+		interpret(interp, Source("(define write-lines (lambda (n) (if (< n 1) nil ((lambda (x) (write-lines (- n 1))) (write-string line out)))))"
+								 "(write-lines 1000)"
+								 "(write-string \"last line without line feed\" out)"
+								 "(close-port out)"));
+		ASSERT_THROW(interpret(interp, Source("(write-string \"closed\" out)")), EvalError);
+	}
+	ASSERT_EQ(std::filesystem::file_size(path), 1000 * 100 + 27);
+
+	Interpreter interp(builtin::table());
+	interpret(interp, Source(format("(define in (open-input-file \"{}\"))", path)));
+	interpret(interp, Source("(define count-lines (lambda (n) (if (read-line in) (count-lines (+ n 1)) n)))"));
+	ASSERT_EQ(*interpret(interp, Source("(count-lines 0)")).integer(), 1001);
+	ASSERT_TRUE(interpret(interp, Source("(read-line in)")).isNil());
+
+	interpret(interp, Source(format("(define in (open-input-file \"{}\"))", path)));
+	ASSERT_EQ(*interpret(interp, Source("(read-bytes 4 in)")).string(), "0123");
+	ASSERT_EQ(*interpret(interp, Source("(read-line in)")).string(), "456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef012");
+	ASSERT_EQ(interpret(interp, Source("(read-bytes 200000 in)")).string()->size(), 999 * 100 + 27);
+	ASSERT_THROW(interpret(interp, Source("(write-string \"x\" in)")), EvalError);
+	ASSERT_THROW(interpret(interp, Source("(open-input-file \"/nonexistent/file\")")), EvalError);
+	std::filesystem::remove(path);
+
+	// without a port the input & output of the interpreter are used
+	std::stringstream in("first\nx"), out;
+	Interpreter       io(builtin::table(), in, out);
+	ASSERT_EQ(*interpret(io, Source("(read-line)")).string(), "first");
+	ASSERT_EQ(*interpret(io, Source("(getchar)")).integer(), 'x');
+	ASSERT_TRUE(interpret(io, Source("(getchar)")).isNil());
+	interpret(io, Source("(write-string \"out\")"));
+	ASSERT_EQ(out.str(), "out");
+}
+
+TEST(Server, PipelinedRequests) {
+	auto            path = (std::filesystem::temp_directory_path() / "lisp-server-test.sock").string();
+	Server::Options options;
+	options.workers = 2;
+	options.prepare = [](Interpreter& interp) {
+		interpret(interp, Source("(define square (lambda (x) (* x x))) (defmacro twice (x) `(+ ,x ,x))"));
+	};
+	Server      server(path, builtin::table(), options);
+	server.start();
+	std::thread loop([&] { server.run(); });
+
+	{
+		ServerClient                   client(path);
+		std::vector<protocol::Request> requests;
+		for(std::uint32_t i = 0; i < 100; i++)
+			requests.push_back({i, 0, format("(square {})", i)});
+		requests.push_back({100, 0, "(car 1)"});
+		requests.push_back({101, 0, "(define n 1)"});
+		requests.push_back({102, 0, "(putchar \"out \")"});
+		requests.push_back({103, 50, "(define spin (lambda (n) (if (< n 1) 0 (+ (spin (- n 1)) (spin (- n 1)))))) (spin 40)"});
+		client.send(requests);
+
+		std::unordered_map<std::uint32_t, protocol::Response> responses;
+		while(responses.size() < requests.size()) {
+			for(auto& response: client.receive())
+				responses.emplace(response.id, response);
+		}
+		for(std::uint32_t i = 0; i < 100; i++) {
+			ASSERT_EQ(responses[i].status, protocol::Status::Ok);
+			ASSERT_EQ(responses[i].payload, std::to_string(i * i));
+		}
+		ASSERT_EQ(responses[100].status, protocol::Status::Error);
+		ASSERT_EQ(responses[102].payload, "out NIL");
+		ASSERT_EQ(responses[103].status, protocol::Status::Timeout);
+
+		// definitions of a request do not leak into the next one
+		client.send({104, 0, "n"});
+		ASSERT_EQ(client.receive()[0].status, protocol::Status::Error);
+		// nor do its macros, those of the prelude stay
+		client.send({105, 0, "(defmacro k (a) `(quote leaked))"});
+		ASSERT_EQ(client.receive()[0].status, protocol::Status::Ok);
+		for(std::uint32_t i = 0; i < 4; i++) {
+			client.send({106 + i, 0, "(k 1)"});
+			ASSERT_EQ(client.receive()[0].status, protocol::Status::Error);
+		}
+		client.send({110, 0, "(twice 21)"});
+		ASSERT_EQ(client.receive()[0].payload, "42");
+
+		// recursion deeper than the stack of a worker fails the request, in a green thread as well
+		const char* deep = "(define deep (lambda (n) (if (< n 1) 0 (+ 1 (deep (- n 1))))))";
+		client.send({111, 0, format("{} (deep 100000000)", deep)});
+		auto overflow = client.receive()[0];
+		ASSERT_EQ(overflow.status, protocol::Status::Error);
+		ASSERT_EQ(overflow.payload, "Stack overflow");
+		client.send({112, 0, format("{} (join (spawn (lambda () (deep 100000000))))", deep)});
+		ASSERT_EQ(client.receive()[0].status, protocol::Status::Error);
+		client.send({113, 0, format("{} (deep 1000)", deep)});
+		ASSERT_EQ(client.receive()[0].payload, "1000");
+	}
+	server.stop();
+	loop.join();
+}
+
+TEST(Server, ClosedClients) {
+	auto            path = (std::filesystem::temp_directory_path() / "lisp-server-closed-test.sock").string();
+	Server::Options options;
+	options.workers = 1;
+	Server      server(path, builtin::table(), options);
+	std::thread loop([&] { server.run(); });
+	auto        cpuTime = [&] {
+		clockid_t clock;
+		timespec  time{};
+		::pthread_getcpuclockid(loop.native_handle(), &clock);
+		::clock_gettime(clock, &time);
+		return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+	};
+
+	{
+		// the client is gone while its request is still evaluated
+		ServerClient client(path);
+		client.send({0, 1000, "(define spin (lambda (n) (if (< n 1) 0 (+ (spin (- n 1)) (spin (- n 1)))))) (spin 40)"});
+	}
+	auto before = cpuTime();
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	// the event loop waited instead of spinning on the hung up socket
+	ASSERT_LT(cpuTime() - before, std::chrono::milliseconds(100));
+
+	ServerClient client(path);
+	client.send({1, 0, "(+ 1 2)"});
+	ASSERT_EQ(client.receive()[0].payload, "3");
+	server.stop();
+	loop.join();
+}
+
+TEST(Batch, ForkedWorkers) {
+	auto dir = std::filesystem::temp_directory_path() / "lisp-batch-test";
+	std::filesystem::create_directories(dir);
+	std::vector<std::string> scripts;
+	for(int i = 0; i < 20; i++) {
+		scripts.push_back((dir / format("script{}.lisp", i)).string());
+		std::ofstream(scripts.back()) << format("(define x {}) (putchar 62) (square x)", i);
+	}
+	scripts.push_back((dir / "missing.lisp").string());
+
+	Interpreter interp(builtin::table());
+	interpret(interp, Source("(define square (lambda (x) (* x x)))"));
+	batch::Options options;
+	options.workers = 3;
+	auto results    = batch::evaluate(interp, scripts, options);
+	ASSERT_EQ(results.size(), scripts.size());
+	for(int i = 0; i < 20; i++) {
+		ASSERT_EQ(results[i].status, batch::Status::Ok);
+		ASSERT_EQ(results[i].text, format(">{}", i * i)); // output, then the result
+	}
+	ASSERT_EQ(results.back().status, batch::Status::Error);
+	// the definitions of the scripts stay in the workers
+	ASSERT_THROW(interpret(interp, Source("x")), EnvError);
+	std::filesystem::remove_all(dir);
+}
+
+TEST(Namespace, ConcurrentReadsAndDefines) {
+	auto ns = std::make_shared<Namespace>();
+	ns->define("x0", Atom(0L));
+	std::atomic<bool>        done = false;
+	std::atomic<size_t>      errors = 0;
+	std::vector<std::thread> readers;
+	for(int t = 0; t < 4; t++) {
+		readers.emplace_back([&] {
+			while(!done) {
+				// every snapshot a reader sees binds x0, & any other xi to i
+				for(long i = 0; i < 50; i++) {
+					auto value = ns->lookup(format("x{}", i));
+					if(i == 0 && !value || value && *value->integer() != i)
+						errors++;
+				}
+			}
+		});
+	}
+	for(long i = 1; i < 5000; i++)
+		ns->define(format("x{}", i), Atom(i));
+	done = true;
+	for(auto& reader: readers)
+		reader.join();
+	ASSERT_EQ(errors, 0);
+	ASSERT_EQ(ns->size(), 5000);
+	ASSERT_EQ(*ns->lookup("x4999")->integer(), 4999);
+	// without readers, the next define reclaims every older snapshot
+	ns->define("x0", Atom(0L));
+	ASSERT_EQ(EpochDomain::instance().pending(), 0);
+
+	// global definitions are visible to parallel evaluation
+	Interpreter interp(builtin::table());
+	interpret(interp, Source("(define offset 10)"));
+	Atom result = interpret(interp, Source("(pmap (lambda (x) (+ x offset)) (cons 1 (cons 2 nil)) 1)"));
+	ASSERT_EQ(*result.car().integer(), 11);
+	ASSERT_EQ(*result.cdr().car().integer(), 12);
+}
+
+TEST(Profiler, CountsCallsAndSamples) {
+	std::stringstream in, out, err;
+	Interpreter       interp(builtin::table(), in, out, err);
+	interpret(interp, Source("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"));
+	interpret(interp, Source("(define pair-up (lambda (n) (cons n n)))"));
+	auto path   = std::filesystem::temp_directory_path() / "lisp-profile.folded";
+	Atom result = interpret(interp, Source(format("(profile (pair-up (fib 20)) \"{}\")", path.string())));
+	ASSERT_EQ(*result.car().integer(), 6765);
+	ASSERT_EQ(interp.profiler(), nullptr);
+
+	// 21891 calls of fib, each listed once in the report by name
+	std::string report = err.str();
+	ASSERT_NE(report.find("21891"), std::string::npos);
+	ASSERT_NE(report.find("fib\n"), std::string::npos);
+	ASSERT_NE(report.find("pair-up\n"), std::string::npos);
+
+	// collapsed stacks start at the outermost function
+	std::ifstream file(path);
+	size_t        samples = 0;
+	for(std::string line; std::getline(file, line);) {
+		auto space = line.rfind(' ');
+		ASSERT_NE(space, std::string::npos);
+		samples += std::stoul(line.substr(space + 1));
+		if(line.find(';') != std::string::npos)
+			ASSERT_EQ(line.rfind("fib;", 0) == 0 || line.rfind("pair-up;", 0) == 0, true);
+	}
+	std::filesystem::remove(path);
+	ASSERT_GT(samples, 0);
+
+	// pairs are attributed to the function allocating them, not its callers
+	Profiler profiler(std::chrono::microseconds(0));
+	interp.setProfiler(&profiler);
+	interpret(interp, Source("(pair-up 1)"));
+	interp.setProfiler(nullptr);
+	auto names = profiler.names((*interp.global().atom().car().ns())->bindings());
+	ASSERT_EQ(profiler.entries().size(), 2);
+	for(auto& [key, entry]: profiler.entries()) {
+		ASSERT_EQ(entry.calls, 1);
+		if(names.at(key) == "cons")
+			ASSERT_EQ(entry.allocations, 1);
+		else
+			ASSERT_GT(entry.allocations, 0);
+	}
+}
+
+TEST(Memory, CountsObjectsByKind) {
+	Interpreter interp(builtin::table());
+	auto        before = memory::stats();
+	{
+		// a list of 1000 pairs, live until the end of the scope
+		Atom list = interpret(interp, Source("(define build (lambda (n acc) (if (= n 0) acc (build (- n 1) (cons n acc)))))"));
+		list      = interpret(interp, Source("(build 1000 nil)"));
+		auto held = memory::stats();
+		ASSERT_GE(held.allocations[size_t(memory::Kind::Pair)] - before.allocations[size_t(memory::Kind::Pair)], 1000);
+		ASSERT_GE(held.live[size_t(memory::Kind::Pair)] - before.live[size_t(memory::Kind::Pair)], 1000);
+		ASSERT_GE(held.allocations[size_t(memory::Kind::Closure)] - before.allocations[size_t(memory::Kind::Closure)], 1);
+		ASSERT_GE(held.allocations[size_t(memory::Kind::Frame)] - before.allocations[size_t(memory::Kind::Frame)], 1000);
+		ASSERT_GE(held.liveBytes - before.liveBytes, std::int64_t(1000 * sizeof(Pair)));
+		ASSERT_GE(held.peakBytes, held.liveBytes);
+	}
+	// freed with the list, only the closure & its binding are left
+	auto after = memory::stats();
+	ASSERT_LT(after.live[size_t(memory::Kind::Pair)] - before.live[size_t(memory::Kind::Pair)], 100);
+
+	Atom listed = interpret(interp, Source("(memory-stats)"));
+	ASSERT_EQ(*listed.car().car().symbol(), "pair");
+	ASSERT_EQ(listed.car().cdr().car().type, Type::Integer);
+	std::stringstream json;
+	memory::json(json, after);
+	ASSERT_EQ(json.str().rfind("{\"allocations\": {\"pair\": ", 0), 0);
+}
+
+TEST(Memory, StackAllocatesFramesThatDontEscape) {
+	// bodies closing over their frame
+	Interpreter quoting(builtin::table());
+	auto        captures = [&](const char* body) { return escape::captures(interpret(quoting, Source(format("(quote {})", body)))); };
+	ASSERT_FALSE(captures("(if (< n 2) n (+ (fib (- n 1)) 1))"));
+	ASSERT_FALSE(captures("(quote (lambda (x) x))"));
+	ASSERT_TRUE(captures("(cons (lambda (x) (+ x n)) nil)"));
+	ASSERT_TRUE(captures("(touch (future n))"));
+
+	for(bool compiled: {false, true}) {
+		Interpreter interp(builtin::table());
+		if(compiled)
+			interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins(), false));
+		interpret(interp, Source("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+								 "(define make-adder (lambda (n) (lambda (x) (+ x n))))"
+								 "(define fail (lambda (n) (+ n undefined)))"));
+		// the frames of a leaf function are released on return
+		size_t used = region::stack().used();
+		ASSERT_EQ(*interpret(interp, Source("(fib 15)")).integer(), 610);
+		ASSERT_EQ(region::stack().used(), used);
+		// a frame captured by a closure outlives its call
+		interpret(interp, Source("(define add2 (make-adder 2))"));
+		ASSERT_EQ(*interpret(interp, Source("(fib 10)")).integer(), 55);
+		ASSERT_EQ(*interpret(interp, Source("(add2 40)")).integer(), 42);
+		// as do the frames an error holds until it is handled
+		ASSERT_THROW(interpret(interp, Source("(fail 1)")), EnvError);
+		ASSERT_EQ(*interpret(interp, Source("(fib 10)")).integer(), 55);
+		ASSERT_EQ(region::stack().used(), used);
+		// released by other threads
+		ASSERT_EQ(*interpret(interp, Source("(preduce + 0 (pmap fib (cons 10 (cons 15 nil))))")).integer(), 665);
+	}
+}
+
+TEST(Memory, CompactLists) {
+	Interpreter interp(builtin::table());
+	// the pairs of a list read or built by pmap lie next to each other
+	auto adjacent = [](const Atom& list) {
+		size_t stride = 0, runs = 0;
+		for(Atom p = list; p.cdr().type == Type::Pair; p = p.cdr()) {
+			auto step = reinterpret_cast<std::uintptr_t>(*p.cdr().pairPtr()) - reinterpret_cast<std::uintptr_t>(*p.pairPtr());
+			if(step != stride)
+				runs++;
+			stride = step;
+		}
+		return runs;
+	};
+	std::string items;
+	for(int i = 0; i < 100; i++)
+		items += format(" {}", i);
+	Atom read = interpret(interp, Source(format("(quote ({}))", items)));
+	ASSERT_LE(adjacent(read), 3); // a chunk may fill up midway
+	ASSERT_LE(adjacent(interpret(interp, Source(format("(pmap (lambda (x) (* x x)) (quote ({})))", items)))), 3);
+
+	// a pair keeps its chunk, its cdr can be set to any list
+	auto  before = memory::stats().live[size_t(memory::Kind::Pair)];
+	Atom  third  = read.cdr().cdr();
+	read         = nil;
+	third.cdr()  = Atom(Atom(42L), nil);
+	ASSERT_EQ(memory::stats().live[size_t(memory::Kind::Pair)] - before, 2 - 100);
+	ASSERT_EQ(*third.car().integer(), 2);
+	ASSERT_EQ(*third.cdr().car().integer(), 42);
+
+	// improper lists & quasiquote
+	ASSERT_EQ(*interpret(interp, Source("(cdr (quote (1 . 2)))")).integer(), 2);
+	ASSERT_EQ(*interpret(interp, Source("(car (cdr `(1 ,(+ 1 1) . 3)))")).integer(), 2);
+}
+
+TEST(Trace, RecordsTheWayToAnError) {
+	HistoryBuffer<int, 4> history;
+	for(int i = 0; i < 6; i++)
+		history.push(i);
+	ASSERT_EQ(history.size(), 4);
+	ASSERT_EQ(history[0], 2);
+	ASSERT_EQ(history[3], 5);
+
+	std::stringstream in, out, err;
+	Interpreter       interp(builtin::table(), in, out, err);
+	interpret(interp, Source("(define first (lambda (x) (car x)))"));
+	interpret(interp, Source("(define outer (lambda (x) (+ 1 (first x))))"));
+	trace::clear();
+	ASSERT_THROW(interpret(interp, Source("(outer 5)")), TypeError);
+	std::stringstream dump;
+	dumpTrace(interp, dump);
+	std::string decoded = dump.str();
+	// every application on the way to the error is unwound, innermost first
+	auto car = decoded.find("unwind car"), first = decoded.find("unwind first"), outer = decoded.find("unwind outer");
+	ASSERT_NE(decoded.find("apply outer"), std::string::npos);
+	ASSERT_NE(decoded.find("eval (first ...)"), std::string::npos);
+	ASSERT_NE(car, std::string::npos);
+	ASSERT_LT(car, first);
+	ASSERT_LT(first, outer);
+
+	// on demand, with returns
+	trace::clear();
+	interpret(interp, Source("(dump-trace 3)"));
+	interpret(interp, Source("(first (cons 1 2))"));
+	ASSERT_NE(err.str().find("builtin dump-trace"), std::string::npos);
+	std::stringstream returned;
+	dumpTrace(interp, returned, 2);
+	ASSERT_NE(returned.str().find("return car -> Integer"), std::string::npos);
+	ASSERT_NE(returned.str().find("return first -> Integer"), std::string::npos);
+}
+
+TEST(Compiler, MatchesTheTreeWalker) {
+	const char* definitions =
+		"(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+		"(define make-adder (lambda (n) (lambda (x) (+ x n))))"
+		"(define scale (lambda (x) (* x 1.5)))"
+		"(define counter (lambda (n) ((lambda (ignored) (+ total n)) (define total (* n 2)))))"
+		"(define build (lambda (n acc) (if (< n 1) acc (build (- n 1) (cons n acc)))))";
+	const char* expressions[] = {"(fib 15)", "((make-adder 3) 4)", "(scale 3)", "(counter 5)", "(car (cdr (build 5 nil)))", "(quote (a b))"};
+	Interpreter walked(builtin::table()), compiled(builtin::table());
+	compiled.setEvaluator(std::make_unique<compiler::Compiler>(compiled.builtins()));
+	interpret(walked, Source(definitions));
+	interpret(compiled, Source(definitions));
+	for(auto* expression: expressions) {
+		std::stringstream expected, actual;
+		expected << interpret(walked, Source(expression));
+		actual << interpret(compiled, Source(expression));
+		ASSERT_EQ(actual.str(), expected.str()) << expression;
+	}
+	// compiled closures are applied by built-in functions, closures of the tree walker by compiled code
+	ASSERT_EQ(*interpret(compiled, Source("(preduce + 0 (pmap (make-adder 1) (build 10 nil)))")).integer(), 65);
+	Source adder("(define walked-adder (lambda (x) (+ x 10)))");
+	auto   tokens = tokenizer(adder);
+	eval(compiled, expression(tokens, adder), compiled.global());
+	ASSERT_EQ(*interpret(compiled, Source("(walked-adder 1)")).integer(), 11);
+	ASSERT_THROW(interpret(compiled, Source("(fib 1 2)")), EvalError);
+	ASSERT_THROW(interpret(compiled, Source("(fib undefined)")), EnvError);
+}
+
+TEST(Compiler, PrimitivesFollowRedefinitions) {
+	Interpreter interp(builtin::table());
+	interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins()));
+	interpret(interp, Source("(define add (lambda (a b) (+ a b)))"));
+	ASSERT_EQ(*interpret(interp, Source("(add 2 3)")).integer(), 5);
+	ASSERT_DOUBLE_EQ(*interpret(interp, Source("(add 2 0.5)")).rational(), 2.5);
+	ASSERT_THROW(interpret(interp, Source("(add 2 nil)")), TypeError);
+	// the inlined + is a call of the new binding once + is redefined
+	interpret(interp, Source("(define + (lambda (a b) (- a b)))"));
+	ASSERT_EQ(*interpret(interp, Source("(add 2 3)")).integer(), -1);
+}
+
+TEST(Compiler, NativeCode) {
+	if(!jit::available())
+		GTEST_SKIP() << "no native code on this platform";
+	Interpreter interp(builtin::table());
+	interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins()));
+	interpret(interp, Source("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+							 "(define half (lambda (n) (- n (* n 0.5))))"));
+	// hot after the first call, the following run natively
+	ASSERT_EQ(*interpret(interp, Source("(fib 20)")).integer(), 6765);
+	ASSERT_EQ(*interpret(interp, Source("(fib 25)")).integer(), 75025);
+	// the deadline aborts native code
+	interp.setDeadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(50));
+	ASSERT_THROW(interpret(interp, Source("(fib 45)")), TimeoutError);
+	interp.clearDeadline();
+	// arguments other than integers & redefined globals are left to the nodes
+	ASSERT_DOUBLE_EQ(*interpret(interp, Source("(fib 2.5)")).rational(), 2.0);
+	interpret(interp, Source("(define + (lambda (a b) (* a b)))"));
+	ASSERT_EQ(*interpret(interp, Source("(fib 10)")).integer(), 0);
+	interpret(interp, Source("(define + -)"));
+	ASSERT_EQ(*interpret(interp, Source("(fib 5)")).integer(), -1);
+	// a body that can't be compiled
+	for(int i = 0; i < 1100; i++)
+		interpret(interp, Source("(half 4)"));
+	ASSERT_DOUBLE_EQ(*interpret(interp, Source("(half 4)")).rational(), 2.0);
+}
+
+TEST(Compiler, DropsProgramsNothingRefersTo) {
+	Interpreter interp(builtin::table());
+	auto*       compiler = new compiler::Compiler(interp.builtins());
+	interp.setEvaluator(std::unique_ptr<Evaluator>(compiler));
+	interpret(interp, Source("(define apply-one (lambda (f) (f 1)))"
+							 "(define make-adder (lambda (n) (lambda (x) (+ x n))))"
+							 "(define add2 (make-adder 2))"
+							 "(define later (future (+ 1 2)))"));
+	auto before = memory::stats().live[size_t(memory::Kind::Pair)];
+	for(long i = 0; i < 1000; i++) {
+		// redefined & called with a lambda dying with the call, the call site keeps seeing new lambdas
+		interpret(interp, Source(format("(define f (lambda (x) (+ x {})))", i)));
+		ASSERT_EQ(*interpret(interp, Source(format("(apply-one (lambda (x) (+ x {})))", i))).integer(), i + 1);
+		ASSERT_EQ(*interpret(interp, Source("(f 1)")).integer(), i + 1);
+	}
+	ASSERT_LT(compiler->programs(), 50);
+	ASSERT_LT(memory::stats().live[size_t(memory::Kind::Pair)] - before, 500);
+	// the programs still referred to stay
+	ASSERT_EQ(*interpret(interp, Source("(add2 40)")).integer(), 42);
+	ASSERT_EQ(*interpret(interp, Source("(touch later)")).integer(), 3);
+	ASSERT_EQ(*interpret(interp, Source("((make-adder 1) 1)")).integer(), 2);
+}
+
+TEST(Compiler, TypeFeedback) {
+	using compiler::Operands;
+	Interpreter interp(builtin::table());
+	auto        ns = *interp.global().atom().car().ns();
+	compiler::Registry           lambdas;
+	std::vector<compiler::NodePtr> args;
+	args.push_back(std::make_unique<compiler::NameRefNode>(Atom("a")));
+	args.push_back(std::make_unique<compiler::NameRefNode>(Atom("b")));
+	compiler::PrimitiveNode<compiler::Primitive::Mul> mul(lambdas, ns, std::make_unique<compiler::GlobalRefNode>(ns, Atom("*")), builtin::mul, std::move(args));
+	auto call = [&](Atom a, Atom b) {
+		Environment frame(interp.global().atom());
+		frame.set(Atom("a"), a);
+		frame.set(Atom("b"), b);
+		return mul.eval(interp, frame);
+	};
+	ASSERT_EQ(mul.specialized(), Operands::None);
+	// specialized to the operands of the first call
+	ASSERT_DOUBLE_EQ(*call(Atom(1.5), Atom(2.0)).rational(), 3.0);
+	ASSERT_DOUBLE_EQ(*call(Atom(0.5), Atom(0.5)).rational(), 0.25);
+	ASSERT_EQ(mul.specialized(), Operands::DoubleDouble);
+	// generic from the first miss on
+	ASSERT_EQ(*call(Atom(2L), Atom(3L)).integer(), 6);
+	ASSERT_EQ(mul.specialized(), Operands::Other);
+	ASSERT_DOUBLE_EQ(*call(Atom(2L), Atom(0.25)).rational(), 0.5);
+	ASSERT_THROW(call(Atom(2L), nil), TypeError);
+	ASSERT_EQ(mul.seen(), std::uint8_t(Operands::DoubleDouble) | std::uint8_t(Operands::IntInt) | std::uint8_t(Operands::IntDouble) | std::uint8_t(Operands::Other));
+	// through the compiler, sites see the types of their own operands
+	interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins()));
+	interpret(interp, Source("(define scale (lambda (x k) (* x k)))"));
+	ASSERT_DOUBLE_EQ(*interpret(interp, Source("(scale 1.5 2)")).rational(), 3.0);
+	ASSERT_EQ(*interpret(interp, Source("(scale 3 2)")).integer(), 6);
+	ASSERT_EQ(*interpret(interp, Source("(scale 3 2)")).integer(), 6);
+	ASSERT_DOUBLE_EQ(*interpret(interp, Source("(scale 3 0.5)")).rational(), 1.5);
+}
+
+TEST(Macros, ExpandedOnceInPlace) {
+	auto show = [](const Atom& atom) {
+		std::stringstream os;
+		os << atom;
+		return os.str();
+	};
+	for(bool compiled: {false, true}) {
+		std::stringstream in, out;
+		Interpreter       interp(builtin::table(), in, out, out);
+		if(compiled)
+			interp.setEvaluator(std::make_unique<compiler::Compiler>(interp.builtins()));
+		// the expander prints an x every time it runs
+		interpret(interp, Source("(defmacro inc (x) (car (cons `(+ ,x 1) (putchar \"x\"))))"
+								 "(define f (lambda (n) (inc (inc n))))"));
+		ASSERT_EQ(out.str(), "xx");
+		for(int i = 0; i < 3; i++)
+			ASSERT_EQ(*interpret(interp, Source("(f 1)")).integer(), 3);
+		ASSERT_EQ(out.str(), "xx");
+		// a program evaluated again is not expanded again
+		Source source("(inc 41)");
+		auto   tokens = tokenizer(source);
+		Atom   parsed = program(tokens, source);
+		ASSERT_EQ(*evalProgram(interp, parsed, interp.global()).integer(), 42);
+		ASSERT_EQ(*evalProgram(interp, parsed, interp.global()).integer(), 42);
+		ASSERT_EQ(out.str(), "xxx");
+
+		interpret(interp, Source("(define xs '(2 3))"));
+		ASSERT_EQ(show(interpret(interp, Source("`(1 ,@xs ,(inc 3) `(a ,(b ,(car xs))) . ,(car xs))"))),
+				  show(interpret(interp, Source("'(1 2 3 4 (quasiquote (a (unquote (b 2)))) . 2)"))));
+		// macroexpand expands a copy
+		ASSERT_EQ(show(interpret(interp, Source("(macroexpand '(f (inc 1)))"))), show(interpret(interp, Source("'(f (+ 1 1))"))));
+		ASSERT_EQ(show(interpret(interp, Source("(macroexpand ''(inc 1))"))), show(interpret(interp, Source("''(inc 1)"))));
+
+		// names bound by a lambda shadow the macros of the same name
+		interpret(interp, Source("(defmacro twice (x) `(+ ,x ,x))"
+								 "(define f (lambda (twice) (twice 5)))"
+								 "(define g (lambda (n) ((lambda (ignored) (twice n)) (define twice (lambda (x) x)))))"
+								 "(defmacro h (twice) `(twice ,twice))"));
+		ASSERT_EQ(*interpret(interp, Source("(f (lambda (y) y))")).integer(), 5);
+		ASSERT_EQ(*interpret(interp, Source("(g 5)")).integer(), 5);
+		ASSERT_EQ(*interpret(interp, Source("(twice 5)")).integer(), 10);
+		ASSERT_EQ(*interpret(interp, Source("(h 4)")).integer(), 8);
+
+		ASSERT_THROW(interpret(interp, Source("(defmacro 1 (x) x)")), TypeError);
+		ASSERT_THROW(interpret(interp, Source("`(1 ,@2)")), TypeError);
+		ASSERT_THROW(interpret(interp, Source("(inc 1 2)")), EvalError);
+	}
+}
+
+TEST(Aot, Translate) {
+	const char* fib = "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))(fib 20)";
+	std::string cpp = aot::translate(Source(fib));
+	// integer operators inline & recursive calls of the struct
+	ASSERT_NE(cpp.find("std::get<long>(v_n.value) - (1L)"), std::string::npos);
+	ASSERT_NE(cpp.find("Lambda0{}(interp, t2)"), std::string::npos);
+	ASSERT_EQ(cpp.find("runtime::evaluate"), std::string::npos);
+	// once + is redefined it is called as any function, as is fib defined twice
+	std::string shadowed = aot::translate(Source(std::string(fib) + "(define + -)(define fib 1)"));
+	ASSERT_EQ(shadowed.find("std::get<long>(t3.value) + "), std::string::npos);
+	ASSERT_EQ(shadowed.find("Lambda0{}(interp, t"), std::string::npos);
+	ASSERT_NE(shadowed.find("site[0](interp"), std::string::npos);
+	// a define in a lambda is left to the tree walker
+	ASSERT_NE(aot::translate(Source("(define f (lambda (x) (define y x)))")).find("runtime::evaluate"), std::string::npos);
+}